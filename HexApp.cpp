@@ -94,6 +94,7 @@ public:
     HexGrid       mHexGrid;
     HexMapPtr     mHexMap;
     HexRenderPtr  mHexRender;
+    HexComponentIndexPtr mComponents;
 
     WarGame          mWarGame;
     StateManagerPtr  mStateManager;
@@ -115,7 +116,10 @@ void HexApp::setup()
     Vec2i wsize(getWindowSize());
 
     mHexMap    = HexMapPtr(new HexMap(mHexGrid, 64, 48));
+    //  cell colors come from the player colors and a few editor colors
+    mHexMap->setColorMode(HEX_PALETTE_COLOR);
     mHexRender = HexRenderPtr(new HexRender(*mHexMap));
+    mComponents = HexComponentIndexPtr(new HexComponentIndex(*mHexMap));
     mHexRender->setup(wsize);
     mMouse = MousePtr(new Mouse(wsize));
     mFactory = GuiFactoryPtr(new GuiFactory(mGui));
@@ -124,7 +128,7 @@ void HexApp::setup()
     //  Set console to full window width
     mConsole->setWidth(mMouse->getWindowSize().x);
 
-    SharedPtr shared(new Shared(*mHexMap, mHexMap->hexGrid(), *mHexRender, mGui, *mFactory, *mMouse, mWarGame, mConsole));
+    SharedPtr shared(new Shared(*mHexMap, mHexMap->hexGrid(), *mHexRender, *mComponents, mGui, *mFactory, *mMouse, mWarGame, mConsole));
 
     //  XXX hack -- required to pass the Shared object to Gui callbacks
     mGui.setShared(shared);
@@ -5,3 +5,8 @@
 #define RES_FRAG		CINDER_RESOURCE( ../data/, frag.glsl, 129, GLSL )
 #define RES_TEXTURE_PNG CINDER_RESOURCE( ../data/, texture.png, 130, PNG )
 #define RES_LAGUNA_PRESA_PNG  CINDER_RESOURCE( ../data/, LagunaPresa.png, 131, PNG )
+#define RES_INSTANCED_VERT    CINDER_RESOURCE( ../data/, instanced_vert.glsl, 132, GLSL )
+#define RES_INSTANCED_FRAG    CINDER_RESOURCE( ../data/, instanced_frag.glsl, 133, GLSL )
+#define RES_PROCEDURAL_VERT   CINDER_RESOURCE( ../data/, procedural_vert.glsl, 134, GLSL )
+#define RES_PROCEDURAL_FRAG   CINDER_RESOURCE( ../data/, procedural_frag.glsl, 135, GLSL )
+#define RES_PROCEDURAL_HEX    CINDER_RESOURCE( ../data/, procedural_hex.glsl, 136, GLSL )
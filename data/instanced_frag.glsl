@@ -0,0 +1,17 @@
+//  palette mode colors are looked up in a 256x1 texture of the map's palette
+uniform bool      usePalette;
+uniform sampler2D palette;
+
+varying vec2 paletteEntry;
+
+void main()
+{
+    if (usePalette) {
+        //  the index arrives normalised to 0..1, sample the centre of its texel
+        vec3 color = texture2D(palette, vec2((paletteEntry.x * 255.0 + 0.5) / 256.0, 0.5)).rgb;
+        gl_FragColor = vec4(color, paletteEntry.y);
+    }
+    else {
+        gl_FragColor = gl_Color;
+    }
+}
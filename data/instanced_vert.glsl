@@ -0,0 +1,27 @@
+//  One instance per hex of a chunk: gl_Vertex is the unit hex mesh, each
+//  instance supplies its offset from the chunk's origin and color
+//  xy world offset from chunkOrigin, zw the cell's column and row in the chunk
+attribute vec4 instanceOffset;
+//  RGBA, or (palette index, alpha) for palette mode maps
+attribute vec4 instanceColor;
+
+//  world position of the chunk's first cell, and the columns and rows of
+//  the chunk that are on the map
+uniform vec2 chunkOrigin;
+uniform vec2 chunkCells;
+
+varying vec2 paletteEntry;
+
+void main()
+{
+    if (instanceOffset.z >= chunkCells.x || instanceOffset.w >= chunkCells.y) {
+        //  collapse the whole hex to a point outside the clip volume
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    }
+    else {
+        vec2 offset = chunkOrigin + instanceOffset.xy;
+        gl_Position = gl_ModelViewProjectionMatrix * (gl_Vertex + vec4(offset, 0.0, 0.0));
+    }
+    gl_FrontColor = instanceColor;
+    paletteEntry = instanceColor.xy;
+}
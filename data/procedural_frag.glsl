@@ -0,0 +1,50 @@
+//  Procedural hexes: each pixel finds its cell with worldToHex() from
+//  procedural_hex.glsl, compiled in front of this file, then looks up the
+//  cell's color and owner in map-sized textures with a texel per cell.
+//  hextest checks the cell lookup and the border neighbour from
+//  procedural_hex.glsl, keep that logic there.
+uniform sampler2D cells;       //  RGBA
+uniform sampler2D owners;      //  owner + 1, low byte and high byte
+uniform vec2      mapSize;
+uniform float     borderWidth; //  world units either side of an owner border
+uniform vec2      selected;    //  selected cell, drawn with an outline
+uniform vec4      selectColor;
+uniform float     selectWidth;
+
+varying vec2 world;
+
+bool onMap(vec2 hex)
+{
+    return hex.x >= 0.0 && hex.y >= 0.0 && hex.x < mapSize.x && hex.y < mapSize.y;
+}
+
+vec2 ownerOf(vec2 hex)
+{
+    return texture2D(owners, (hex + 0.5) / mapSize).ra;
+}
+
+void main()
+{
+    vec2 hex = worldToHex(world);
+    if (!onMap(hex)) {
+        discard;
+    }
+    vec4 color = texture2D(cells, (hex + 0.5) / mapSize);
+
+    //  the side the pixel is nearest and its distance in from that side
+    vec2 centre = hexToWorld(hex);
+    vec2 offset = world - centre;
+    vec2 normal = nearestSide(offset);
+    float inside = 0.5 * spacing.y - dot(offset, normal);
+
+    //  darken either side of sides between cells of different owners
+    vec2 across = acrossSide(centre, normal);
+    if (inside < borderWidth && onMap(across) && ownerOf(across) != ownerOf(hex)) {
+        color.rgb *= 0.4;
+    }
+
+    if (hex == selected && inside < selectWidth) {
+        color = vec4(mix(color.rgb, selectColor.rgb, selectColor.a), max(color.a, selectColor.a));
+    }
+    gl_FragColor = color;
+}
@@ -0,0 +1,69 @@
+//  Hex cell lookup for procedural_frag.glsl, which HexRender compiles with
+//  this file in front of it.  tools/hextest.cpp also compiles this file as
+//  C++ to check it against HexGrid, so it must stay in the part of GLSL
+//  that hextest's definitions of vec2, floor(), mod() and the rest cover.
+uniform vec2 spacing;     //  column and row spacing
+
+//  Offset coordinates of the cell holding a world position, with the same
+//  cube rounding as HexGrid::WorldToHex
+vec2 worldToHex(vec2 pos)
+{
+    float x = pos.x / spacing.x;
+    float y = pos.y / spacing.y;
+    float z = -0.5 * x - y;
+          y = y - 0.5 * x;
+
+    float ix = floor(x + 0.5);
+    float iy = floor(y + 0.5);
+    float iz = floor(z + 0.5);
+    float s = ix + iy + iz;
+    if (s != 0.0) {
+        float dx = abs(ix - x);
+        float dy = abs(iy - y);
+        float dz = abs(iz - z);
+        if (dx >= dy && dx >= dz) {
+            ix -= s;
+        }
+        else if (dy >= dx && dy >= dz) {
+            iy -= s;
+        }
+        else {
+            iz -= s;
+        }
+    }
+
+    //  halved rounding towards zero, as the integer division it mirrors
+    float odd = mod(ix, 2.0);
+    float d = iy - iz;
+    float row = d < 0.0 ? d - odd : d + 1.0 - odd;
+    return vec2(ix, row < 0.0 ? ceil(row * 0.5) : floor(row * 0.5));
+}
+
+vec2 hexToWorld(vec2 hex)
+{
+    return vec2(hex.x * spacing.x, (hex.y + 0.5 * mod(hex.x, 2.0)) * spacing.y);
+}
+
+//  Normal of the side nearest an offset from a cell's centre, from the six
+//  side normals at 30 degrees and every 60 after
+vec2 nearestSide(vec2 offset)
+{
+    vec2 normal = vec2(0.0);
+    float best = -1.0e9;
+    for (int i=0; i < 6; ++i) {
+        float angle = radians(30.0 + 60.0 * float(i));
+        vec2 n = vec2(cos(angle), sin(angle));
+        float along = dot(offset, n);
+        if (along > best) {
+            best = along;
+            normal = n;
+        }
+    }
+    return normal;
+}
+
+//  The cell across the side of a cell centred at centre with that normal
+vec2 acrossSide(vec2 centre, vec2 normal)
+{
+    return worldToHex(centre + normal * spacing.y);
+}
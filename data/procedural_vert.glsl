@@ -0,0 +1,9 @@
+//  A single quad on the map plane over the cells in view, the fragment
+//  shader works out which hex each pixel is in
+varying vec2 world;
+
+void main()
+{
+    world = gl_Vertex.xy;
+    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+}
@@ -1,5 +1,9 @@
 #include "StateManager.h"
 #include "GuiController.h"
+#include "Hex.h"
+#include "WarGame.h"
+
+#include <vector>
 
 namespace war
 {
@@ -27,6 +31,19 @@ private:
     bool mDragStart;
     ci::Vec2f mDragOrigin;
     ci::Vec2f mDragEyeOrigin;
+
+    //  map cells and territory list before an edit
+    struct UndoStep
+    {
+        HexMapSnapshotPtr map;
+        TerritoryList     territories;
+    };
+    //  most recent last
+    std::vector<UndoStep> mUndo;
+    bool mPainting;
+
+    void pushUndo();
+    void undo();
 };
 
 }
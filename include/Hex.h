@@ -1,4 +1,8 @@
 #pragma once
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
 #include <string>
 #include <vector>
 
@@ -11,7 +15,10 @@
 
 #include "GuiController.h"
 
+#include "boost/cstdint.hpp"
+#include "boost/shared_ptr.hpp"
 #include "boost/unordered_set.hpp"
+#include "boost/unordered_map.hpp"
 #include "boost/foreach.hpp"
 #define FOREACH BOOST_FOREACH
 
@@ -28,34 +35,261 @@ enum HexDir {
     SOUTHWEST = 5
 };
 
-struct HexEdges {
-    //  
-    HexCoord mHex;
-    //  Edge data stored in lower 6 bits of a byte
-    unsigned char mEdges;
+//  Neighbour offsets in HexDir order.  The row offsets depend on whether the
+//  column is even or odd, index them with (x & 1).
+static const int HEX_NEIGHBOUR_DX[6] = { -1, 0, 1,  1,  0, -1 };
+static const int HEX_NEIGHBOUR_DY[2][6] = {
+    {  0, 1, 0, -1, -1, -1 },   //  even columns
+    {  1, 1, 1,  0, -1,  0 }    //  odd columns
+};
+
+//  Axial steps round a hexagon, see hexDistance() for axial coordinates.
+//  Walking radius steps in each direction in turn goes once round the ring
+//  of cells radius away, starting from the cell radius steps along the
+//  fifth.
+static const int HEX_AXIAL_DQ[6] = { 1,  1,  0, -1, -1, 0 };
+static const int HEX_AXIAL_DR[6] = { 0, -1, -1,  0,  1, 1 };
+
+//  Neighbour of a cell in direction dir
+inline HexCoord hexNeighbour(const HexCoord& pos, int dir)
+{
+    return HexCoord(pos.x + HEX_NEIGHBOUR_DX[dir], pos.y + HEX_NEIGHBOUR_DY[pos.x & 1][dir]);
+}
+
+//  Number of steps between two cells.  In axial coordinates (q, r) with
+//  q = x and r = y - x/2 the odd column shift disappears and the distance is
+//  the usual cube coordinate one.
+inline int hexDistance(const HexCoord& a, const HexCoord& b)
+{
+    int dq = b.x - a.x;
+    int dr = (b.y - (b.x >> 1)) - (a.y - (a.x >> 1));
+    return (std::abs(dq) + std::abs(dr) + std::abs(dq + dr)) / 2;
+}
+
+//  Steps through the cells on a straight line from a to b, both included,
+//  each a neighbour of the one before:
+//
+//      for (HexLine it(a, b); it; ++it) {
+//          visit(*it);
+//      }
+//
+//  Points are sampled evenly along the line in axial coordinates and
+//  rounded to the nearest cell.  The start is nudged off the line slightly
+//  so points exactly between two cells always round the same way.
+class HexLine
+{
+private:
+    double mQ;
+    double mR;
+    double mDq;
+    double mDr;
+    int    mSteps;
+    int    mStep;
+
+public:
+    HexLine(const HexCoord& a, const HexCoord& b)
+        : mQ(a.x + 1e-6), mR(a.y - (a.x >> 1) + 2e-6),
+          mDq(b.x - a.x), mDr((b.y - (b.x >> 1)) - (a.y - (a.x >> 1))),
+          mSteps(hexDistance(a, b)), mStep(0) { }
+
+    operator bool() const { return mStep <= mSteps; }
+    HexLine& operator++() { ++mStep; return *this; }
+
+    HexCoord operator*() const {
+        double t = mSteps ? static_cast<double>(mStep) / mSteps : 0.0;
+        double q = mQ + mDq * t;
+        double r = mR + mDr * t;
+        double s = -q - r;
+
+        //  round each cube coordinate, then fix the one furthest off so
+        //  they sum to zero again
+        int iq = static_cast<int>(floor(q + 0.5));
+        int ir = static_cast<int>(floor(r + 0.5));
+        int is = static_cast<int>(floor(s + 0.5));
+        double fq = fabs(iq - q);
+        double fr = fabs(ir - r);
+        double fs = fabs(is - s);
+        if (fq > fr && fq > fs) {
+            iq = -ir - is;
+        }
+        else if (fr > fs) {
+            ir = -iq - is;
+        }
+        return HexCoord(iq, ir + (iq >> 1));
+    }
+    //  cells stepped so far, 0 at a
+    int step() const { return mStep; }
+};
+
+//  Steps through the cells exactly radius steps from center, going round
+//  the ring.  With a size only cells inside (0,0)-size are visited, such as
+//  the cells on a HexMap with size = map.getSize().
+//
+//      for (HexRing it(pos, 3, map.getSize()); it; ++it) {
+//          visit(*it);
+//      }
+class HexRing
+{
+private:
+    int       mQ;
+    int       mR;
+    int       mRadius;
+    int       mSide;
+    int       mLeft;
+    int       mStep;
+    bool      mClip;
+    ci::Vec2i mSize;
 
-    HexEdges(HexCoord& hex) : mEdges(0), mHex(hex) { 
+    void advance() {
+        ++mStep;
+        if (mRadius == 0) {
+            mSide = 6;
+            return;
+        }
+        mQ += HEX_AXIAL_DQ[mSide];
+        mR += HEX_AXIAL_DR[mSide];
+        if (--mLeft == 0) {
+            mLeft = mRadius;
+            ++mSide;
+        }
+    }
+    bool inside() const {
+        HexCoord pos = **this;
+        return pos.x >= 0 && pos.y >= 0 && pos.x < mSize.x && pos.y < mSize.y;
+    }
+    void start(const HexCoord& center) {
+        mQ = center.x + HEX_AXIAL_DQ[4] * mRadius;
+        mR = center.y - (center.x >> 1) + HEX_AXIAL_DR[4] * mRadius;
+        while (mClip && *this && !inside()) {
+            advance();
+        }
     }
 
-    void addEdge(unsigned int edge) { mEdges |= 1 << edge; }
+public:
+    HexRing(const HexCoord& center, int radius) 
+        : mRadius(radius), mSide(0), mLeft(radius), mStep(0), mClip(false) { start(center); }
+    HexRing(const HexCoord& center, int radius, ci::Vec2i size) 
+        : mRadius(radius), mSide(0), mLeft(radius), mStep(0), mClip(true), mSize(size) { start(center); }
+
+    operator bool() const { return mSide < 6; }
+    HexRing& operator++() {
+        do {
+            advance();
+        } while (mClip && *this && !inside());
+        return *this;
+    }
 
-    //  Returns a vector of HexDir edges
-    std::vector<HexDir> getEdges() {
-        std::vector<HexDir> edges;
-        for (int i=0; i < 6; ++i) {
-            if ((1 << i) & mEdges) {
-                edges.push_back(static_cast<HexDir>(i));
+    HexCoord operator*() const { return HexCoord(mQ, mR + (mQ >> 1)); }
+    //  position round the ring from 0 to 6*radius-1, clipped cells included
+    int step() const { return mStep; }
+};
+
+//  Steps through the cells within radius steps of center, a column at a
+//  time from the left, optionally clipped to (0,0)-size like HexRing.
+//  Each column of a hexagon is a run of rows, so nothing outside it is
+//  visited.
+class HexRange
+{
+private:
+    int       mCx;
+    int       mR0;      //  axial r of the center
+    int       mRadius;
+    int       mX;
+    int       mXEnd;
+    int       mY;
+    int       mYEnd;
+    bool      mClip;
+    ci::Vec2i mSize;
+
+    //  find the rows of column mX, moving right past empty columns
+    void startColumn() {
+        for (; mX < mXEnd; ++mX) {
+            int dq = mX - mCx;
+            int top = mR0 + (mX >> 1);
+            mY    = top + std::max(-mRadius, -dq - mRadius);
+            mYEnd = top + std::min(mRadius, mRadius - dq) + 1;
+            if (mClip) {
+                mY    = std::max(mY, 0);
+                mYEnd = std::min(mYEnd, mSize.y);
+            }
+            if (mY < mYEnd) {
+                return;
             }
         }
-        return edges;
     }
+    void start(const HexCoord& center) {
+        mCx = center.x;
+        mR0 = center.y - (center.x >> 1);
+        mX = center.x - mRadius;
+        mXEnd = center.x + mRadius + 1;
+        if (mClip) {
+            mX = std::max(mX, 0);
+            mXEnd = std::min(mXEnd, mSize.x);
+        }
+        startColumn();
+    }
+
+public:
+    HexRange(const HexCoord& center, int radius) 
+        : mRadius(radius), mClip(false) { start(center); }
+    HexRange(const HexCoord& center, int radius, ci::Vec2i size) 
+        : mRadius(radius), mClip(true), mSize(size) { start(center); }
 
-    HexCoord getHexCoord() { return mHex; }
-    bool hasEdge(HexDir edge) {
-        return (mEdges & (1 << static_cast<unsigned int>(edge)));
+    operator bool() const { return mX < mXEnd; }
+    HexRange& operator++() {
+        if (++mY == mYEnd) {
+            ++mX;
+            startColumn();
+        }
+        return *this;
     }
 
-    void reset() { mEdges = 0; }
+    HexCoord operator*() const { return HexCoord(mX, mY); }
+};
+
+//  Steps through the neighbours of a cell in HexDir order without building
+//  a HexAdjacent:
+//
+//      for (HexNeighbours it(pos); it; ++it) {
+//          visit(*it, it.dir());
+//      }
+class HexNeighbours
+{
+private:
+    HexCoord   mPos;
+    const int* mDy;
+    int        mDir;
+
+public:
+    explicit HexNeighbours(const HexCoord& pos) 
+        : mPos(pos), mDy(HEX_NEIGHBOUR_DY[pos.x & 1]), mDir(0) { }
+
+    operator bool() const { return mDir < 6; }
+    HexNeighbours& operator++() { ++mDir; return *this; }
+
+    HexCoord operator*() const { 
+        return HexCoord(mPos.x + HEX_NEIGHBOUR_DX[mDir], mPos.y + mDy[mDir]); 
+    }
+    HexDir dir() const { return static_cast<HexDir>(mDir); }
+};
+
+//  One side of a hex, the side shared with its neighbour in direction dir
+struct HexEdge {
+    HexCoord cell;
+    HexDir   dir;
+
+    HexEdge() { }
+    HexEdge(const HexCoord& cell, HexDir dir) : cell(cell), dir(dir) { }
+};
+
+//  A closed outline of a region.  Consecutive edges share a corner and the
+//  last edge joins the first.  The region is always on the right, so outer
+//  boundaries run clockwise and holes run anticlockwise.
+struct HexEdgeLoop {
+    std::vector<HexEdge> edges;
+    bool hole;
+
+    HexEdgeLoop() : hole(false) { }
 };
 
 //  Adjacency check results
@@ -119,29 +353,39 @@ public:
     HexCoord  WorldToHex(ci::Vec3f worldPos);
     ci::Vec3f HexToWorld(HexCoord hexPos, bool scale=true);
 
+    //  Convert count points at once, two (WorldToHex) or four (HexToWorld)
+    //  at a time with SSE2 where available.  Results are identical to
+    //  converting each point with the functions above.
+    void WorldToHex(const ci::Vec3f* worldPos, HexCoord* out, size_t count);
+    void HexToWorld(const HexCoord* hexPos, ci::Vec3f* out, size_t count, bool scale=true);
+
     HexAdjacent adjacent(HexCoord pos);
 };
 
+class HexMap;
+
+//  Handle to a single cell of a HexMap
+//
+//  Cell data lives in the map's owner, land and color planes.  A HexCell only
+//  records the map and cell index, so it is cheap to copy and pass by value,
+//  and is valid only as long as the map it came from.
 class HexCell
 {
 public:
-    HexCell();
-    ~HexCell();
-
-    void setPos(HexCoord& pos);
+    HexCell(HexMap& map, int index) : mMap(&map), mIndex(index) { }
 
-    void       setColor(ci::ColorA& color);
-    ci::ColorA& getColor();
+    void       setColor(const ci::ColorA& color);
+    ci::ColorA getColor();
     int  getLand();
     void setLand(int land);
     int  getOwner();
     void setOwner(int id);
 
+    int  getIndex() { return mIndex; }
+
 private:
-    HexCoord   mPos;
-    ci::ColorA mColor;
-    int        mLand;  //  0 for sea, 1 for land
-    int        mOwner; //  player owner ID
+    HexMap* mMap;
+    int     mIndex;
 };
 
 // XXX replace with Territory
@@ -164,7 +408,7 @@ struct ConnectedByOwner
     int mOwner;
 
     ConnectedByOwner(int ownerId) : mOwner(ownerId) { }
-    bool operator()(HexCell& cell) {
+    bool operator()(HexCell cell) {
         return (mOwner >=0 && cell.getOwner() == mOwner);
     }
 };
@@ -182,83 +426,603 @@ struct HexConnectivity
 //  hex (HexParent)
 typedef std::pair<HexCoord, HexCoord> HexParent;
 
+//  HexMap storage is split into square chunks of HEX_CHUNK_SIZE cells a side
+enum {
+    HEX_CHUNK_SHIFT = 4,
+    HEX_CHUNK_SIZE  = 1 << HEX_CHUNK_SHIFT,
+    HEX_CHUNK_MASK  = HEX_CHUNK_SIZE - 1,
+    HEX_CHUNK_CELLS = HEX_CHUNK_SIZE * HEX_CHUNK_SIZE
+};
+
+//  Territory IDs are shorts in the chunks' territory plane, so a map holds
+//  at most this many territories
+enum {
+    HEX_MAX_TERRITORIES = SHRT_MAX + 1
+};
+
+//  How a HexMap stores cell colors, see HexMap::setColorMode()
+enum HexColorMode {
+    HEX_FULL_COLOR,     //  a ColorA per cell
+    HEX_PALETTE_COLOR   //  a HexPalette index and an alpha byte per cell
+};
+
+//  Up to 256 colors shared by the cells of a palette mode map
+//
+//  Colors are matched on their 8 bit RGB values, which is all the renderer
+//  can show anyway.  Once the palette is full a new color maps to the
+//  nearest entry.  Entries are only ever added, so an index keeps its color.
+class HexPalette
+{
+public:
+    enum { MAX_COLORS = 256 };
+
+private:
+    std::vector<ci::Color>                               mColors;
+    boost::unordered_map<boost::uint32_t, unsigned char> mLookup;
+
+    static boost::uint32_t key(const ci::Color& color);
+
+public:
+    HexPalette() { }
+
+    int  size() const { return static_cast<int>(mColors.size()); }
+    bool full() const { return mColors.size() == MAX_COLORS; }
+    const ci::Color& operator[](int index) const { return mColors[index]; }
+
+    //  Index of a color, -1 if it is not in the palette
+    int find(const ci::Color& color) const;
+    //  Index of a color, adding it (or taking the nearest when full)
+    int add(const ci::Color& color);
+};
+typedef boost::shared_ptr<HexPalette> HexPalettePtr;
+
+//  A tile of cells stored as separate planes.  Cells are ordered
+//  column-major within the chunk, (x << HEX_CHUNK_SHIFT) | y.  The color
+//  plane depends on the map's HexColorMode, so chunks are allocated as
+//  HexColorChunk or HexPaletteChunk.  Chunks are cache-line aligned, see
+//  operator new.
+struct HexChunk
+{
+    short         owner[HEX_CHUNK_CELLS];  //  player owner ID
+    unsigned char land[HEX_CHUNK_CELLS];   //  0 for sea, 1 for land
+    short         territory[HEX_CHUNK_CELLS]; //  territory ID, -1 for none
+
+    //  true if any cell in the chunk is land
+    bool hasLand() const;
+    //  true if any cell in the chunk belongs to a territory
+    bool hasTerritory() const;
+
+    static void* operator new(size_t bytes);
+    static void  operator delete(void* p);
+};
+typedef boost::shared_ptr<HexChunk> HexChunkPtr;
+
+//  HEX_FULL_COLOR chunk
+struct HexColorChunk : public HexChunk
+{
+    ci::ColorA    color[HEX_CHUNK_CELLS];
+};
+
+//  HEX_PALETTE_COLOR chunk, an eighth of the color memory
+struct HexPaletteChunk : public HexChunk
+{
+    unsigned char colorIndex[HEX_CHUNK_CELLS];
+    unsigned char alpha[HEX_CHUNK_CELLS];
+};
+
+//  Color of a cell in a chunk of either mode
+inline ci::ColorA hexChunkColor(const HexChunk* chunk, int cell, HexColorMode mode, 
+                                const HexPalette& palette)
+{
+    if (mode == HEX_PALETTE_COLOR) {
+        const HexPaletteChunk* c = static_cast<const HexPaletteChunk*>(chunk);
+        return ci::ColorA(palette[c->colorIndex[cell]], c->alpha[cell] * (1.0f / 255.0f));
+    }
+    return static_cast<const HexColorChunk*>(chunk)->color[cell];
+}
+
+//  Bytes of a chunk of either mode
+inline size_t hexChunkBytes(HexColorMode mode)
+{
+    return mode == HEX_PALETTE_COLOR ? sizeof(HexPaletteChunk) : sizeof(HexColorChunk);
+}
+
+//  Order of a HexMap's chunks, and so of its cell indices
+enum HexCellOrder {
+    HEX_ORDER_COLUMNS,  //  chunks column-major over the map
+    HEX_ORDER_TILED     //  chunks Z-ordered within square tiles of chunks
+};
+
+//  Chunk numbering for a map size and HexCellOrder
+//
+//  Chunks are grouped into tiles of 1 << tileShift chunks a side.  Tiles are
+//  numbered column-major and the chunks inside a tile along a Z-order
+//  (Morton) curve, so cells near each other on the map are near each other
+//  in anything indexed by cell, whichever way they lie.  A tile shift of 0
+//  is plain column-major order.  Tiles overhanging the map edge leave gaps
+//  in the numbering; chunks in the gaps are never resident.
+struct HexChunkLayout
+{
+    enum { TILE_SHIFT = 3 };  //  8x8 chunks, 128x128 cells
+
+    ci::Vec2i grid;   //  chunks across and down the map
+    ci::Vec2i tiles;  //  tiles across and down the map
+    int       tileShift;
+
+    HexChunkLayout() : tileShift(0) { }
+    HexChunkLayout(ci::Vec2i size, HexCellOrder order);
+
+    //  chunk numbers in use, gaps included
+    int count() const { return (tiles.x * tiles.y) << (2*tileShift); }
+
+    //  interleave the low three bits of v with zeros, and back
+    static int spread(int v) { return (v & 1) | ((v & 2) << 1) | ((v & 4) << 2); }
+    static int compact(int v) { return (v & 1) | ((v >> 1) & 2) | ((v >> 2) & 4); }
+
+    //  chunk at chunk column cx, row cy
+    int chunkAt(int cx, int cy) const {
+        int mask = (1 << tileShift) - 1;
+        int tile = (cx >> tileShift) * tiles.y + (cy >> tileShift);
+        return (tile << (2*tileShift)) | (spread(cx & mask) << 1) | spread(cy & mask);
+    }
+    //  chunk column and row of a chunk number
+    ci::Vec2i chunkPos(int chunk) const {
+        int tile  = chunk >> (2*tileShift);
+        int local = chunk & ((1 << (2*tileShift)) - 1);
+        return ci::Vec2i(((tile / tiles.y) << tileShift) | compact(local >> 1), 
+                         ((tile % tiles.y) << tileShift) | compact(local));
+    }
+
+    //  Cell indices encode the chunk in the high bits and the cell within
+    //  the chunk, column-major, in the low HEX_CHUNK_SHIFT*2 bits
+    int index(const HexCoord& pos) const {
+        return (chunkAt(pos.x >> HEX_CHUNK_SHIFT, pos.y >> HEX_CHUNK_SHIFT) << (2*HEX_CHUNK_SHIFT)) 
+            | ((pos.x & HEX_CHUNK_MASK) << HEX_CHUNK_SHIFT) | (pos.y & HEX_CHUNK_MASK);
+    }
+    HexCoord coord(int index) const {
+        ci::Vec2i chunk = chunkPos(index >> (2*HEX_CHUNK_SHIFT));
+        int cell = index & (HEX_CHUNK_CELLS-1);
+        return HexCoord((chunk.x << HEX_CHUNK_SHIFT) | (cell >> HEX_CHUNK_SHIFT), 
+                        (chunk.y << HEX_CHUNK_SHIFT) | (cell & HEX_CHUNK_MASK));
+    }
+};
+
+//  Read-only copy of a HexMap's cells, see HexMap::snapshot()
+//
+//  A snapshot shares chunks with the map it was taken from.  The map copies
+//  a shared chunk before its first write, so a snapshot never changes and
+//  any number of threads may read it while the map keeps being edited.
+class HexMapSnapshot
+{
+private:
+    ci::Vec2i                mSize;
+    HexChunkLayout           mLayout;
+    std::vector<HexChunkPtr> mChunks;
+    ci::ColorA               mDefaultColor;
+    HexColorMode             mColorMode;
+    HexPalettePtr            mPalette;
+
+    friend class HexMap;
+    HexMapSnapshot() { }
+
+public:
+    ci::Vec2i getSize() const { return mSize; }
+    ci::Vec2i getChunkGrid() const { return mLayout.grid; }
+
+    //  Same cell indices as HexMap::index()
+    int index(const HexCoord& pos) const { return mLayout.index(pos); }
+    bool isValid(const HexCoord& pos) const {
+        return pos.x >= 0 && pos.y >= 0 && pos.x < mSize.x && pos.y < mSize.y;
+    }
+
+    ci::ColorA getColor(int index) const { 
+        const HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? hexChunkColor(chunk, index & (HEX_CHUNK_CELLS-1), mColorMode, *mPalette) 
+                     : mDefaultColor;
+    }
+    int getOwner(int index) const { 
+        const HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? chunk->owner[index & (HEX_CHUNK_CELLS-1)] : -1;
+    }
+    int getLand(int index) const { 
+        const HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? chunk->land[index & (HEX_CHUNK_CELLS-1)] : 0;
+    }
+    int getTerritory(int index) const { 
+        const HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? chunk->territory[index & (HEX_CHUNK_CELLS-1)] : -1;
+    }
+
+    //  null for chunks that were unwritten when the snapshot was taken
+    const HexChunk* getChunk(int chunk) const { return mChunks[chunk].get(); }
+    HexColorMode getColorMode() const { return mColorMode; }
+    const HexPalette& getPalette() const { return *mPalette; }
+};
+typedef boost::shared_ptr<const HexMapSnapshot> HexMapSnapshotPtr;
+
+//  Notified of changes to HexMap cells, see HexMap::addListener
+class HexMapListener
+{
+public:
+    virtual ~HexMapListener() { }
+
+    //  a cell's owner changed from oldOwner to newOwner
+    virtual void ownerChanged(int index, int oldOwner, int newOwner) { }
+    //  HexMap::clear() reset every owner and color
+    virtual void mapCleared() { }
+    //  cells were replaced in bulk, see HexMap::endReplace()
+    virtual void mapLoaded() { }
+};
+
+//  Cells of a HexMap changed since the tracker was last cleared
+//
+//  Each consumer of changes (renderer, network sync, stats) owns a tracker
+//  and drains it on its own schedule.  A changed cell is set in a bitmap
+//  indexed by cell index, so each chunk's cells are a run of 
+//  HEX_CHUNK_CELLS bits, and is appended to the cell list the first time it
+//  changes.  Marking and clearing cost time proportional to the changes.
+class HexDirtyTracker
+{
+public:
+    //  cell fields a tracker can watch
+    enum Field {
+        COLOR = 1,
+        OWNER = 2,
+        LAND  = 4,
+        ALL   = 7
+    };
+
+private:
+    HexMap& mHexMap;
+    int     mFields;
+    bool    mAll;
+
+    std::vector<boost::uint64_t> mBits;
+    std::vector<int>             mCells;
+    std::vector<int>             mChunks;
+
+    //  registered with the map
+    HexDirtyTracker(const HexDirtyTracker&);
+    HexDirtyTracker& operator=(const HexDirtyTracker&);
+
+public:
+    //  Registers with the map, which must outlive the tracker
+    HexDirtyTracker(HexMap& map, int fields=ALL);
+    ~HexDirtyTracker();
+
+    int getFields() { return mFields; }
+
+    void mark(int index) {
+        boost::uint64_t& word = mBits[index >> 6];
+        boost::uint64_t  bit  = boost::uint64_t(1) << (index & 63);
+        if (word & bit) {
+            return;
+        }
+        if (!isChunkDirty(index >> (2*HEX_CHUNK_SHIFT))) {
+            mChunks.push_back(index >> (2*HEX_CHUNK_SHIFT));
+        }
+        word |= bit;
+        mCells.push_back(index);
+    }
+    //  Flag every cell as changed without listing them, for bulk changes
+    void markAll() { mAll = true; }
+
+    //  True after markAll(), consumers should then refresh everything
+    bool isAllDirty() { return mAll; }
+    bool isDirty(int index) { return mAll || ((mBits[index >> 6] >> (index & 63)) & 1) != 0; }
+    bool isChunkDirty(int chunk) {
+        const boost::uint64_t* words = &mBits[chunk * (HEX_CHUNK_CELLS / 64)];
+        return (words[0] | words[1] | words[2] | words[3]) != 0;
+    }
+    bool empty() { return !mAll && mCells.empty(); }
+
+    //  Changed cell indices and the chunks holding them, each listed once
+    //  in the order they first changed
+    const std::vector<int>& getCells() { return mCells; }
+    const std::vector<int>& getChunks() { return mChunks; }
+
+    //  Forget all changes
+    void clear();
+};
+
 class HexMap
 {
 private:
     HexGrid& mHexGrid;
     ci::Vec2i mSize;
-    HexCell** mCells;
+
+    //  Sparse chunked cell storage.  mChunks holds one pointer per chunk,
+    //  numbered by mLayout, and is null until a cell in that chunk is first written
+    //  with a non-default value.  Reads of absent chunks return the defaults
+    //  below, so large maps that are mostly sea cost almost nothing.  One
+    //  extra, always absent, entry at the end backs defaultCell().
+    //
+    //  Chunks may be shared with snapshots and are copied on the first write
+    //  after a snapshot, see writableChunk().
+    HexChunkLayout           mLayout;
+    std::vector<HexChunkPtr> mChunks;
+    int                      mResidentChunks;
+
+    ci::ColorA mDefaultColor;
+
+    //  Cell colors.  The palette is shared with snapshots like the chunks
+    //  and copied before an entry is added to a shared one.  The default
+    //  color is always in it, as mDefaultIndex.
+    HexColorMode  mColorMode;
+    HexPalettePtr mPalette;
+    unsigned char mDefaultIndex;
+    unsigned char mDefaultAlpha;
+
+    int paletteIndex(const ci::Color& color);
+
+    //  an unlisted chunk of the current color mode, holding defaults or a
+    //  copy of another chunk
+    HexChunkPtr newChunk();
+    HexChunkPtr newChunk(const HexChunk& copy);
+
+    HexChunk* allocChunk(int chunk);
+    //  a chunk this map alone owns, copied first if a snapshot shares it, or
+    //  null if the chunk is not resident
+    HexChunk* writableChunk(int chunk);
+
+    //  Flood fill scratch space, kept between searches so connected() does
+    //  not allocate.  mVisited is indexed by cell index: a cell was reached
+    //  by the current search and failed the predicate if its entry equals
+    //  mSearchStamp, and passed it if the entry equals mSearchStamp+1.
+    std::vector<unsigned int> mVisited;
+    unsigned int              mSearchStamp;
+    std::vector<int>          mSearchQueue;
+
+    //  start a new search, invalidating all visited marks in O(1)
+    void beginSearch();
+
+    //  neighbour cell indices, six per cell index, see neighbourIndex()
+    std::vector<int> mNeighbourIndex;
+    void buildNeighbourIndex();
+
+    //  Boundary edges still to be walked by extractEdges(), one bit per
+    //  HexDir by cell index.  The walk clears every bit it sets.
+    std::vector<unsigned char> mEdgeMask;
+
+    std::vector<HexMapListener*> mListeners;
+    std::vector<HexDirtyTracker*> mTrackers;
+
+    void markDirty(int index, int field) {
+        FOREACH (HexDirtyTracker* tracker, mTrackers) {
+            if (tracker->getFields() & field) {
+                tracker->mark(index);
+            }
+        }
+    }
+
+    //  non-copyable, the chunks are owned by the map
+    HexMap(const HexMap&);
+    HexMap& operator=(const HexMap&);
 
 public:
-    HexMap(HexGrid& grid, int width, int height);
+    //  The cell order only affects performance: HEX_ORDER_TILED keeps
+    //  neighbouring chunks close in memory for searches over large maps
+    HexMap(HexGrid& grid, int width, int height, HexCellOrder order=HEX_ORDER_COLUMNS);
     ~HexMap();
 
-    HexCell& at(HexCoord& pos);
+    HexCell at(const HexCoord& pos);
     ci::Vec2i getSize();
 
-    //  Find all connected land cells belonging to the same player
-    //  predicate -- a functor taking a HexCell or reference as its only argument
+    //  Cell indices encode the chunk in the high bits and the cell within the
+    //  chunk in the low HEX_CHUNK_SHIFT*2 bits, see HexChunkLayout.  Only
+    //  valid for isValid() coords.
+    int index(const HexCoord& pos) { return mLayout.index(pos); }
+    HexCoord coord(int index) { return mLayout.coord(index); }
+    //  Precomputed neighbours: neighbourIndex()[index*6 + dir] is the cell
+    //  index of the neighbour in HexDir dir, or -1 if it is off the map.
+    //  Built on first use and kept for the life of the map.
+    const int* neighbourIndex() {
+        if (mNeighbourIndex.empty()) {
+            buildNeighbourIndex();
+        }
+        return &mNeighbourIndex[0];
+    }
+
+    //  Number of cells on the map
+    int getCellCount() { return mSize.x * mSize.y; }
+    //  Upper bound (exclusive) of cell indices, for arrays indexed by cell
+    int getIndexLimit() { return getChunkCount() * HEX_CHUNK_CELLS; }
+
+    //  Per-cell access by index
+    ci::ColorA getColor(int index) { 
+        HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? hexChunkColor(chunk, index & (HEX_CHUNK_CELLS-1), mColorMode, *mPalette) 
+                     : mDefaultColor;
+    }
+    int getOwner(int index) { 
+        HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? chunk->owner[index & (HEX_CHUNK_CELLS-1)] : -1;
+    }
+    int getLand(int index) { 
+        HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? chunk->land[index & (HEX_CHUNK_CELLS-1)] : 0;
+    }
+    //  Palette mode only, a cell's palette index and alpha byte
+    int getColorIndex(int index) {
+        HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? static_cast<HexPaletteChunk*>(chunk)->colorIndex[index & (HEX_CHUNK_CELLS-1)] 
+                     : mDefaultIndex;
+    }
+    int getAlpha(int index) {
+        HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? static_cast<HexPaletteChunk*>(chunk)->alpha[index & (HEX_CHUNK_CELLS-1)] 
+                     : mDefaultAlpha;
+    }
+    void setColor(int index, const ci::ColorA& color);
+    void setOwner(int index, int id);
+    void setLand(int index, int land);
+
+    //  Territory of a cell, its position in a TerritoryList, or -1 for
+    //  none.  TerritoryList keeps these in step with its territories.  IDs
+    //  are below HEX_MAX_TERRITORIES.  They are a chunk plane like owners,
+    //  so snapshots, restore() and map files carry them.
+    int getTerritory(int index) {
+        HexChunk* chunk = mChunks[index >> (2*HEX_CHUNK_SHIFT)].get();
+        return chunk ? chunk->territory[index & (HEX_CHUNK_CELLS-1)] : -1;
+    }
+    void setTerritory(int index, int id);
+    void clearTerritories();
+
+    //  Chunk access.  Chunks are numbered by the cell order over
+    //  getChunkGrid(), find them with chunkAt().  getChunkCount() includes
+    //  the gaps of HEX_ORDER_TILED, which are never resident.
+    HexCellOrder getCellOrder() { return mLayout.tileShift ? HEX_ORDER_TILED : HEX_ORDER_COLUMNS; }
+    ci::Vec2i getChunkGrid() { return mLayout.grid; }
+    int       getChunkCount() { return mLayout.count(); }
+    int       chunkAt(int cx, int cy) { return mLayout.chunkAt(cx, cy); }
+    int       getResidentChunkCount() { return mResidentChunks; }
+    //  returns null for chunks that have never been written.  Chunks are
+    //  written through the map only, they may be shared with snapshots.
+    const HexChunk* getChunk(int chunk) { return mChunks[chunk].get(); }
+    HexCoord  chunkOrigin(int chunk) { return mLayout.chunkPos(chunk) * HEX_CHUNK_SIZE; }
+    //  chunk containing a valid map position
+    int chunkIndex(const HexCoord& pos) {
+        return mLayout.chunkAt(pos.x >> HEX_CHUNK_SHIFT, pos.y >> HEX_CHUNK_SHIFT);
+    }
+    bool isResident(const HexCoord& pos) { return mChunks[chunkIndex(pos)].get() != 0; }
+
+    //  Memory used by a chunk's cells (0 when not resident), and by the whole
+    //  map including the chunk table
+    size_t chunkMemory(int chunk) { return mChunks[chunk] ? hexChunkBytes(mColorMode) : 0; }
+    size_t getMemoryUsage();
+
+    //  Listeners are not owned by the map and must be removed before they
+    //  are destroyed
+    void addListener(HexMapListener* listener);
+    void removeListener(HexMapListener* listener);
+
+    //  Color storage.  Palette mode keeps a byte of palette index and a byte
+    //  of alpha per cell instead of a ColorA; colors are quantised to 8 bits
+    //  a channel and limited to HexPalette::MAX_COLORS distinct RGB values.
+    //  Changing mode converts every resident chunk and flags every tracker.
+    HexColorMode getColorMode() { return mColorMode; }
+    void setColorMode(HexColorMode mode);
+    const HexPalette& getPalette() { return *mPalette; }
+    //  Replace the palette, for loading palette mode chunks.  Cells keep
+    //  their indices, the default color is added if missing.
+    void setPalette(const HexPalette& palette);
+
+    //  Bulk replacement, for loading: copy a whole chunk's cells from data,
+    //  a chunk of the map's color mode, or reset them to the defaults when
+    //  data is null.  Nothing is told until endReplace() flags every tracker
+    //  and calls mapLoaded().
+    void replaceChunk(int chunk, const HexChunk* data);
+    void endReplace();
+
+    //  Copy-on-write snapshot of every cell, for undo and look-ahead.  Costs
+    //  one pointer copy per chunk; each chunk is copied at most once, when
+    //  the map next writes to it.  Take snapshots on the thread that edits
+    //  the map, they can then be read and released from any thread.
+    HexMapSnapshotPtr snapshot();
+    //  Put every cell back as it was in a snapshot of this map.  Trackers
+    //  are marked for the chunks that differ, listeners get mapLoaded().
+    void restore(const HexMapSnapshot& snapshot);
+
+    //  Trackers register themselves, see HexDirtyTracker
+    void addTracker(HexDirtyTracker* tracker);
+    void removeTracker(HexDirtyTracker* tracker);
+
+    //  A cell holding the default values of unwritten chunks
+    HexCell defaultCell() { return HexCell(*this, getChunkCount() << (2*HEX_CHUNK_SHIFT)); }
+    ci::ColorA getDefaultColor() { return mDefaultColor; }
+
+    //  Find all connected cells matching a predicate, breadth first from pos
+    //  predicate -- a functor taking a HexCell as its only argument
+    //
+    //  Search state lives in the map, so only one search may run at a time.
     template <typename T>
-    // std::vector<HexCoord> connected(HexCoord pos, T predicate)
     HexConnectivity connected(HexCoord pos, T predicate)
     {
         HexConnectivity conn;
+        connected(pos, predicate, conn);
+        return conn;
+    }
 
-        boost::unordered_set<HexCoord> search;
-        boost::unordered_set<HexCoord> checked;
-        boost::unordered_set<HexCoord> matched;
-        boost::unordered_set<HexCoord> borders;
-
-        // int owner = at(pos).getOwner();
-        search.emplace(pos);
-        while (!search.empty()) {
-            // HexParent checkParent = *(search.begin());
-            HexCoord check = *(search.begin());
-            // HexCoord& check = checkParent.first;
-
-            if (predicate(at(check)) == true) {
-                // match
-                conn.cells.push_back(check);            
-                matched.emplace(check);
-
-                std::vector<HexCoord> adjacent = mHexGrid.adjacent(check).toVector();
-                FOREACH (HexCoord coord, adjacent) {
-                    if (isValid(coord) && checked.find(coord) == checked.end()) {
-                        //  queue this cell and track its origin (parent)
-                        search.emplace(coord);
-                    }
+    //  As above, filling conn in place so its vectors' capacity is reused
+    template <typename T>
+    void connected(HexCoord pos, T predicate, HexConnectivity& conn)
+    {
+        conn.cells.clear();
+        conn.borderCells.clear();
+        beginSearch();
+
+        //  cells in unwritten chunks all match or all fail the predicate, so
+        //  evaluate it once and skip them without a lookup when they fail
+        bool defaultMatch = predicate(defaultCell());
+        const int* neighbours = neighbourIndex();
+
+        int start = index(pos);
+        if (!predicate(HexCell(*this, start))) {
+            //  nothing connected, but matching neighbours still border pos
+            for (int i=0; i < 6; ++i) {
+                int cell = neighbours[start*6 + i];
+                if (cell >= 0 && predicate(HexCell(*this, cell))) {
+                    conn.borderCells.push_back(coord(cell));
                 }
             }
-            else {
-                //  XXX slightly inefficient, would be better to selectively check adjacent
-                //  cells based on matched and non-matches
-                std::vector<HexCoord> adjacent = mHexGrid.adjacent(check).toVector();
-                FOREACH (HexCoord coord, adjacent) {
-                    if (predicate(at(coord))) {
-                        borders.emplace(coord);
+            return;
+        }
+
+        const unsigned int failed  = mSearchStamp;
+        const unsigned int matched = mSearchStamp + 1;
+
+        mVisited[start] = matched;
+        mSearchQueue.push_back(start);
+
+        //  the queue only ever holds matched cells, each is evaluated once
+        for (size_t head=0; head < mSearchQueue.size(); ++head) {
+            int check = mSearchQueue[head];
+            HexCoord checkPos = coord(check);
+            conn.cells.push_back(checkPos);
+
+            bool border = false;
+            const int* adjacent = neighbours + check*6;
+            for (int i=0; i < 6; ++i) {
+                int cell = adjacent[i];
+                if (cell < 0) {
+                    continue;
+                }
+                unsigned int& visited = mVisited[cell];
+                if (visited == matched) {
+                    continue;
+                }
+                if (visited != failed) {
+                    bool match = (defaultMatch || mChunks[cell >> (2*HEX_CHUNK_SHIFT)].get())
+                        && predicate(HexCell(*this, cell));
+                    visited = match ? matched : failed;
+                    if (match) {
+                        mSearchQueue.push_back(cell);
+                        continue;
                     }
                 }
+                border = true;
             }
-            checked.emplace(check);
-            search.erase(check);
-        }
 
-        conn.cells       = std::vector<HexCoord>(matched.begin(), matched.end());
-        conn.borderCells = std::vector<HexCoord>(borders.begin(), borders.end());
-        return conn;
+            if (border) {
+                conn.borderCells.push_back(checkPos);
+            }
+        }
     }
 
-    std::vector<HexEdges> extractEdges(HexConnectivity& conn);
+    //  Outlines of a set of cells such as connected().cells: the outer
+    //  boundary of each region and one loop per hole.  Sides on the map edge
+    //  are boundary too.  Linear in the number of cells, the map is not
+    //  changed.
+    std::vector<HexEdgeLoop> extractEdges(const HexConnectivity& conn);
+    void extractEdges(const HexConnectivity& conn, std::vector<HexEdgeLoop>& loops);
 
-    //  XXX should move to WarGame
-    //std::vector<int> countHexes();
+    //  per-owner hex counts are in HexBitboards::countHexes()
 
     //  Check position lies within hex map
-    bool isValid(HexCoord& pos);
+    bool isValid(const HexCoord& pos);
     HexGrid& hexGrid() { return mHexGrid; }
 
-    // obsolete?  scan territory for regions
-    // std::vector<HexRegion> regions();
+    //  whole map region scans are done by HexRegionLabeling
 
     //  clear all map tiles
     void clear();
@@ -266,6 +1030,67 @@ public:
 };
 typedef boost::shared_ptr<HexMap> HexMapPtr;
 
+inline void HexCell::setColor(const ci::ColorA& color) { mMap->setColor(mIndex, color); }
+inline ci::ColorA HexCell::getColor() { return mMap->getColor(mIndex); }
+inline int  HexCell::getLand() { return mMap->getLand(mIndex); }
+inline void HexCell::setLand(int land) { mMap->setLand(mIndex, land); }
+inline int  HexCell::getOwner() { return mMap->getOwner(mIndex); }
+inline void HexCell::setOwner(int id) { mMap->setOwner(mIndex, id); }
+
+//  The part of the hex plane z=0 in view of a camera
+//
+//  The view frustum cut by the plane is a convex polygon, found from where
+//  the frustum's twelve edges cross the plane: its four corner rays and
+//  the edges of the near and far clip rectangles.  It is right for a
+//  camera tilted towards the horizon, where a corner ray can miss the
+//  plane altogether, as well as one looking straight down.
+//
+//  Chunks are found a column of chunks at a time from the span of the
+//  polygon over the column, so the cost is in the chunks in view rather
+//  than the cells or the bounding rectangle.
+class HexViewRegion
+{
+private:
+    std::vector<ci::Vec2f> mPolygon;
+
+public:
+    //  Cut a frustum given by the corners of its near and far clip
+    //  rectangles, each in order round the rectangle
+    void setFrustum(const ci::Vec3f* nearCorners, const ci::Vec3f* farCorners);
+    void setPolygon(const std::vector<ci::Vec2f>& polygon) { mPolygon = polygon; }
+    //  Corners in order round the polygon, empty if nothing of the plane
+    //  is in view
+    const std::vector<ci::Vec2f>& getPolygon() { return mPolygon; }
+    bool empty() { return mPolygon.empty(); }
+
+    //  World y span of the polygon between x0 and x1, false if it does
+    //  not reach that far
+    bool spanY(float x0, float x1, float& y0, float& y1);
+
+    //  Bounds of the cells of map whose centres come within margin of the
+    //  polygon, false if there are none
+    bool cellBounds(HexMap& map, HexCoord& lo, HexCoord& hi, float margin=1.0f);
+    //  Chunks holding cells whose centres come within margin of the
+    //  polygon, column by column.  Chunks outside the polygon are not
+    //  visited.
+    void findChunks(HexMap& map, std::vector<int>& chunks, float margin=1.0f);
+};
+
+//  Render counters for the last frame, reset by HexRender::drawHexes()
+struct HexRenderStats
+{
+    int    drawCalls;
+    int    instances;
+    //  chunks in view
+    int    chunks;
+    //  impostor textures drawn, see HexRender::setLodHexSize()
+    int    impostors;
+    //  instance, vertex and texture data uploaded to the GPU this frame
+    size_t instanceBytes;
+
+    HexRenderStats() : drawCalls(0), instances(0), chunks(0), impostors(0), instanceBytes(0) { }
+};
+
 class HexRender
 {
 private:
@@ -275,9 +1100,10 @@ private:
     ci::CameraPersp   mCamera;
     ci::Vec3f         mCameraTo;
 
-    //  Frustum culling
-    HexCoord         mBottomLeft;
-    HexCoord         mTopRight;
+    //  Frustum culling, the view as of the last update() and the chunks in
+    //  it, reused every frame
+    HexViewRegion    mView;
+    std::vector<int> mVisibleChunks;
 
     ci::gl::GlslProg  mShader;
 
@@ -286,7 +1112,130 @@ private:
 
     HexCoord mSelectedHex;
 
+    //  cells and their positions while baking offsets and chunk meshes
+    std::vector<HexCoord>  mBatchCells;
+    std::vector<ci::Vec3f> mBatchPositions;
+
+    //  Instanced drawing, one draw of HEX_CHUNK_CELLS instances per
+    //  resident chunk in view.  Chunks start on even columns, so every chunk
+    //  shares one buffer of cell offsets from its origin, placed by a
+    //  uniform, and the shader drops cells of edge chunks that are off the
+    //  map.  A chunk's colors are written the first time it is drawn and
+    //  after that only its changed cells are copied in and uploaded again
+    //  in runs, so frames with no changes upload nothing.  Unwritten chunks
+    //  are filled as in the baked path.
+    //
+    //  Colors are RGBA bytes, or for palette mode maps a palette index and
+    //  alpha byte resolved by the shader through mPaletteTexture.
+    struct ChunkInstances
+    {
+        bool                       stale;       //  colors all need writing
+        ci::gl::Vbo                colors;
+        std::vector<unsigned char> colorData;   //  empty until first drawn
+
+        ChunkInstances() : stale(false) { }
+    };
+    bool                        mInstancing;
+    ci::gl::GlslProg            mInstanceShader;
+    GLint                       mOffsetAttrib;
+    GLint                       mColorAttrib;
+    ci::gl::Vbo                 mInstanceOffsets;
+    std::vector<ChunkInstances> mChunkInstances;
+    ci::Vec2i                   mInstanceSize;
+    HexColorMode                mInstanceMode;
+    int                         mColorStride;
+    HexDirtyTracker             mColorChanges;
+    ci::gl::Texture             mPaletteTexture;
+    std::vector<unsigned char>  mPaletteData;
+
+    //  Baked chunk drawing when instancing is unavailable.  Each resident
+    //  chunk gets a mesh the first time it is in view: world positions
+    //  built once and left alone, and RGBA vertex colors of which only the
+    //  changed cells are written again.  Cells are in chunk order with six
+    //  vertices each, so the index buffer is shared by every chunk.  Cells
+    //  of edge chunks that are off the map have no area.
+    struct ChunkMesh
+    {
+        bool                       built;
+        bool                       stale;   //  colors all need writing
+        ci::gl::Vbo                positions;
+        ci::gl::Vbo                colors;
+        std::vector<unsigned char> colorData;
+
+        ChunkMesh() : built(false), stale(false) { }
+    };
+    std::vector<ChunkMesh>     mChunkMeshes;
+    ci::gl::Vbo                mChunkIndices;
+    ci::Vec2i                  mMeshSize;
+    std::vector<unsigned char> mMeshPalette;
+
+    //  changed cells or instances in order, reused every frame
+    std::vector<int>           mChanged;
+
+    //  Level of detail for far zoom.  Once hexes are smaller than
+    //  mLodHexSize pixels on screen, chunks are drawn from impostor
+    //  textures with a texel per cell, a square of HEX_IMPOSTOR_CHUNKS
+    //  chunks to a texture and one quad each.  A chunk's texels are written
+    //  the first time it is drawn this way and after that only once its
+    //  colors change, as reported by mImpostorChanges, so a frame costs in
+    //  the chunks in view and the changed chunks whatever the map's size.
+    struct Impostor
+    {
+        bool            built;
+        unsigned int    frame;     //  last frame drawn
+        ci::gl::Texture texture;
+
+        Impostor() : built(false), frame(0) { }
+    };
+    float                      mLodHexSize;
+    float                      mHexPixels;
+    std::vector<Impostor>      mImpostors;       //  by tile of chunks
+    std::vector<unsigned char> mImpostorStale;   //  by chunk
+    HexDirtyTracker            mImpostorChanges;
+    ci::Vec2i                  mImpostorSize;
+    std::vector<unsigned char> mImpostorPalette;
+    std::vector<unsigned char> mImpostorTexels;
+    std::vector<int>           mImpostorTiles;
+    unsigned int               mFrame;
+
+    //  Procedural drawing, one quad over the cells in view.  The shader
+    //  finds each pixel's cell as WorldToHex() does and reads its color
+    //  and owner from map-sized textures with a texel per cell, written a
+    //  chunk at a time as mCellChanges reports changes.  Owner borders and
+    //  the selection outline are drawn by the shader too.
+    bool                       mProcedural;
+    bool                       mProceduralReady;
+    ci::gl::GlslProg           mProceduralShader;
+    GLint                      mMaxTextureSize;
+    ci::gl::Texture            mCellTexture;
+    ci::gl::Texture            mOwnerTexture;
+    ci::Vec2i                  mCellTextureSize;
+    HexDirtyTracker            mCellChanges;
+    std::vector<unsigned char> mCellPalette;
+    std::vector<unsigned char> mCellTexels;
+    std::vector<unsigned char> mOwnerTexels;
+
+    HexRenderStats mStats;
+
     void generateMeshes();
+    void updateInstances();
+    void updatePalette();
+    void setInstanceColor(ChunkInstances& instances, int cell);
+    void drawInstanced();
+    void drawUnwrittenChunks();
+    void updateChunkMeshes();
+    void buildChunkMesh(int chunk);
+    void setMeshColor(ChunkMesh& mesh, const HexChunk* cells, int cell);
+    void drawChunkMesh(int chunk);
+    bool paletteChanged(std::vector<unsigned char>& seen);
+    void updateImpostors();
+    int  impostorTile(int chunk);
+    void writeImpostor(Impostor& impostor, int chunk);
+    void drawImpostors();
+    bool drawsProcedural();
+    void updateCellTextures();
+    void writeCellTexels(int chunk);
+    void drawProcedural(const HexCoord& lo, const HexCoord& hi);
 
 public:
     HexRender(HexMap& map);
@@ -298,6 +1247,28 @@ public:
     void drawHexes();
     void drawSelection();
 
+    //  Draw the hexes of each resident chunk in view with one instanced
+    //  call.  On by default when the driver supports instancing, otherwise
+    //  each chunk is drawn from a baked mesh.
+    bool isInstancing() { return mInstancing; }
+    void setInstancing(bool enable);
+
+    //  Draw the map as one quad, working out the hexes per pixel, so the
+    //  geometry is the same whatever the map's size.  Needs the shader to
+    //  compile and a map no larger than the biggest texture the driver
+    //  allows, otherwise hexes are drawn as usual.
+    bool isProcedural() { return mProcedural; }
+    void setProcedural(bool enable);
+
+    //  Hexes smaller on screen than this many pixels across are drawn a
+    //  chunk at a time from impostor textures, 0 always draws hexes
+    void  setLodHexSize(float pixels) { mLodHexSize = pixels; }
+    float getLodHexSize() { return mLodHexSize; }
+    //  Size of a hex on screen at the centre of the view as of the last
+    //  update(), 0 if the centre of the view misses the map plane
+    float getHexPixels() { return mHexPixels; }
+    const HexRenderStats& getStats() { return mStats; }
+
     ///  Cast a ray from camera projection plane (u,v) onto hex grid's plane
     ci::Vec3f raycastHexPlane(float u, float v);
 
@@ -308,6 +1279,7 @@ public:
     void setCameraTo(ci::Vec3f& cameraTo);
 
     ci::Camera& getCamera();
+    HexViewRegion& getView() { return mView; }
 };
 typedef boost::shared_ptr<HexRender> HexRenderPtr;
 
@@ -0,0 +1,127 @@
+#pragma once
+#include <vector>
+
+#include "boost/cstdint.hpp"
+
+#include "Hex.h"
+
+namespace war {
+
+typedef boost::uint64_t HexBitWord;
+
+//  One bit per cell of a map sized grid
+//
+//  Bits are stored column-major.  Each column is padded to a whole number of
+//  64 bit words so the y neighbours of 64 cells can be reached with a single
+//  shift, and padding bits are always kept clear.  Boolean operations between
+//  boards of the same size run over whole words (SSE2 where available).
+class HexBitboard
+{
+private:
+    ci::Vec2i mSize;
+    int       mColumnWords;
+    std::vector<HexBitWord> mWords;
+
+    //  mask of the valid bits in the last word of a column
+    HexBitWord mLastWordMask;
+
+    void maskPadding();
+    //  dilate, or with flip all ones dilate the unset cells and invert
+    void spread(HexBitboard& out, HexBitWord flip) const;
+
+public:
+    HexBitboard() : mColumnWords(0), mLastWordMask(0) { }
+    HexBitboard(ci::Vec2i size) { reset(size); }
+
+    //  resize and clear all bits
+    void reset(ci::Vec2i size);
+    void clear();
+
+    ci::Vec2i getSize() const { return mSize; }
+    int getColumnWords() const { return mColumnWords; }
+    HexBitWord* column(int x) { return &mWords[x * mColumnWords]; }
+    const HexBitWord* column(int x) const { return &mWords[x * mColumnWords]; }
+
+    bool get(const HexCoord& pos) const {
+        return ((column(pos.x)[pos.y >> 6] >> (pos.y & 63)) & 1) != 0;
+    }
+    void set(const HexCoord& pos) { column(pos.x)[pos.y >> 6] |= HexBitWord(1) << (pos.y & 63); }
+    void unset(const HexCoord& pos) { column(pos.x)[pos.y >> 6] &= ~(HexBitWord(1) << (pos.y & 63)); }
+
+    //  Number of set bits
+    int  count() const;
+    bool empty() const;
+
+    //  Boolean operations with a board of the same size
+    HexBitboard& operator&=(const HexBitboard& other);
+    HexBitboard& operator|=(const HexBitboard& other);
+    HexBitboard& operator^=(const HexBitboard& other);
+    //  this &= ~other
+    HexBitboard& andNot(const HexBitboard& other);
+    //  flip every bit on the map
+    void invert();
+
+    //  Neighbourhood operations, see HexGrid::adjacent for the column offsets.
+    //  out must be a different board, it is resized to match.
+
+    //  this plus every cell adjacent to it
+    void dilate(HexBitboard& out) const;
+    //  cells whose six neighbours on the map are all set
+    void erode(HexBitboard& out) const;
+    //  set cells with at least one unset neighbour on the map
+    void border(HexBitboard& out) const;
+    //  unset cells adjacent to a set cell
+    void frontier(HexBitboard& out) const;
+
+    //  Call f(HexCoord) for each set bit, in column-major order
+    template <typename F>
+    void forEach(F& f) const
+    {
+        for (int x=0; x < mSize.x; ++x) {
+            const HexBitWord* col = column(x);
+            for (int w=0; w < mColumnWords; ++w) {
+                HexBitWord bits = col[w];
+                while (bits) {
+                    int y = (w << 6) + lowestBit(bits);
+                    f(HexCoord(x, y));
+                    bits &= bits - 1;
+                }
+            }
+        }
+    }
+
+    static int popCount(HexBitWord bits);
+    //  index of the lowest set bit, bits must be non-zero
+    static int lowestBit(HexBitWord bits);
+};
+
+//  Bitplane view of a HexMap, one board for land and one per owner ID
+//
+//  Built from the map's chunk planes a column of a chunk at a time; cells in
+//  unwritten chunks are sea and unowned so they cost nothing.  The view is a
+//  copy, rebuild it after the map changes.
+class HexBitboards
+{
+private:
+    HexBitboard              mLand;
+    std::vector<HexBitboard> mOwners;
+
+public:
+    HexBitboards() { }
+
+    //  Build land and ownership boards for owner IDs 0 .. ownerCount-1.
+    //  Cells with other owner IDs are ignored.
+    void build(HexMap& map, int ownerCount);
+
+    HexBitboard& land() { return mLand; }
+    HexBitboard& owner(int id) { return mOwners[id]; }
+    int getOwnerCount() { return static_cast<int>(mOwners.size()); }
+
+    //  cells owned by anyone
+    void owned(HexBitboard& out);
+
+    //  Number of cells owned by each owner ID
+    std::vector<int> countHexes();
+};
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+#include <set>
+#include <vector>
+
+#include "Hex.h"
+
+namespace war {
+
+//  Connected regions of same-owner cells, kept up to date as owners change
+//
+//  Attaches to a HexMap as a listener.  Every owned cell points at a node in
+//  a union-find forest; the root of a cell's tree is its component ID.  A
+//  cell gaining an owner is merged with its same-owner neighbours.  A cell
+//  losing an owner can split its region, so the parts on each side are
+//  searched in lockstep and only the parts that end up disconnected from the
+//  rest are relabelled, which costs time proportional to the smaller parts.
+//
+//  Nodes of removed or relabelled cells stay in the forest to keep paths to
+//  the root intact; the index is rebuilt from the map when they pile up.
+class HexComponentIndex : public HexMapListener
+{
+private:
+    HexMap&  mHexMap;
+
+    //  cell index -> union-find node, -1 for unowned cells
+    std::vector<int> mCellNode;
+
+    //  union-find nodes, mSize and mOwner are valid for roots only
+    std::vector<int> mParent;
+    std::vector<int> mSize;
+    std::vector<int> mOwner;
+    int              mRoots;
+    int              mCells;
+
+    //  component sizes per owner ID, largest last
+    std::vector< std::multiset<int> > mOwnerSizes;
+
+    //  split search scratch, reused between mutations
+    std::vector<unsigned int> mMark;
+    std::vector<unsigned char> mMarkSearch;
+    unsigned int              mMarkStamp;
+    std::vector<int>          mQueues[6];
+
+    int  newNode(int owner, int size);
+    int  find(int node);
+    void unite(int a, int b);
+    void setSize(int root, int size);
+
+    void addCell(int cell, int owner);
+    void removeCell(int cell, int owner);
+
+    //  same-owner neighbours of a cell, in HexDir order (-1 where none)
+    void sameOwnerNeighbours(int cell, int owner, int* out);
+
+    //  non-copyable, registered with the map
+    HexComponentIndex(const HexComponentIndex&);
+    HexComponentIndex& operator=(const HexComponentIndex&);
+
+public:
+    HexComponentIndex(HexMap& map);
+    ~HexComponentIndex();
+
+    //  Relabel every region from scratch
+    void rebuild();
+
+    //  Component ID of a cell, -1 if unowned.  IDs are only stable until the
+    //  next mutation.
+    int componentId(const HexCoord& pos);
+    //  Number of cells in a cell's region, 0 if unowned
+    int componentSize(const HexCoord& pos);
+    int componentOwner(int id) { return mOwner[id]; }
+    int getComponentCount() { return mRoots; }
+
+    //  Size of the largest connected region owned by a player, 0 if none
+    int largestRegion(int owner);
+
+    //  Compare every region against HexMap::connected(), for debugging
+    bool validate();
+
+    //  HexMapListener
+    void ownerChanged(int index, int oldOwner, int newOwner);
+    void mapCleared();
+    void mapLoaded();
+};
+typedef boost::shared_ptr<HexComponentIndex> HexComponentIndexPtr;
+
+//  Size, owner and bounding box of a labelled region
+struct HexRegionStats
+{
+    int      owner;   //  -1 when labelling land
+    int      size;
+    HexCoord min;
+    HexCoord max;
+};
+
+//  One pass connected component labelling of a whole map
+//
+//  The map is cut into bands of whole chunk rows, one per thread.  Each
+//  thread unions neighbouring cells inside its band, the band seams are then
+//  joined on the calling thread, and the threads number the regions and
+//  gather their statistics.  Unlike HexComponentIndex nothing is kept up to
+//  date; label() again after the map changes.
+class HexRegionLabeling
+{
+public:
+    enum Mode {
+        BY_OWNER,  //  cells with the same owner (>= 0)
+        BY_LAND    //  land cells
+    };
+
+private:
+    //  cell index -> union-find parent while labelling
+    std::vector<int> mParent;
+    //  cell index -> region ID, -1 outside any region
+    std::vector<int> mRegion;
+    std::vector<HexRegionStats> mStats;
+
+    struct Band;
+    void unionBand(HexMap& map, Mode mode, Band& band);
+    void countRoots(HexMap& map, Band& band);
+    void numberRoots(HexMap& map, Band& band);
+    void resolveBand(HexMap& map, Band& band);
+
+public:
+    HexRegionLabeling() { }
+
+    //  Label every region of the map.  threads <= 0 uses one thread per core.
+    void label(HexMap& map, Mode mode=BY_OWNER, int threads=0);
+
+    //  Region ID of a cell index or position, -1 if none
+    int regionAt(int index) { return mRegion[index]; }
+    int regionAt(HexMap& map, const HexCoord& pos) { return mRegion[map.index(pos)]; }
+    int getRegionCount() { return static_cast<int>(mStats.size()); }
+    std::vector<HexRegionStats>& getRegions() { return mStats; }
+};
+
+}
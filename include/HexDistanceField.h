@@ -0,0 +1,130 @@
+#pragma once
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+#include "Hex.h"
+
+namespace war {
+
+//  A source cell for HexDistanceField.  Cells are claimed by the seed with
+//  the lowest weight plus steps, so a seed with a higher weight starts later
+//  and claims less.
+struct HexSeed
+{
+    HexCoord pos;
+    int      weight;   //  >= 0
+
+    HexSeed() : weight(0) { }
+    HexSeed(const HexCoord& pos, int weight=0) : pos(pos), weight(weight) { }
+};
+
+//  Passability check letting the field spread over every cell of the map
+struct PassableAny
+{
+    bool operator()(HexCell cell) { return true; }
+};
+
+//  Distance to, and identity of, the nearest of a set of seeds for every
+//  cell, from one breadth first search started at all the seeds at once
+//
+//  Cells are visited in order of distance, one ring of the search at a
+//  time, and seeds join the search when it reaches their weight.  Each
+//  reachable cell is visited once, so a field costs time linear in the
+//  cells it reaches.  With a maxDistance only the cells within it are
+//  visited, which keeps local queries such as AI influence around a few
+//  cells cheap on large maps.
+//
+//  Results are kept per cell index and stamped like HexMap::beginSearch(),
+//  so the arrays are allocated once and never cleared.  Ties between seeds
+//  go to whichever the search reaches first.
+class HexDistanceField
+{
+private:
+    std::vector<unsigned int> mMark;
+    std::vector<int>          mDist;
+    std::vector<int>          mNearest;
+    unsigned int              mStamp;
+
+    //  reached cells in order of distance
+    std::vector<int> mCells;
+    std::vector<int> mSeedOrder;
+
+    void begin(HexMap& map, const std::vector<HexSeed>& seeds);
+    bool reach(int cell, int dist, int seed) {
+        if (mMark[cell] == mStamp) {
+            return false;
+        }
+        mMark[cell]    = mStamp;
+        mDist[cell]    = dist;
+        mNearest[cell] = seed;
+        mCells.push_back(cell);
+        return true;
+    }
+
+public:
+    HexDistanceField() : mStamp(0) { }
+
+    //  Spread from seeds through cells matching passable, a functor taking a
+    //  HexCell as in HexMap::connected().  Seed cells are claimed even if
+    //  they are not passable, seeds off the map are ignored.  Cells further
+    //  than maxDistance are left unreached.
+    template <typename P>
+    void compute(HexMap& map, const std::vector<HexSeed>& seeds, P passable, int maxDistance=INT_MAX)
+    {
+        begin(map, seeds);
+        const int* neighbours = map.neighbourIndex();
+
+        size_t nextSeed = 0;
+        size_t ring = 0;
+        int dist = seeds.empty() ? 0 : seeds[mSeedOrder[0]].weight;
+        while (dist <= maxDistance) {
+            //  seeds starting at this distance, unless a cell is already taken
+            for (; nextSeed < mSeedOrder.size() && seeds[mSeedOrder[nextSeed]].weight == dist; ++nextSeed) {
+                int seed = mSeedOrder[nextSeed];
+                if (map.isValid(seeds[seed].pos)) {
+                    reach(map.index(seeds[seed].pos), dist, seed);
+                }
+            }
+
+            size_t end = mCells.size();
+            if (ring == end) {
+                //  nothing at this distance, skip ahead to the next seed
+                if (nextSeed == mSeedOrder.size()) {
+                    break;
+                }
+                dist = seeds[mSeedOrder[nextSeed]].weight;
+                continue;
+            }
+            if (dist == maxDistance) {
+                break;
+            }
+
+            //  the next ring, cells reached from this one
+            for (; ring < end; ++ring) {
+                int cell = mCells[ring];
+                const int* adjacent = neighbours + cell*6;
+                for (int i=0; i < 6; ++i) {
+                    int next = adjacent[i];
+                    if (next >= 0 && mMark[next] != mStamp && passable(HexCell(map, next))) {
+                        reach(next, dist + 1, mNearest[cell]);
+                    }
+                }
+            }
+            ++dist;
+        }
+    }
+
+    //  Steps plus seed weight to the nearest seed, -1 if unreached
+    int distance(int index) { return mMark[index] == mStamp ? mDist[index] : -1; }
+    int distance(HexMap& map, const HexCoord& pos) { return distance(map.index(pos)); }
+
+    //  Position in the seed list of the nearest seed, -1 if unreached
+    int nearest(int index) { return mMark[index] == mStamp ? mNearest[index] : -1; }
+    int nearest(HexMap& map, const HexCoord& pos) { return nearest(map.index(pos)); }
+
+    //  Indices of the reached cells, nearest first
+    const std::vector<int>& getCells() { return mCells; }
+};
+
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <iosfwd>
+
+#include "boost/cstdint.hpp"
+
+#include "Hex.h"
+
+namespace war {
+
+struct Territory;
+
+//  On disk header of a binary map file.  All values are little-endian.
+//
+//  The file is laid out so it can be memory mapped and read in place:
+//
+//      header        HexMapFileHeader, 128 bytes
+//      chunk table   one uint64 file offset per chunk, 0 for chunks that
+//                    hold only default values
+//      palette       palette mode only, float r, g, b per entry
+//      chunks        HexColorChunk or HexPaletteChunk images, by color
+//                    mode, at 64 byte aligned offsets.  Version 2 added
+//                    the territory plane to the chunks.
+//      territories   HexTerritoryRecord per territory, then every
+//                    territory's cells as int32 x, y pairs
+//
+//  Chunks are numbered column-major, HEX_ORDER_COLUMNS, and their cells
+//  ordered exactly as in HexMap, so a chunk is found with one table lookup
+//  and loads with a single copy.
+struct HexMapFileHeader
+{
+    char            magic[4];          //  "HEXM"
+    boost::uint32_t version;
+    boost::int32_t  width;
+    boost::int32_t  height;
+    boost::int32_t  chunkSize;         //  HEX_CHUNK_SIZE
+    boost::int32_t  chunkCount;
+    boost::int32_t  residentChunks;
+    boost::int32_t  territoryCount;
+    float           defaultColor[4];
+    boost::uint64_t chunkTableOffset;
+    boost::uint64_t territoryOffset;
+    boost::uint64_t fileSize;
+    boost::int32_t  colorMode;         //  HexColorMode, 0 (full color) in older files
+    boost::int32_t  paletteSize;
+    boost::uint64_t paletteOffset;
+    unsigned char   reserved[40];
+};
+
+struct HexTerritoryRecord
+{
+    boost::int32_t  originX;
+    boost::int32_t  originY;
+    boost::uint32_t firstCell;         //  index into the cell array
+    boost::uint32_t cellCount;
+};
+
+enum {
+    HEX_MAP_FILE_VERSION = 2
+};
+
+//  A binary map file, memory mapped read-only
+//
+//  open() only maps the file and checks the header, so it takes the same
+//  time for any map size, and pages are read from disk as cells are first
+//  touched.  Cells can be read in place or copied into a HexMap with load().
+class HexMapFile
+{
+private:
+    const unsigned char* mData;
+    boost::uint64_t      mFileSize;
+    ci::Vec2i            mChunkGrid;
+    HexColorMode         mColorMode;
+    HexPalette           mPalette;
+
+    //  platform mapping handles
+    void* mFile;
+    void* mMapping;
+
+    const HexMapFileHeader& header() const { return *reinterpret_cast<const HexMapFileHeader*>(mData); }
+    const boost::uint64_t* chunkTable() const { 
+        return reinterpret_cast<const boost::uint64_t*>(mData + header().chunkTableOffset); 
+    }
+    const HexTerritoryRecord* territories() const {
+        return reinterpret_cast<const HexTerritoryRecord*>(mData + header().territoryOffset);
+    }
+    const boost::int32_t* territoryCells() const {
+        return reinterpret_cast<const boost::int32_t*>(territories() + header().territoryCount);
+    }
+
+    bool validate();
+
+    //  mapped, non-copyable
+    HexMapFile(const HexMapFile&);
+    HexMapFile& operator=(const HexMapFile&);
+
+public:
+    HexMapFile();
+    ~HexMapFile();
+
+    //  Map a file and check its header, false if it is not a valid map
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const { return mData != 0; }
+
+    ci::Vec2i  getSize() const { return ci::Vec2i(header().width, header().height); }
+    ci::ColorA getDefaultColor() const;
+    HexColorMode getColorMode() const { return mColorMode; }
+    const HexPalette& getPalette() const { return mPalette; }
+
+    //  A chunk's cells in place, null for chunks holding only defaults.
+    //  The chunk is a HexColorChunk or HexPaletteChunk by getColorMode().
+    const HexChunk* getChunk(int chunk) const;
+
+    //  In place cell reads, pos must be on the map
+    int        getOwner(const HexCoord& pos) const;
+    int        getLand(const HexCoord& pos) const;
+    int        getTerritory(const HexCoord& pos) const;
+    ci::ColorA getColor(const HexCoord& pos) const;
+
+    int      getTerritoryCount() const { return header().territoryCount; }
+    HexCoord getTerritoryOrigin(int territory) const;
+    int      getTerritorySize(int territory) const { return territories()[territory].cellCount; }
+    HexCoord getTerritoryCell(int territory, int cell) const;
+
+    //  Copy the cells into a map of the same size, false if the sizes
+    //  differ.  The map takes the file's color mode and palette.
+    bool load(HexMap& map) const;
+    //  false, leaving territories empty, if a territory has cells off the map.
+    //  Only the lists are read, TerritoryList::assign() indexes them.
+    bool loadTerritories(std::vector<Territory>& territories) const;
+
+    //  Write a map and its territories
+    static bool save(const std::string& path, HexMap& map, const std::vector<Territory>& territories);
+
+    //  Human-readable form of an open file, and back to a binary file
+    bool writeText(std::ostream& out) const;
+    static bool readText(std::istream& in, const std::string& path);
+};
+
+}
@@ -0,0 +1,408 @@
+#pragma once
+#include <algorithm>
+#include <vector>
+
+#include "boost/function.hpp"
+
+#include "Hex.h"
+#include "HexBitboard.h"
+
+namespace war {
+
+//  A route between two cells, start and goal included
+struct HexPath
+{
+    std::vector<HexCoord> cells;
+    //  sum of the step costs, -1 when there is no route
+    int cost;
+
+    HexPath() : cost(-1) { }
+    bool found() const { return cost >= 0; }
+};
+
+struct HexPathRequest
+{
+    HexCoord start;
+    HexCoord goal;
+
+    HexPathRequest() { }
+    HexPathRequest(const HexCoord& start, const HexCoord& goal) : start(start), goal(goal) { }
+};
+
+//  Passability check for land cells, see ConnectedByOwner for owned cells
+struct PassableLand
+{
+    bool operator()(HexCell cell) {
+        return cell.getLand() != 0;
+    }
+};
+
+//  Cost of stepping between two neighbouring cells.  Step costs must be at
+//  least 1 or the hex distance heuristic can overestimate.
+struct UnitStepCost
+{
+    int operator()(HexCell from, HexCell to) { return 1; }
+};
+
+//  A* search over a HexMap
+//
+//  Node state lives in flat arrays indexed by cell index, allocated on the
+//  first search and reused by later ones.  Each search takes two new stamps
+//  like HexMap::beginSearch(), so nothing is cleared between searches.  The
+//  open list is a binary heap; a cell whose cost improves is pushed again and
+//  the stale entry is skipped when it comes off the heap.
+//
+//  A finder only reads the map, so finders on different threads may search
+//  the same map as long as nothing edits it meanwhile, see HexPathBatch.
+class HexPathFinder
+{
+private:
+    HexMap& mHexMap;
+
+    struct Node
+    {
+        int f;      //  cost so far plus the distance left
+        int g;      //  cost so far
+        int cell;
+    };
+
+    //  heap order: lowest f on top, ties go to the node furthest along
+    struct NodeOrder
+    {
+        bool operator()(const Node& a, const Node& b) const {
+            return a.f > b.f || (a.f == b.f && a.g < b.g);
+        }
+    };
+
+    std::vector<Node> mOpen;
+
+    //  cell index -> stamp, the cell is open if it equals mStamp and closed
+    //  if it equals mStamp+1.  mCost and mParentDir are valid for open and
+    //  closed cells, mParentDir is the HexDir back towards the start.
+    std::vector<unsigned int>  mState;
+    std::vector<int>           mCost;
+    std::vector<unsigned char> mParentDir;
+    unsigned int               mStamp;
+
+    //  cells closed by the last search
+    int mExpanded;
+
+    void begin();
+    void tracePath(int start, int goal, HexPath& path);
+
+    //  non-copyable, holds a map reference and large buffers
+    HexPathFinder(const HexPathFinder&);
+    HexPathFinder& operator=(const HexPathFinder&);
+
+public:
+    HexPathFinder(HexMap& map);
+
+    //  Find the cheapest route from start to goal
+    //  passable -- a functor taking a HexCell, false for cells the route
+    //              may not enter.  The start cell is not checked.
+    //  cost     -- a functor taking the HexCells a step leaves and enters,
+    //              returning the step cost (>= 1)
+    //
+    //  Returns false and leaves path empty if the goal cannot be reached.
+    template <typename P, typename C>
+    bool find(const HexCoord& start, const HexCoord& goal, P passable, C cost, HexPath& path)
+    {
+        path.cells.clear();
+        path.cost = -1;
+        if (!mHexMap.isValid(start) || !mHexMap.isValid(goal)) {
+            return false;
+        }
+
+        begin();
+        const unsigned int open   = mStamp;
+        const unsigned int closed = mStamp + 1;
+        const int* neighbours = mHexMap.neighbourIndex();
+
+        int startCell = mHexMap.index(start);
+        int goalCell  = mHexMap.index(goal);
+        if (startCell != goalCell && !passable(HexCell(mHexMap, goalCell))) {
+            return false;
+        }
+
+        mState[startCell] = open;
+        mCost[startCell]  = 0;
+        Node first = { hexDistance(start, goal), 0, startCell };
+        mOpen.push_back(first);
+
+        while (!mOpen.empty()) {
+            Node node = mOpen.front();
+            std::pop_heap(mOpen.begin(), mOpen.end(), NodeOrder());
+            mOpen.pop_back();
+
+            //  skip entries superseded by a cheaper push
+            if (mState[node.cell] != open || node.g != mCost[node.cell]) {
+                continue;
+            }
+            if (node.cell == goalCell) {
+                path.cost = node.g;
+                tracePath(startCell, goalCell, path);
+                return true;
+            }
+            mState[node.cell] = closed;
+            ++mExpanded;
+
+            HexCell from(mHexMap, node.cell);
+            const int* adjacent = neighbours + node.cell*6;
+            for (int dir=0; dir < 6; ++dir) {
+                int next = adjacent[dir];
+                if (next < 0) {
+                    continue;
+                }
+                unsigned int& state = mState[next];
+                if (state == closed) {
+                    continue;
+                }
+                //  impassable cells are closed the first time they are seen
+                if (state != open && !passable(HexCell(mHexMap, next))) {
+                    state = closed;
+                    continue;
+                }
+
+                int g = node.g + cost(from, HexCell(mHexMap, next));
+                if (state == open && g >= mCost[next]) {
+                    continue;
+                }
+                state = open;
+                mCost[next] = g;
+                mParentDir[next] = static_cast<unsigned char>((dir + 3) % 6);
+
+                Node push = { g + hexDistance(mHexMap.coord(next), goal), g, next };
+                mOpen.push_back(push);
+                std::push_heap(mOpen.begin(), mOpen.end(), NodeOrder());
+            }
+        }
+        return false;
+    }
+
+    //  As above with every step costing 1
+    template <typename P>
+    bool find(const HexCoord& start, const HexCoord& goal, P passable, HexPath& path)
+    {
+        return find(start, goal, passable, UnitStepCost(), path);
+    }
+
+    //  Number of cells expanded by the last search
+    int getExpanded() { return mExpanded; }
+};
+typedef boost::shared_ptr<HexPathFinder> HexPathFinderPtr;
+
+//  Runs every other threads-th request of a batch on one finder
+template <typename P, typename C>
+struct HexPathJob
+{
+    HexPathFinder*                     finder;
+    const std::vector<HexPathRequest>* requests;
+    std::vector<HexPath>*              paths;
+    int first;
+    int step;
+    P   passable;
+    C   cost;
+
+    HexPathJob(HexPathFinder* finder, const std::vector<HexPathRequest>* requests,
+               std::vector<HexPath>* paths, int first, int step, P passable, C cost)
+        : finder(finder), requests(requests), paths(paths), first(first), step(step),
+          passable(passable), cost(cost) { }
+
+    void operator()()
+    {
+        for (size_t i=first; i < requests->size(); i += step) {
+            const HexPathRequest& request = (*requests)[i];
+            finder->find(request.start, request.goal, passable, cost, (*paths)[i]);
+        }
+    }
+};
+
+//  Many path searches at once, spread over threads
+//
+//  Each thread owns a HexPathFinder which is kept between batches so its
+//  buffers are only allocated once.  Requests are dealt out in turn rather
+//  than in blocks so long and short routes even out between threads.  The
+//  map must not be edited while a batch runs.
+class HexPathBatch
+{
+private:
+    HexMap& mHexMap;
+    std::vector<HexPathFinderPtr> mFinders;
+
+    typedef boost::function<void ()> Job;
+    void run(std::vector<Job>& jobs);
+
+public:
+    //  threads <= 0 uses one thread per core
+    HexPathBatch(HexMap& map, int threads=0);
+
+    //  Fill paths[i] with the route for requests[i], see HexPathFinder::find.
+    //  Each thread gets its own copy of passable and cost.
+    template <typename P, typename C>
+    void find(const std::vector<HexPathRequest>& requests, std::vector<HexPath>& paths, P passable, C cost)
+    {
+        paths.resize(requests.size());
+        int threads = std::min(static_cast<int>(mFinders.size()), static_cast<int>(requests.size()));
+
+        //  build the neighbour table up front, the threads only read it
+        mHexMap.neighbourIndex();
+
+        std::vector<Job> jobs;
+        for (int t=0; t < threads; ++t) {
+            jobs.push_back(HexPathJob<P, C>(mFinders[t].get(), &requests, &paths, t, threads, passable, cost));
+        }
+        run(jobs);
+    }
+
+    template <typename P>
+    void find(const std::vector<HexPathRequest>& requests, std::vector<HexPath>& paths, P passable)
+    {
+        find(requests, paths, passable, UnitStepCost());
+    }
+
+    int getThreadCount() { return static_cast<int>(mFinders.size()); }
+};
+
+//  Hierarchical path search for large maps
+//
+//  The map is cut into square clusters of 2^clusterShift cells a side.  Each
+//  run of passable cell pairs along the boundary of two clusters becomes an
+//  entrance: a node on each side, joined by one step.  Short runs get one
+//  entrance in the middle and long runs one at each end.  Nodes in the same
+//  cluster are joined by their shortest distance within the cluster.
+//
+//  A query links start and goal to the nodes of their clusters, searches
+//  this small graph and returns the cells where the route crosses between
+//  clusters as waypoints.  refine() fills in the cells between two waypoints
+//  with a search of one cluster, so a unit only pays for the stretch it is
+//  about to walk.  Every step costs 1, and routes are close to the shortest
+//  but not always the shortest.
+//
+//  The graph watches the map's owner and land changes with a
+//  HexDirtyTracker.  update() rebuilds only the entrances around changed
+//  clusters and the distances inside the clusters they touch.  Queries call
+//  update() first.
+class HexPathGraph
+{
+public:
+    typedef boost::function<bool (HexCell)> Passable;
+
+private:
+    struct Edge
+    {
+        int node;
+        int cost;
+
+        Edge(int node, int cost) : node(node), cost(cost) { }
+    };
+
+    struct Node
+    {
+        HexCoord pos;
+        int      cluster;   //  -1 for free slots
+        int      partner;   //  node across the cluster boundary
+        std::vector<Edge> edges;
+    };
+
+    HexMap&         mHexMap;
+    Passable        mPassable;
+    HexDirtyTracker mTracker;
+
+    int       mShift;
+    int       mClusterSize;
+    ci::Vec2i mClusterGrid;
+
+    //  passable cells, refreshed per cluster
+    HexBitboard mOpen;
+
+    std::vector<Node> mNodes;
+    std::vector<int>  mFreeNodes;
+    //  cluster -> its nodes
+    std::vector< std::vector<int> > mClusterNodes;
+    //  cluster*3 + side -> nodes of the entrances shared with the cluster
+    //  east (0), north (1) or north east (2) of it
+    std::vector< std::vector<int> > mSideNodes;
+
+    //  cluster search scratch, indexed by cell offset in the cluster
+    std::vector<int>           mDist;
+    std::vector<unsigned char> mFromDir;
+    std::vector<int>           mQueue;
+
+    //  graph search scratch, indexed by node with start and goal at the end
+    struct Open
+    {
+        int f;
+        int g;
+        int node;
+    };
+    struct OpenOrder
+    {
+        bool operator()(const Open& a, const Open& b) const {
+            return a.f > b.f || (a.f == b.f && a.g < b.g);
+        }
+    };
+    std::vector<Open>         mOpenList;
+    std::vector<unsigned int> mState;
+    std::vector<int>          mCost;
+    std::vector<int>          mParent;
+    unsigned int              mStamp;
+    std::vector<Edge>         mStartEdges;
+    std::vector<Edge>         mGoalEdges;
+    HexPath                   mWaypoints;
+    HexPath                   mSegment;
+
+    int clusterAt(const HexCoord& pos) {
+        return (pos.x >> mShift) * mClusterGrid.y + (pos.y >> mShift);
+    }
+    HexCoord clusterOrigin(int cluster) {
+        return HexCoord(cluster / mClusterGrid.y, cluster % mClusterGrid.y) * mClusterSize;
+    }
+    HexCoord clusterEnd(int cluster);
+    int local(int cluster, const HexCoord& pos) {
+        HexCoord offset = pos - clusterOrigin(cluster);
+        return (offset.x << mShift) | offset.y;
+    }
+
+    void refreshOpen(int cluster);
+    void searchCluster(int cluster, const HexCoord& from);
+
+    int  newNode(const HexCoord& pos, int cluster);
+    void addEntrance(int side, const HexCoord& a, const HexCoord& b);
+    //  cluster across a side, -1 past the map edge
+    int  sideNeighbour(int cluster, int side);
+    void buildSide(int cluster, int side);
+    void clearSide(int cluster, int side);
+    void linkCluster(int cluster);
+    void relax(const Open& from, const Edge& edge, const HexCoord& goal);
+
+    //  non-copyable, registered with the map through mTracker
+    HexPathGraph(const HexPathGraph&);
+    HexPathGraph& operator=(const HexPathGraph&);
+
+public:
+    //  Clusters are 2^clusterShift cells a side, at least a chunk
+    HexPathGraph(HexMap& map, Passable passable, int clusterShift=5);
+
+    //  Rebuild the whole graph
+    void build();
+    //  Repair the graph around cells changed since the last update
+    void update();
+
+    //  Find a route from start to goal through the graph.  path.cells gets
+    //  the start, the cells where the route crosses between clusters and
+    //  the goal.  path.cost is the length of the full route.  Returns false
+    //  if the goal cannot be reached or either end is not passable.
+    bool findWaypoints(const HexCoord& start, const HexCoord& goal, HexPath& path);
+
+    //  Cells from waypoints.cells[segment] to waypoints.cells[segment+1]
+    //  inclusive, as found by findWaypoints()
+    void refine(const HexPath& waypoints, size_t segment, HexPath& path);
+
+    //  findWaypoints() and refine() every segment
+    bool find(const HexCoord& start, const HexCoord& goal, HexPath& path);
+
+    int getNodeCount() { return static_cast<int>(mNodes.size() - mFreeNodes.size()); }
+    int getClusterCount() { return mClusterGrid.x * mClusterGrid.y; }
+};
+
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <vector>
+
+#include "boost/function.hpp"
+
+#include "Hex.h"
+#include "HexBitboard.h"
+
+namespace war {
+
+//  Blocker check for sea cells
+struct BlockedBySea
+{
+    bool operator()(HexCell cell) {
+        return cell.getLand() == 0;
+    }
+};
+
+//  True if no cell on the line strictly between a and b blocks the view.
+//  blocks is a functor taking a HexCell, see BlockedBySea.
+template <typename B>
+bool hexLineOfSight(HexMap& map, const HexCoord& a, const HexCoord& b, B blocks)
+{
+    for (HexLine it(a, b); it; ++it) {
+        HexCoord pos = *it;
+        if (pos == a || pos == b) {
+            continue;
+        }
+        if (!map.isValid(pos) || blocks(HexCell(map, map.index(pos)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//  Field of view for a set of observers, kept until the map changes near
+//  them
+//
+//  Visible cells are found by shadowcasting ring by ring outwards from the
+//  observer.  A ring of radius r has 6r cells evenly spaced round a hexagon,
+//  so each cell covers 1/6r of the way round and a ray from the centre
+//  crosses every ring at the same fraction.  Blocking cells cast their
+//  share of the way round as shadow on the rings beyond, and a cell is
+//  visible unless the middle half of its share is in shadow.  The
+//  observer's own cell is always visible and blocking cells can be seen.
+//
+//  Each observer's cells are cached until a HexDirtyTracker reports a
+//  change to a chunk within its radius, so visibility can be asked for
+//  every player every turn and only observers near a change pay for it.
+class HexVisibility
+{
+public:
+    typedef boost::function<bool (HexCell)> Blocks;
+
+private:
+    struct Observer
+    {
+        HexCoord pos;
+        int      radius;   //  -1 for free slots
+        bool     valid;
+        std::vector<int> cells;
+    };
+
+    //  a stretch of the way round a ring, 0 to 1
+    struct Arc
+    {
+        double begin;
+        double end;
+
+        Arc(double begin, double end) : begin(begin), end(end) { }
+    };
+
+    HexMap&         mHexMap;
+    Blocks          mBlocks;
+    HexDirtyTracker mTracker;
+
+    std::vector<Observer> mObservers;
+    std::vector<int>      mFreeObservers;
+
+    //  shadows on the current ring, sorted and merged, and those cast by it
+    std::vector<Arc> mShadows;
+    std::vector<Arc> mCast;
+
+    int mRecomputed;
+
+    bool inShadow(double begin, double end);
+    void addShadow(double begin, double end);
+
+    //  non-copyable, registered with the map through mTracker
+    HexVisibility(const HexVisibility&);
+    HexVisibility& operator=(const HexVisibility&);
+
+public:
+    //  fields are the HexDirtyTracker fields blocks depends on
+    HexVisibility(HexMap& map, Blocks blocks, int fields=HexDirtyTracker::LAND);
+
+    //  Cell indices visible from origin within radius steps
+    void fieldOfView(const HexCoord& origin, int radius, std::vector<int>& cells);
+
+    //  Observers are numbered from 0, ids of removed observers are reused
+    int  addObserver(const HexCoord& pos, int radius);
+    void moveObserver(int id, const HexCoord& pos);
+    void removeObserver(int id);
+
+    //  Drop the cached cells of observers near cells changed since the last
+    //  update.  visible() calls it first.
+    void update();
+
+    //  Cell indices visible to an observer
+    const std::vector<int>& visible(int id);
+    //  Set an observer's visible cells on a map sized board, for example
+    //  to gather everything one player can see
+    void markVisible(int id, HexBitboard& board);
+
+    //  Observers whose cells were worked out again, since the last reset
+    int  getRecomputed() { return mRecomputed; }
+    void resetStats() { mRecomputed = 0; }
+};
+
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <vector>
+
+#include "Hex.h"
+
+namespace war {
+
+struct Territory
+{
+    HexCoord mOrigin;
+    std::vector<HexCoord> mCells;
+
+    Territory(HexCoord origin) : mOrigin(origin) { }
+
+    //  Appends to the cell list alone, as HexMapFile does building lists to
+    //  load.  A map's territory plane only learns of cells added through
+    //  TerritoryList, hand lists built this way to TerritoryList::assign().
+    void addCell(HexCoord& coord) {
+        mCells.push_back(coord);
+    }
+
+    HexCoord getOrigin() { return mOrigin; }
+};
+
+//  A game's territories, kept in step with a map's territory plane so
+//  membership and lookup by cell take a plane read, see
+//  HexMap::getTerritory().  Territories are numbered by their position in
+//  the list, at most HEX_MAX_TERRITORIES of them.
+//
+//  Copies share nothing with the map; assigning a copy back is only in step
+//  if the map's plane was restored with it, as editor undo does.
+class TerritoryList
+{
+private:
+    std::vector<Territory> mTerritories;
+
+public:
+    const std::vector<Territory>& getTerritories() const { return mTerritories; }
+    int size() const { return static_cast<int>(mTerritories.size()); }
+    const Territory& operator[](int territory) const { return mTerritories[territory]; }
+
+    //  Start a territory holding just its origin cell, returning its ID, or
+    //  -1 if the origin is off the map or the list is full
+    int  add(HexMap& map, const HexCoord& origin);
+    //  Add a cell to a territory, taking it from the one it was in
+    void addCell(HexMap& map, int territory, const HexCoord& pos);
+    //  Territory holding a cell, -1 for none
+    int  territoryAt(HexMap& map, const HexCoord& pos) {
+        return map.isValid(pos) ? map.getTerritory(map.index(pos)) : -1;
+    }
+    bool contains(HexMap& map, int territory, const HexCoord& pos) {
+        return territory >= 0 && territoryAt(map, pos) == territory;
+    }
+    //  Hand every cell of a territory to a new owner
+    void setOwner(HexMap& map, int territory, int owner);
+
+    //  Replace the list, as loaded from a file, and rebuild the map's plane
+    //  from it.  False, leaving the list empty, if there are more than
+    //  HEX_MAX_TERRITORIES or a cell is off the map.
+    bool assign(HexMap& map, const std::vector<Territory>& territories);
+    void clear(HexMap& map);
+};
+
+}
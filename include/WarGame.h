@@ -4,6 +4,8 @@
 #include <vector>
 
 #include "Hex.h"
+#include "HexComponents.h"
+#include "Territory.h"
 
 #include "cinder/app/KeyEvent.h"
 #include "cinder/app/MouseEvent.h"
@@ -69,30 +71,13 @@ public:
 	//@}	
 };
 
-struct Territory
-{
-    HexCoord mOrigin;
-    std::vector<HexCoord> mCells;
-
-    Territory(HexCoord origin) : mOrigin(origin) { }
-
-    void addCell(HexCoord& coord) {
-        mCells.push_back(coord);
-    }
-    bool contains(HexCoord& coord) {
-        return (find(mCells.begin(), mCells.end(), coord) != mCells.end());
-    }
-
-    HexCoord getOrigin() { return mOrigin; }
-};
-
 //  New instance created when a game is started
 class WarGame
 {
 private:
     std::string mName;
     std::vector<Player> mPlayers;
-    std::vector<Territory> mTerritories;
+    TerritoryList mTerritories;
     int mTurnPlayer;
 
 public:
@@ -106,8 +91,10 @@ public:
     void update();
     void draw();
 
-    // get a reference to the territory list
-    std::vector<war::Territory>& getTerritories() { return mTerritories; }
+    //  the territories, read-only, and the list that edits them in step
+    //  with the map
+    const std::vector<war::Territory>& getTerritories() const { return mTerritories.getTerritories(); }
+    TerritoryList& getTerritoryList() { return mTerritories; }
 };
 
 typedef enum
@@ -188,6 +175,7 @@ struct Shared
     HexMap&        hexMap;
     HexGrid&       hexGrid;
     HexRender&     hexRender;
+    HexComponentIndex& components;
     GuiController& gui;
     GuiFactory&    guiFactory;
     Mouse&         mouse;
@@ -196,7 +184,7 @@ struct Shared
     GuiConsolePtr  console;   // XXX have to use a smart ptr here to attach/detach, 
                               // but is there a cyclic dependency between Shared & console?
                               // fix by not using pointers to attach/detach, generate uid's for widgets instead.
-    Shared(HexMap& hexmap, HexGrid& hexgrid, HexRender& hexrender, GuiController& gui, GuiFactory& factory, Mouse& mouse, WarGame& wargame, GuiConsolePtr console);
+    Shared(HexMap& hexmap, HexGrid& hexgrid, HexRender& hexrender, HexComponentIndex& components, GuiController& gui, GuiFactory& factory, Mouse& mouse, WarGame& wargame, GuiConsolePtr console);
 };
 
 }
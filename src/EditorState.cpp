@@ -1,5 +1,7 @@
 #include "EditorState.h"
 #include "WarGame.h"
+#include "HexMapFile.h"
+#include "HexDistanceField.h"
 #include "cinder/Vector.h"
 #include "cinder/Rand.h"
 #include "cinder/gl/gl.h"
@@ -25,7 +27,21 @@ static Rand random;
 #define HexRender GG.hexRender
 #define Map       GG.hexMap
 
-EditorState::EditorState(StateManager& manager, Shared& shared) : State(manager, shared)
+//  the editor's map is kept next to the executable
+static string mapPath()
+{
+    return getAppPath() + "map.hexmap";
+}
+
+//  undo steps kept, each costs a chunk table plus the chunks edited since,
+//  and a copy of the territory list
+static const size_t UNDO_DEPTH = 64;
+
+//  steps a generated territory reaches from its city
+static const int TERRITORY_RADIUS = 4;
+
+EditorState::EditorState(StateManager& manager, Shared& shared) 
+    : State(manager, shared), mPainting(false)
 {
 }
 
@@ -62,6 +78,28 @@ void EditorState::leave()
     Gui.detachAll();
 }
 
+void EditorState::pushUndo()
+{
+    if (mUndo.size() >= UNDO_DEPTH) {
+        mUndo.erase(mUndo.begin());
+    }
+    UndoStep step;
+    step.map = Map.snapshot();
+    step.territories = Game.getTerritoryList();
+    mUndo.push_back(step);
+}
+
+void EditorState::undo()
+{
+    //  the territory plane comes back with the chunks, so it matches the
+    //  restored list
+    if (!mUndo.empty()) {
+        Map.restore(*mUndo.back().map);
+        Game.getTerritoryList() = mUndo.back().territories;
+        mUndo.pop_back();
+    }
+}
+
 void EditorState::update()
 {
     Vec2f mousePos = GG.mouse.getPos();
@@ -89,17 +127,29 @@ void EditorState::update()
 
     //  Set land
     if (GG.mouse.getLeft() == PRESSED) {
+        //  one undo step per stroke
+        if (!mPainting) {
+            pushUndo();
+            mPainting = true;
+        }
         HexCoord selectedHex = GG.hexGrid.WorldToHex(planeHit);
         if (Map.isValid(selectedHex)) {
             Map.at(selectedHex).setColor(ColorA(1.0f, 1.0f, 0.8f, 1.0f));
             Map.at(selectedHex).setLand(1);
         }
     }
+    else {
+        mPainting = false;
+    }
 
     std::stringstream ss;
     HexCoord selectedHex = GG.hexGrid.WorldToHex(planeHit);
     HexRender.setSelectedHex(selectedHex);
     ss << "Hex:" << selectedHex << " Owner: " << Map.at(selectedHex).getOwner(); // << " World: " << planeHit;
+    ss << " Region: " << (Map.isValid(selectedHex) ? GG.components.componentSize(selectedHex) : 0);
+    //  counters from the last frame drawn
+    const HexRenderStats& stats = HexRender.getStats();
+    ss << " Draws: " << stats.drawCalls << " Upload: " << stats.instanceBytes;
 
     GuiLabelData& labelData = mLabel->getData();
     labelData.Text = ss.str();
@@ -147,21 +197,46 @@ void EditorState::keyDown(ci::app::KeyEvent event)
         cameraTo += Vec3f(2.0f, 0, 0);
     }
     else if (keycode == app::KeyEvent::KEY_g) {
+        pushUndo();
         generate();
     }
+    else if (keycode == app::KeyEvent::KEY_z) {
+        undo();
+    }
     else if (keycode == app::KeyEvent::KEY_DELETE) {
+        pushUndo();
         Map.at(selectedHex).setLand(0);
     }
     else if (keycode == app::KeyEvent::KEY_SPACE) {
         mManager.setActiveState(string("game"));
     }
+    else if (keycode == app::KeyEvent::KEY_s) {
+        HexMapFile::save(mapPath(), Map, Game.getTerritories());
+    }
+    else if (keycode == app::KeyEvent::KEY_l) {
+        pushUndo();
+        HexMapFile file;
+        if (file.open(mapPath()) && file.load(Map)) {
+            //  territories with cells off the map are dropped
+            vector<Territory> territories;
+            file.loadTerritories(territories);
+            Game.getTerritoryList().assign(Map, territories);
+        }
+    }
+    else if (keycode == app::KeyEvent::KEY_i) {
+        HexRender.setInstancing(!HexRender.isInstancing());
+    }
+    else if (keycode == app::KeyEvent::KEY_p) {
+        HexRender.setProcedural(!HexRender.isProcedural());
+    }
     else if (keycode == app::KeyEvent::KEY_c) {
+        pushUndo();
         ConnectedByOwner byOwner(Map.at(selectedHex).getOwner());
         HexConnectivity connected = Map.connected(selectedHex, byOwner);
 
         // for (vector<HexCoord>::iterator it = connected.cells.begin(); it != connected.end(); ++it) {
         FOREACH (HexCoord coord, connected.cells) {
-            HexCell& cell = Map.at(coord);
+            HexCell cell = Map.at(coord);
             ColorA cellColor = cell.getColor();
             cellColor.r = 0.5f * cellColor.r;
             cellColor.g = 0.5f * cellColor.g;
@@ -170,19 +245,30 @@ void EditorState::keyDown(ci::app::KeyEvent event)
         }
 
         FOREACH (HexCoord coord, connected.borderCells) {
-            HexCell& cell = Map.at(coord);
+            HexCell cell = Map.at(coord);
             cell.setColor(ColorA(1,1,0,1));
         }
-        vector<HexEdges> edges = Map.extractEdges(connected);
 
+        //  trace the outlines, outer loops fading from white and holes from cyan
+        vector<HexEdgeLoop> loops = Map.extractEdges(connected);
+        FOREACH (HexEdgeLoop& loop, loops) {
+            ColorA color = loop.hole ? ColorA(0,1,1,1) : ColorA(1,1,1,1);
+            FOREACH (HexEdge& edge, loop.edges) {
+                Map.at(edge.cell).setColor(color);
+                color.a *= 0.8f;
+            }
+        }
     }
     else if (keycode == app::KeyEvent::KEY_BACKSPACE) {
+        pushUndo();
         Map.clear();
     }
     else if (keycode == app::KeyEvent::KEY_1) {
+        pushUndo();
         Map.at(selectedHex).setColor(ColorA(1.0f, 0, 0, 1.0f));
     }
     else if (keycode == app::KeyEvent::KEY_2) {
+        pushUndo();
         Map.at(selectedHex).setColor(ColorA(0, 0, 1.0f, 1.0f));
     }
 }
@@ -191,7 +277,8 @@ void EditorState::generate()
 {
     Map.clear();
     //  clear all the territories
-    Game.getTerritories().clear();
+    TerritoryList& territories = Game.getTerritoryList();
+    territories.clear(Map);
 
     //  City positions
     HexCoord start(32, 16);
@@ -232,104 +319,34 @@ void EditorState::generate()
     //     }
     // }
 
-    //  Add territories to the game
-    vector<Territory>& territories = Game.getTerritories();
-    int owner = 1;
+    //  Add territories to the game, each city seeding one and being its
+    //  territory's first cell
+    vector<HexSeed> seeds;
     FOREACH (HexCoord& coord, positions) {
-        Territory terr(coord);
-        terr.addCell(coord);
-        territories.push_back(terr);
-        HexCell& cell = Map.at(coord);
-        cell.setOwner(owner++);
-    }
-
-    //  XXX build up territories
-    owner = 1;
-    FOREACH (Territory& terr, territories) {
-        // Starting cell
-        HexCoord start = *(terr.mCells.begin());
-        assert(!terr.mCells.empty());
-
-        // Mark all adjacent cells
-        HexAdjacent adj = GG.hexGrid.adjacent(start);
-        for (int terrOffset=0; terrOffset < 6; ++terrOffset) {
-            HexCoord newCell = *(((HexCoord*)&adj) + terrOffset);
-            if (Map.isValid(newCell)) {
-                terr.addCell(newCell);
-                Map.at(newCell).setOwner(owner);
-            }
-        }
-
-        // Stamp on a random cell
-        int attempts = 500;
-        while (terr.mCells.size() < 48) {
-            int iEdge = Rand::randInt(1, terr.mCells.size());
-            HexCoord edgeCell = terr.mCells[iEdge];
-            // int terrOffset = Rand::randInt(0, 6);
-            adj = GG.hexGrid.adjacent(edgeCell);
-
-            vector<int> stamp;
-            switch (Rand::randInt(0, 4)) {
-                case 0:
-                    //  nw, ne
-                    stamp.push_back(NORTHWEST);
-                    stamp.push_back(SOUTHWEST);
-                    break;
-                case 1:
-                    // sw, se
-                    stamp.push_back(NORTHEAST);
-                    stamp.push_back(SOUTHEAST);
-                    break;
-                // case 2:
-                //     // n, s
-                //     stamp.push_back(NORTH);
-                //     stamp.push_back(NORTHEAST);
-                //     break;
-                // case 3:
-                //     stamp.push_back(NORTH);
-                //     stamp.push_back(NORTHWEST);
-                //     break;
-                // case 5:
-                //     stamp.push_back(SOUTH);
-                //     stamp.push_back(SOUTHEAST);
-                //     break;
-                // case 6:
-                //     stamp.push_back(SOUTH);
-                //     stamp.push_back(SOUTHWEST);
-                //     break;
-                default:
-                    // all neighbours
-                    for (int i=0; i < 6; ++i)
-                        stamp.push_back(i);
-                    break;
-            }
-
-            FOREACH (int terrOffset, stamp) {
-                HexCoord newCell = *(((HexCoord*)&adj) + terrOffset);
-                if (Map.isValid(newCell) && !terr.contains(newCell) 
-                        && Map.at(newCell).getOwner() < 0) {
-                    terr.addCell(newCell);
-                    Map.at(newCell).setOwner(owner);
-                }
-            }
-
-            if (--attempts == 0) {
-                //  just give up if we can't fill the territory (no biggie?)
-                break;
-            }
+        if (territories.add(Map, coord) >= 0) {
+            //  a late start makes for a smaller territory
+            seeds.push_back(HexSeed(coord, Rand::randInt(0, 2)));
         }
+    }
 
-        Map.at(start).setOwner(owner);
-        ++owner;
+    //  Grow them all at once, every cell within reach going to the nearest
+    //  city.
+    HexDistanceField field;
+    field.compute(Map, seeds, PassableAny(), TERRITORY_RADIUS);
+    FOREACH (int index, field.getCells()) {
+        territories.addCell(Map, field.nearest(index), Map.coord(index));
+    }
+    for (int t=0; t < territories.size(); ++t) {
+        territories.setOwner(Map, t, t + 1);
     }
 
     // color them randomly
-    FOREACH (Territory& terr, territories) {
+    FOREACH (const Territory& terr, territories.getTerritories()) {
         // Territory& terr = *(territories.begin()); 
         Vec3f randv = Rand::randVec3f();
         ColorA color(abs(randv.x), abs(randv.y), abs(randv.z), 1.0f);
 
-        FOREACH (HexCoord& coord, terr.mCells) {
+        FOREACH (const HexCoord& coord, terr.mCells) {
             Map.at(coord).setColor(color);
         }
     }
@@ -57,24 +57,24 @@ void GameState::enter()
     }
 
     //  Color territories
-    Vec2i mapSize = GG.hexMap.getSize();
+    HexMap& map = GG.hexMap;
 
     int ownerId=0;
-    vector<Territory>& territories = Game.getTerritories();
+    const vector<Territory>& territories = Game.getTerritories();
     int playerCount = Game.getPlayers().size();
 
     // for (vector<Territory>::iterator it=territories.begin(); it != territories.end(); ++i, ++it) {
-    FOREACH (Territory& terr, territories) {
+    FOREACH (const Territory& terr, territories) {
         Player& owner = Game.getPlayers()[ ownerId % playerCount ];
         // Territory& terr = *it;
         Vec3f randv = Rand::randVec3f();
 
-        for (vector<HexCoord>::iterator it = terr.mCells.begin(); 
+        for (vector<HexCoord>::const_iterator it = terr.mCells.begin(); 
              it != terr.mCells.end(); ++it) {
             ColorA cellColor(owner.getColor());
             cellColor.a = Rand::randFloat(0.77f, 0.966f);
 
-            GG.hexMap.at(*it).setColor(cellColor);
+            map.setColor(map.index(*it), cellColor);
         }
 
         ++ownerId;
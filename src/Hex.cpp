@@ -2,6 +2,14 @@
 
 #include <string>
 #include <sstream>
+#include <algorithm>
+#include <climits>
+#include <cfloat>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define HEX_GRID_SSE2
+#include <emmintrin.h>
+#endif
 
 using namespace ci;
 using namespace ci::app;
@@ -21,16 +29,11 @@ void HexGrid::setSpacing(double xspacing, double yspacing)
     mYSpacing = yspacing;
 }
 
-HexCoord HexGrid::WorldToHex(Vec3f worldPos)
+//  Second half of WorldToHex: round cube coordinates (x, y, z) that were
+//  floored to (ix, iy, iz) so they sum to zero, then convert to an offset
+//  coordinate
+static inline HexCoord roundCube(double x, double y, double z, int ix, int iy, int iz)
 {
-    double x = worldPos.x / mXSpacing;
-    double y = worldPos.y / mYSpacing;
-    double z = -0.5*x - y;
-           y = y - 0.5*x;
-
-    int ix = static_cast<int>(floor(x+0.5));
-    int iy = static_cast<int>(floor(y+0.5));
-    int iz = static_cast<int>(floor(z+0.5));
     int s = ix+iy+iz;
     if (s)
     {
@@ -49,6 +52,64 @@ HexCoord HexGrid::WorldToHex(Vec3f worldPos)
     return HexCoord(ix, iy);
 }
 
+HexCoord HexGrid::WorldToHex(Vec3f worldPos)
+{
+    double x = worldPos.x / mXSpacing;
+    double y = worldPos.y / mYSpacing;
+    double z = -0.5*x - y;
+           y = y - 0.5*x;
+
+    int ix = static_cast<int>(floor(x+0.5));
+    int iy = static_cast<int>(floor(y+0.5));
+    int iz = static_cast<int>(floor(z+0.5));
+    return roundCube(x, y, z, ix, iy, iz);
+}
+
+#ifdef HEX_GRID_SSE2
+//  floor() of two doubles within int range, SSE2 can only truncate
+static inline __m128d floorPd(__m128d v)
+{
+    __m128d t = _mm_cvtepi32_pd(_mm_cvttpd_epi32(v));
+    return _mm_sub_pd(t, _mm_and_pd(_mm_cmpgt_pd(t, v), _mm_set1_pd(1.0)));
+}
+#endif
+
+void HexGrid::WorldToHex(const Vec3f* worldPos, HexCoord* out, size_t count)
+{
+    size_t i = 0;
+#ifdef HEX_GRID_SSE2
+    //  the divides and floors two points at a time, the same double
+    //  operations in the same order as the scalar version
+    const __m128d xspacing = _mm_set1_pd(mXSpacing);
+    const __m128d yspacing = _mm_set1_pd(mYSpacing);
+    const __m128d half     = _mm_set1_pd(0.5);
+    const __m128d neghalf  = _mm_set1_pd(-0.5);
+    for (; i + 2 <= count; i += 2) {
+        __m128d x = _mm_div_pd(_mm_set_pd(worldPos[i+1].x, worldPos[i].x), xspacing);
+        __m128d y = _mm_div_pd(_mm_set_pd(worldPos[i+1].y, worldPos[i].y), yspacing);
+        __m128d z = _mm_sub_pd(_mm_mul_pd(neghalf, x), y);
+                y = _mm_sub_pd(y, _mm_mul_pd(half, x));
+
+        __m128i ix = _mm_cvttpd_epi32(floorPd(_mm_add_pd(x, half)));
+        __m128i iy = _mm_cvttpd_epi32(floorPd(_mm_add_pd(y, half)));
+        __m128i iz = _mm_cvttpd_epi32(floorPd(_mm_add_pd(z, half)));
+
+        double dx[2], dy[2], dz[2];
+        _mm_storeu_pd(dx, x);
+        _mm_storeu_pd(dy, y);
+        _mm_storeu_pd(dz, z);
+        out[i]   = roundCube(dx[0], dy[0], dz[0], _mm_cvtsi128_si32(ix), 
+                             _mm_cvtsi128_si32(iy), _mm_cvtsi128_si32(iz));
+        out[i+1] = roundCube(dx[1], dy[1], dz[1], _mm_cvtsi128_si32(_mm_srli_si128(ix, 4)), 
+                             _mm_cvtsi128_si32(_mm_srli_si128(iy, 4)), 
+                             _mm_cvtsi128_si32(_mm_srli_si128(iz, 4)));
+    }
+#endif
+    for (; i < count; ++i) {
+        out[i] = WorldToHex(worldPos[i]);
+    }
+}
+
 Vec3f HexGrid::HexToWorld(HexCoord hexPos, bool scale)
 {
     float x = hexPos.x * float(scale ? mXSpacing : 1.0f);
@@ -57,30 +118,53 @@ Vec3f HexGrid::HexToWorld(HexCoord hexPos, bool scale)
     return Vec3f(x, y, 0);
 }
 
-//  Returns neighbours in order nw, n, ne, se, s, sw
-HexAdjacent HexGrid::adjacent(HexCoord pos)
+void HexGrid::HexToWorld(const HexCoord* hexPos, Vec3f* out, size_t count, bool scale)
 {
-    HexAdjacent result;
-
-    if (pos.x % 2) {
-        // odd column
-        result.nw = HexCoord(pos.x-1, pos.y+1);
-        result.n  = HexCoord(pos.x, pos.y+1);
-        result.ne = HexCoord(pos.x+1, pos.y+1);
-        result.se = HexCoord(pos.x+1, pos.y);
-        result.s  = HexCoord(pos.x, pos.y-1);
-        result.sw = HexCoord(pos.x-1, pos.y);
+    size_t i = 0;
+#ifdef HEX_GRID_SSE2
+    const __m128 xspacing = _mm_set1_ps(float(scale ? mXSpacing : 1.0f));
+    const __m128 yspacing = _mm_set1_ps(float(scale ? mYSpacing : 1.0f));
+    const __m128 half     = _mm_set1_ps(0.5f);
+    const __m128 neghalf  = _mm_set1_ps(-0.5f);
+    const __m128i one     = _mm_set1_epi32(1);
+    for (; i + 4 <= count; i += 4) {
+        //  x0 y0 x1 y1, x2 y2 x3 y3 -> x0 x1 x2 x3, y0 y1 y2 y3
+        __m128i lo = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&hexPos[i])), 
+                                       _MM_SHUFFLE(3,1,2,0));
+        __m128i hi = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&hexPos[i+2])), 
+                                       _MM_SHUFFLE(3,1,2,0));
+        __m128i hx = _mm_unpacklo_epi64(lo, hi);
+        __m128i hy = _mm_unpackhi_epi64(lo, hi);
+
+        //  odd columns round down to the even column below, x - (x & 1)
+        __m128i even = _mm_sub_epi32(hx, _mm_and_si128(hx, one));
+        __m128 fx = _mm_cvtepi32_ps(hx);
+        __m128 yoffset = _mm_mul_ps(neghalf, _mm_cvtepi32_ps(even));
+        __m128 y = _mm_add_ps(_mm_add_ps(_mm_cvtepi32_ps(hy), _mm_mul_ps(half, fx)), yoffset);
+
+        float wx[4], wy[4];
+        _mm_storeu_ps(wx, _mm_mul_ps(fx, xspacing));
+        _mm_storeu_ps(wy, _mm_mul_ps(y, yspacing));
+        for (int j=0; j < 4; ++j) {
+            out[i+j] = Vec3f(wx[j], wy[j], 0);
+        }
     }
-    else {
-        // even column
-        result.nw = HexCoord(pos.x-1, pos.y);
-        result.n  = HexCoord(pos.x, pos.y+1);
-        result.ne = HexCoord(pos.x+1, pos.y);
-        result.se = HexCoord(pos.x+1, pos.y-1);
-        result.s  = HexCoord(pos.x, pos.y-1);
-        result.sw = HexCoord(pos.x-1, pos.y-1);
+#endif
+    for (; i < count; ++i) {
+        out[i] = HexToWorld(hexPos[i], scale);
     }
+}
 
+//  Returns neighbours in order nw, n, ne, se, s, sw
+HexAdjacent HexGrid::adjacent(HexCoord pos)
+{
+    HexAdjacent result;
+    result.nw = hexNeighbour(pos, NORTHWEST);
+    result.n  = hexNeighbour(pos, NORTH);
+    result.ne = hexNeighbour(pos, NORTHEAST);
+    result.se = hexNeighbour(pos, SOUTHEAST);
+    result.s  = hexNeighbour(pos, SOUTH);
+    result.sw = hexNeighbour(pos, SOUTHWEST);
     return result;
 }
 
@@ -106,75 +190,502 @@ string HexAdjacent::toString()
 }
 
 
-HexCell::HexCell()
+bool HexChunk::hasLand() const
 {
-    mLand = 0;
+    for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+        if (land[i]) {
+            return true;
+        }
+    }
+    return false;
 }
 
-HexCell::~HexCell()
-{ 
+bool HexChunk::hasTerritory() const
+{
+    for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+        if (territory[i] >= 0) {
+            return true;
+        }
+    }
+    return false;
 }
 
-void HexCell::setPos(HexCoord& pos) 
+//  Chunks are allocated on a cache line boundary.  The offset back to the
+//  start of the underlying allocation is stored in the byte before the chunk.
+void* HexChunk::operator new(size_t bytes)
 {
-    mPos = pos;
+    const size_t line = 64;
+    char* block = static_cast<char*>(::operator new(bytes + line));
+    char* aligned = block + (line - (reinterpret_cast<size_t>(block) & (line - 1)));
+    aligned[-1] = static_cast<char>(aligned - block);
+    return aligned;
 }
 
-void HexCell::setColor(ColorA& color) 
+void HexChunk::operator delete(void* p)
 {
-    mColor = color;
+    if (p) {
+        char* aligned = static_cast<char*>(p);
+        ::operator delete(aligned - static_cast<unsigned char>(aligned[-1]));
+    }
 }
 
-ColorA& HexCell::getColor()
+//  a 0..1 channel as a byte, as it is drawn
+static inline unsigned char unitByte(float value)
 {
-    return mColor;
+    return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
 }
 
-int HexCell::getLand()
+boost::uint32_t HexPalette::key(const Color& color)
 {
-    return mLand;
+    return (boost::uint32_t(unitByte(color.r)) << 16) | (unitByte(color.g) << 8) | unitByte(color.b);
 }
 
-void HexCell::setLand(int land)
+int HexPalette::find(const Color& color) const
 {
-    mLand = land;
+    boost::unordered_map<boost::uint32_t, unsigned char>::const_iterator it = mLookup.find(key(color));
+    return it == mLookup.end() ? -1 : it->second;
 }
 
-int HexCell::getOwner()
+int HexPalette::add(const Color& color)
 {
-    return mOwner;
+    int found = find(color);
+    if (found >= 0) {
+        return found;
+    }
+    if (!full()) {
+        mLookup[key(color)] = static_cast<unsigned char>(mColors.size());
+        mColors.push_back(color);
+        return size() - 1;
+    }
+
+    int nearest = 0;
+    float best = FLT_MAX;
+    for (int i=0; i < size(); ++i) {
+        float dr = mColors[i].r - color.r, dg = mColors[i].g - color.g, db = mColors[i].b - color.b;
+        float distance = dr * dr + dg * dg + db * db;
+        if (distance < best) {
+            best = distance;
+            nearest = i;
+        }
+    }
+    return nearest;
 }
 
-void HexCell::setOwner(int id)
+HexChunkLayout::HexChunkLayout(Vec2i size, HexCellOrder order)
 {
-    mOwner = id;
+    //  round the map up to whole chunks, and the chunks up to whole tiles
+    grid.x = (size.x + HEX_CHUNK_SIZE - 1) >> HEX_CHUNK_SHIFT;
+    grid.y = (size.y + HEX_CHUNK_SIZE - 1) >> HEX_CHUNK_SHIFT;
+    tileShift = order == HEX_ORDER_TILED ? TILE_SHIFT : 0;
+    tiles.x = (grid.x + (1 << tileShift) - 1) >> tileShift;
+    tiles.y = (grid.y + (1 << tileShift) - 1) >> tileShift;
 }
 
-HexMap::HexMap(HexGrid& grid, int width, int height) : mHexGrid(grid)
+HexMap::HexMap(HexGrid& grid, int width, int height, HexCellOrder order) 
+    : mHexGrid(grid), mLayout(Vec2i(width, height), order), mResidentChunks(0), 
+      mDefaultColor(0.15f, 0.15f, 0.15f, 1.0f), mColorMode(HEX_FULL_COLOR), mPalette(new HexPalette()), mSearchStamp(0)
 { 
     mSize.x = width;
     mSize.y = height;
 
-    mCells = new HexCell*[width];
-    for (int i=0; i < mSize.x; ++i ) {
-        for (int j=0; j < mSize.y; ++j) {
-            mCells[i] = new HexCell[mSize.y];
+    //  chunks are allocated on first write
+    mChunks.resize(getChunkCount() + 1);
+
+    mDefaultIndex = static_cast<unsigned char>(mPalette->add(Color(mDefaultColor.r, mDefaultColor.g, mDefaultColor.b)));
+    mDefaultAlpha = unitByte(mDefaultColor.a);
+}
+
+HexMap::~HexMap()
+{
+}
+
+//  Chunks are created through their own type so the pointer deletes them
+//  as that type
+
+HexChunkPtr HexMap::newChunk()
+{
+    HexChunkPtr c;
+    if (mColorMode == HEX_PALETTE_COLOR) {
+        HexPaletteChunk* cells = new HexPaletteChunk();
+        std::fill(cells->colorIndex, cells->colorIndex + HEX_CHUNK_CELLS, mDefaultIndex);
+        std::fill(cells->alpha, cells->alpha + HEX_CHUNK_CELLS, mDefaultAlpha);
+        c.reset(cells);
+    }
+    else {
+        HexColorChunk* cells = new HexColorChunk();
+        std::fill(cells->color, cells->color + HEX_CHUNK_CELLS, mDefaultColor);
+        c.reset(cells);
+    }
+    std::fill(c->owner, c->owner + HEX_CHUNK_CELLS, -1);
+    std::fill(c->land, c->land + HEX_CHUNK_CELLS, 0);
+    std::fill(c->territory, c->territory + HEX_CHUNK_CELLS, -1);
+    return c;
+}
+
+HexChunkPtr HexMap::newChunk(const HexChunk& copy)
+{
+    if (mColorMode == HEX_PALETTE_COLOR) {
+        return HexChunkPtr(new HexPaletteChunk(static_cast<const HexPaletteChunk&>(copy)));
+    }
+    return HexChunkPtr(new HexColorChunk(static_cast<const HexColorChunk&>(copy)));
+}
+
+HexChunk* HexMap::allocChunk(int chunk)
+{
+    assert(chunk < getChunkCount());
+    mChunks[chunk] = newChunk();
+    ++mResidentChunks;
+    return mChunks[chunk].get();
+}
+
+HexChunk* HexMap::writableChunk(int chunk)
+{
+    //  Only this thread can add references to a chunk, so once it is unique
+    //  it stays that way.  A snapshot released concurrently at worst causes
+    //  one needless copy.
+    HexChunkPtr& c = mChunks[chunk];
+    if (c && !c.unique()) {
+        c = newChunk(*c);
+    }
+    return c.get();
+}
+
+//  Writing a default value to an unwritten chunk leaves it unallocated
+
+int HexMap::paletteIndex(const Color& color)
+{
+    int found = mPalette->find(color);
+    if (found >= 0) {
+        return found;
+    }
+    //  a new entry is appended unless the palette is full, copy a palette
+    //  shared with snapshots first
+    if (!mPalette->full() && !mPalette.unique()) {
+        mPalette.reset(new HexPalette(*mPalette));
+    }
+    return mPalette->add(color);
+}
+
+void HexMap::setColor(int index, const ColorA& color)
+{
+    int c    = index >> (2*HEX_CHUNK_SHIFT);
+    int cell = index & (HEX_CHUNK_CELLS-1);
+
+    if (mColorMode == HEX_PALETTE_COLOR) {
+        //  a color not in the palette can't be the cell's, so only a color
+        //  that is actually written adds an entry
+        Color rgb(color.r, color.g, color.b);
+        int found = mPalette->find(rgb);
+        unsigned char alpha = unitByte(color.a);
+        const HexPaletteChunk* cells = static_cast<const HexPaletteChunk*>(mChunks[c].get());
+        unsigned char oldIndex = cells ? cells->colorIndex[cell] : mDefaultIndex;
+        unsigned char oldAlpha = cells ? cells->alpha[cell] : mDefaultAlpha;
+        if (found == oldIndex && alpha == oldAlpha) {
+            return;
+        }
+        unsigned char colorIndex = static_cast<unsigned char>(found >= 0 ? found : paletteIndex(rgb));
+        if (colorIndex == oldIndex && alpha == oldAlpha) {
+            //  a full palette's nearest entry
+            return;
+        }
+        HexPaletteChunk* chunk = static_cast<HexPaletteChunk*>(cells ? writableChunk(c) : allocChunk(c));
+        chunk->colorIndex[cell] = colorIndex;
+        chunk->alpha[cell]      = alpha;
+    }
+    else {
+        if (getColor(index) == color) {
+            return;
         }
+        HexChunk* chunk = mChunks[c] ? writableChunk(c) : allocChunk(c);
+        static_cast<HexColorChunk*>(chunk)->color[cell] = color;
     }
-    clear();
+    markDirty(index, HexDirtyTracker::COLOR);
 }
 
-HexMap::~HexMap()
+void HexMap::setColorMode(HexColorMode mode)
+{
+    if (mode == mColorMode) {
+        return;
+    }
+
+    //  convert through the old chunks and palette, a new palette starts
+    //  with the default color
+    HexColorMode  oldMode    = mColorMode;
+    HexPalettePtr oldPalette = mPalette;
+    mColorMode = mode;
+    if (mode == HEX_PALETTE_COLOR) {
+        mPalette.reset(new HexPalette());
+        mDefaultIndex = static_cast<unsigned char>(paletteIndex(Color(mDefaultColor.r, mDefaultColor.g, mDefaultColor.b)));
+    }
+
+    for (int c=0; c < getChunkCount(); ++c) {
+        HexChunkPtr old = mChunks[c];
+        if (!old) {
+            continue;
+        }
+        mChunks[c] = newChunk();
+        HexChunk* chunk = mChunks[c].get();
+        std::copy(old->owner, old->owner + HEX_CHUNK_CELLS, chunk->owner);
+        std::copy(old->land, old->land + HEX_CHUNK_CELLS, chunk->land);
+        std::copy(old->territory, old->territory + HEX_CHUNK_CELLS, chunk->territory);
+
+        for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+            ColorA color = hexChunkColor(old.get(), i, oldMode, *oldPalette);
+            if (mode == HEX_PALETTE_COLOR) {
+                HexPaletteChunk* cells = static_cast<HexPaletteChunk*>(chunk);
+                cells->colorIndex[i] = static_cast<unsigned char>(paletteIndex(Color(color.r, color.g, color.b)));
+                cells->alpha[i]      = unitByte(color.a);
+            }
+            else {
+                static_cast<HexColorChunk*>(chunk)->color[i] = color;
+            }
+        }
+    }
+
+    FOREACH (HexDirtyTracker* tracker, mTrackers) {
+        tracker->markAll();
+    }
+}
+
+void HexMap::setPalette(const HexPalette& palette)
 {
-    for (int i=0; i < mSize.x; ++i) {
-        delete [] mCells[i];
+    mPalette.reset(new HexPalette(palette));
+    mDefaultIndex = static_cast<unsigned char>(paletteIndex(Color(mDefaultColor.r, mDefaultColor.g, mDefaultColor.b)));
+}
+
+void HexMap::setOwner(int index, int id)
+{
+    int oldOwner = getOwner(index);
+    if (oldOwner == id) {
+        return;
+    }
+
+    HexChunk* chunk = writableChunk(index >> (2*HEX_CHUNK_SHIFT));
+    if (!chunk) {
+        chunk = allocChunk(index >> (2*HEX_CHUNK_SHIFT));
+    }
+    chunk->owner[index & (HEX_CHUNK_CELLS-1)] = static_cast<short>(id);
+    markDirty(index, HexDirtyTracker::OWNER);
+
+    FOREACH (HexMapListener* listener, mListeners) {
+        listener->ownerChanged(index, oldOwner, id);
     }
 }
 
-HexCell& HexMap::at(HexCoord& pos)
+void HexMap::setTerritory(int index, int id)
+{
+    assert(-1 <= id && id < HEX_MAX_TERRITORIES);
+    if (getTerritory(index) == id) {
+        return;
+    }
+
+    HexChunk* chunk = writableChunk(index >> (2*HEX_CHUNK_SHIFT));
+    if (!chunk) {
+        chunk = allocChunk(index >> (2*HEX_CHUNK_SHIFT));
+    }
+    chunk->territory[index & (HEX_CHUNK_CELLS-1)] = static_cast<short>(id);
+}
+
+void HexMap::clearTerritories()
+{
+    //  only chunks holding a territory are written, so chunks shared with
+    //  snapshots stay shared otherwise
+    for (int i=0; i < getChunkCount(); ++i) {
+        if (mChunks[i] && mChunks[i]->hasTerritory()) {
+            HexChunk* chunk = writableChunk(i);
+            std::fill(chunk->territory, chunk->territory + HEX_CHUNK_CELLS, -1);
+        }
+    }
+}
+
+void HexMap::setLand(int index, int land)
+{
+    unsigned char value = static_cast<unsigned char>(land);
+    if (getLand(index) == value) {
+        return;
+    }
+
+    HexChunk* chunk = writableChunk(index >> (2*HEX_CHUNK_SHIFT));
+    if (!chunk) {
+        chunk = allocChunk(index >> (2*HEX_CHUNK_SHIFT));
+    }
+    chunk->land[index & (HEX_CHUNK_CELLS-1)] = value;
+    markDirty(index, HexDirtyTracker::LAND);
+}
+
+void HexMap::beginSearch()
+{
+    //  the visited array covers every cell index, allocated on first use
+    if (mVisited.empty()) {
+        mVisited.assign(getIndexLimit(), 0);
+    }
+
+    //  two stamps per search, when they run out clear the marks and restart
+    if (mSearchStamp == 0 || mSearchStamp >= UINT_MAX - 2) {
+        std::fill(mVisited.begin(), mVisited.end(), 0);
+        mSearchStamp = 1;
+    }
+    else {
+        mSearchStamp += 2;
+    }
+
+    mSearchQueue.clear();
+}
+
+void HexMap::buildNeighbourIndex()
+{
+    //  indices past the map edge in partial chunks keep -1 neighbours
+    mNeighbourIndex.assign(getIndexLimit() * 6, -1);
+    for (int x=0; x < mSize.x; ++x) {
+        for (int y=0; y < mSize.y; ++y) {
+            HexCoord pos(x, y);
+            int* out = &mNeighbourIndex[index(pos) * 6];
+            for (HexNeighbours it(pos); it; ++it) {
+                if (isValid(*it)) {
+                    out[it.dir()] = index(*it);
+                }
+            }
+        }
+    }
+}
+
+size_t HexMap::getMemoryUsage()
+{
+    return sizeof(HexMap) + mChunks.capacity() * sizeof(HexChunkPtr) 
+        + mResidentChunks * hexChunkBytes(mColorMode) + mPalette->size() * sizeof(Color);
+}
+
+void HexMap::addListener(HexMapListener* listener)
+{
+    mListeners.push_back(listener);
+}
+
+void HexMap::removeListener(HexMapListener* listener)
+{
+    mListeners.erase(std::remove(mListeners.begin(), mListeners.end(), listener), mListeners.end());
+}
+
+void HexMap::replaceChunk(int chunk, const HexChunk* data)
+{
+    if (!data) {
+        if (mChunks[chunk]) {
+            mChunks[chunk].reset();
+            --mResidentChunks;
+        }
+        return;
+    }
+
+    //  every cell is overwritten, so a chunk shared with a snapshot is
+    //  replaced rather than copied
+    HexChunk* c = mChunks[chunk].get();
+    if (!c || !mChunks[chunk].unique()) {
+        if (c) {
+            --mResidentChunks;
+        }
+        c = allocChunk(chunk);
+    }
+    if (mColorMode == HEX_PALETTE_COLOR) {
+        *static_cast<HexPaletteChunk*>(c) = *static_cast<const HexPaletteChunk*>(data);
+    }
+    else {
+        *static_cast<HexColorChunk*>(c) = *static_cast<const HexColorChunk*>(data);
+    }
+}
+
+void HexMap::endReplace()
+{
+    FOREACH (HexDirtyTracker* tracker, mTrackers) {
+        tracker->markAll();
+    }
+    FOREACH (HexMapListener* listener, mListeners) {
+        listener->mapLoaded();
+    }
+}
+
+HexMapSnapshotPtr HexMap::snapshot()
+{
+    boost::shared_ptr<HexMapSnapshot> snap(new HexMapSnapshot());
+    snap->mSize = mSize;
+    snap->mLayout = mLayout;
+    snap->mChunks = mChunks;
+    snap->mDefaultColor = mDefaultColor;
+    snap->mColorMode = mColorMode;
+    snap->mPalette = mPalette;
+    return snap;
+}
+
+void HexMap::restore(const HexMapSnapshot& snapshot)
+{
+    assert(snapshot.mChunks.size() == mChunks.size());
+
+    //  chunks of another color mode never share pointers, so all of them
+    //  are put back and marked below
+    mColorMode = snapshot.mColorMode;
+    mPalette = snapshot.mPalette;
+    mDefaultIndex = static_cast<unsigned char>(mPalette->find(Color(mDefaultColor.r, mDefaultColor.g, mDefaultColor.b)));
+
+    for (int c=0; c < getChunkCount(); ++c) {
+        if (mChunks[c] == snapshot.mChunks[c]) {
+            continue;
+        }
+        mResidentChunks += (snapshot.mChunks[c] ? 1 : 0) - (mChunks[c] ? 1 : 0);
+        mChunks[c] = snapshot.mChunks[c];
+
+        //  the chunk's cells on the map may all have changed
+        if (!mTrackers.empty()) {
+            HexCoord origin = chunkOrigin(c);
+            int xend = std::min<int>(HEX_CHUNK_SIZE, mSize.x - origin.x);
+            int yend = std::min<int>(HEX_CHUNK_SIZE, mSize.y - origin.y);
+            for (int x=0; x < xend; ++x) {
+                for (int y=0; y < yend; ++y) {
+                    markDirty((c << (2*HEX_CHUNK_SHIFT)) | (x << HEX_CHUNK_SHIFT) | y, 
+                              HexDirtyTracker::ALL);
+                }
+            }
+        }
+    }
+
+    FOREACH (HexMapListener* listener, mListeners) {
+        listener->mapLoaded();
+    }
+}
+
+void HexMap::addTracker(HexDirtyTracker* tracker)
+{
+    mTrackers.push_back(tracker);
+}
+
+void HexMap::removeTracker(HexDirtyTracker* tracker)
+{
+    mTrackers.erase(std::remove(mTrackers.begin(), mTrackers.end(), tracker), mTrackers.end());
+}
+
+HexDirtyTracker::HexDirtyTracker(HexMap& map, int fields)
+    : mHexMap(map), mFields(fields), mAll(false), mBits(map.getIndexLimit() / 64, 0)
+{
+    mHexMap.addTracker(this);
+}
+
+HexDirtyTracker::~HexDirtyTracker()
+{
+    mHexMap.removeTracker(this);
+}
+
+void HexDirtyTracker::clear()
+{
+    //  every set bit belongs to a listed cell
+    FOREACH (int cell, mCells) {
+        mBits[cell >> 6] = 0;
+    }
+    mCells.clear();
+    mChunks.clear();
+    mAll = false;
+}
+
+HexCell HexMap::at(const HexCoord& pos)
 {
     assert(pos.x >=0 && pos.x < mSize.x && pos.y >= 0 && pos.y < mSize.y);
-    return mCells[pos.x][pos.y];
+    return HexCell(*this, index(pos));
 }
 
 Vec2i HexMap::getSize()
@@ -183,7 +694,7 @@ Vec2i HexMap::getSize()
 }
 
 //  Check position lies on hex map
-bool HexMap::isValid(HexCoord& pos)
+bool HexMap::isValid(const HexCoord& pos)
 {
     return (pos.x >= 0 && pos.y >= 0 && pos.x < mSize.x && pos.y < mSize.y);
 }
@@ -223,126 +734,247 @@ void HexRegion::addHexes(vector<HexCoord>& hexes)
     }
 }
 
-// std::vector<HexRegion> HexMap::regions()
-// {
-//     unordered_set<HexCoord> search;
-//     unordered_set<HexCoord> checked;
-//     vector<HexRegion> regions;
-// 
-//     HexCoord pos;
-//     for (int ix=0; ix < mSize.x; ++ix) {
-//         for (int iy=0; iy < mSize.y; ++iy) {
-//             pos = HexCoord(ix, iy);
-//             if (at(pos).getLand()) {
-//                 search.emplace(pos);
-//             }
-//         }
-//     }
-// 
-//     while (search.begin() != search.end()) {
-//         HexCoord check = *(search.begin());
-// 
-//         vector<HexCoord> conn = connected(check);
-//         for (vector<HexCoord>::iterator it = conn.begin(); it != conn.end(); ++it) {
-//             search.erase(*it);
-//         }
-// 
-//         HexRegion region;
-//         region.addHexes(conn);
-//         regions.push_back(region);        
-// 
-//         //  XXX not required, already erased above
-//         search.erase(check);
-//     }
-// 
-//     return regions;
-// }
-
 void HexMap::clear()
 {
-    for (int i=0; i < mSize.x; ++i ) {
-        for (int j=0; j < mSize.y; ++j) {
-            HexCell& cell = at(HexCoord(i,j));
-            cell.setPos(HexCoord(i,j));
-            cell.setColor(ColorA(0.15f, 0.15f, 0.15f, 1.0f));
-            cell.setOwner(-1);
+    //  Reset owners and colors, land and territories are kept.  Chunks
+    //  left with neither hold only default values and are released.  Every cell
+    //  is left the default color, so a palette starts again from that alone;
+    //  snapshots keep the palette they were taken with.
+    if (mColorMode == HEX_PALETTE_COLOR) {
+        mPalette.reset(new HexPalette());
+        mDefaultIndex = static_cast<unsigned char>(mPalette->add(Color(mDefaultColor.r, mDefaultColor.g, mDefaultColor.b)));
+    }
+    for (int i=0; i < getChunkCount(); ++i) {
+        if (!mChunks[i]) {
+            continue;
+        }
+        if (!mChunks[i]->hasLand() && !mChunks[i]->hasTerritory()) {
+            mChunks[i].reset();
+            --mResidentChunks;
+            continue;
+        }
+        HexChunk* chunk = writableChunk(i);
+        if (mColorMode == HEX_PALETTE_COLOR) {
+            HexPaletteChunk* cells = static_cast<HexPaletteChunk*>(chunk);
+            std::fill(cells->colorIndex, cells->colorIndex + HEX_CHUNK_CELLS, mDefaultIndex);
+            std::fill(cells->alpha, cells->alpha + HEX_CHUNK_CELLS, mDefaultAlpha);
         }
+        else {
+            HexColorChunk* cells = static_cast<HexColorChunk*>(chunk);
+            std::fill(cells->color, cells->color + HEX_CHUNK_CELLS, mDefaultColor);
+        }
+        std::fill(chunk->owner, chunk->owner + HEX_CHUNK_CELLS, -1);
+    }
+    FOREACH (HexDirtyTracker* tracker, mTrackers) {
+        tracker->markAll();
     }
-}
 
-//vector<int> HexMap::countHexes()
-//{
-//    vector<int> counts();
-//
-//    for (int ix=0; ix < mSize.x; ++ix) {
-//        for (int iy=0; iy < mSize.y; ++iy) {
-//            HexCell& cell = at(ix, iy);
-//            if (cell.getLand()) {
-//            }
-//        }
-//    }
-//}
+    FOREACH (HexMapListener* listener, mListeners) {
+        listener->mapCleared();
+    }
+}
 
 
-vector<HexEdges> HexMap::extractEdges(HexConnectivity& conn)
+vector<HexEdgeLoop> HexMap::extractEdges(const HexConnectivity& conn)
 {
-    //  Extract a border loop as a vector of HexEdges
-    vector<HexEdges> result;
-    unordered_set<HexCoord> borderCells(conn.borderCells.begin(), conn.borderCells.end());
-
-    HexCoord start = *(conn.borderCells.begin());
-    HexCoord coord = start;
-    int owner = at(coord).getOwner();
+    vector<HexEdgeLoop> loops;
+    extractEdges(conn, loops);
+    return loops;
+}
 
-    ColorA color(1.0f,1.0f,1.0f,1.0f);
-    do {
-        // vector<HexCoord> adjacents = mHexGrid.adjacent(coord).toVector();
-        HexAdjacent adjacents = mHexGrid.adjacent(coord);
+void HexMap::extractEdges(const HexConnectivity& conn, vector<HexEdgeLoop>& loops)
+{
+    loops.clear();
+    if (mEdgeMask.empty()) {
+        mEdgeMask.assign(getIndexLimit(), 0);
+    }
 
-        HexEdges edges(coord);
+    //  mark the region with the search stamps
+    beginSearch();
+    const unsigned int inside = mSearchStamp + 1;
+    FOREACH (const HexCoord& coord, conn.cells) {
+        mVisited[index(coord)] = inside;
+    }
 
-        // FOREACH (HexCoord adjacent, adjacents) {
+    //  every side facing a cell outside the region is a boundary edge
+    const int* neighbours = neighbourIndex();
+    FOREACH (const HexCoord& coord, conn.cells) {
+        int cell = index(coord);
+        const int* adjacent = neighbours + cell*6;
+        unsigned char mask = 0;
         for (int i=0; i < 6; ++i) {
-            HexDir dir = static_cast<HexDir>(i);
-            HexCoord adjacent = adjacents.getAdjacent(dir);
-            if (isValid(adjacent) && at(adjacent).getOwner() != owner) { 
-               //  a border edge
-               edges.addEdge(dir);
+            if (adjacent[i] < 0 || mVisited[adjacent[i]] != inside) {
+                mask |= 1 << i;
             }
         }
-        result.push_back(edges);
-        at(edges.getHexCoord()).setColor(color);
-        color.a *= 0.8f;
+        mEdgeMask[cell] = mask;
+    }
 
-        //  Choose the next hex in the border loop
-        HexCoord nextHex;
+    //  Walk each loop from its first unwalked edge.  The corner at the
+    //  clockwise end of side dir is shared with the neighbours in dir and
+    //  dir+1.  If the dir+1 neighbour is outside, the loop turns right onto
+    //  the next side of this cell, otherwise it turns left onto that
+    //  neighbour's side facing the dir neighbour, which is its dir-1 side.
+    //  Once round an outer boundary makes six more right turns than left
+    //  turns, once round a hole six more left turns.
+    FOREACH (const HexCoord& start, conn.cells) {
+        int startCell = index(start);
+        while (mEdgeMask[startCell]) {
+            int startDir = 0;
+            while (!(mEdgeMask[startCell] & (1 << startDir))) {
+                ++startDir;
+            }
 
-        //  eligible next cells based on the border edges
-        vector<HexDir> validDirs;
-        for (int i=0; i < 6; ++i) {
-            HexDir edge = static_cast<HexDir>((i+1) % 6);
-            if (edges.hasEdge(edge)) {
-                validDirs.push_back(static_cast<HexDir>(edge == 0 ? 5 : edge-1));
-                validDirs.push_back(static_cast<HexDir>(edge == 5 ? 0 : edge+1));
+            loops.push_back(HexEdgeLoop());
+            HexEdgeLoop& loop = loops.back();
+
+            int cell = startCell;
+            int dir = startDir;
+            int turns = 0;
+            do {
+                loop.edges.push_back(HexEdge(coord(cell), static_cast<HexDir>(dir)));
+                mEdgeMask[cell] &= ~(1 << dir);
+
+                int nextDir = (dir + 1) % 6;
+                int next = neighbours[cell*6 + nextDir];
+                if (next >= 0 && mVisited[next] == inside) {
+                    cell = next;
+                    dir = (dir + 5) % 6;
+                    --turns;
+                }
+                else {
+                    dir = nextDir;
+                    ++turns;
+                }
+            } while (cell != startCell || dir != startDir);
+
+            loop.hole = turns < 0;
+        }
+    }
+}
+
+
+//  orders points by angle about a centre
+struct AngleOrder
+{
+    ci::Vec2f centre;
+
+    AngleOrder(const Vec2f& centre) : centre(centre) { }
+    bool operator()(const Vec2f& a, const Vec2f& b) const {
+        return atan2(a.y - centre.y, a.x - centre.x) < atan2(b.y - centre.y, b.x - centre.x);
+    }
+};
+
+void HexViewRegion::setFrustum(const Vec3f* nearCorners, const Vec3f* farCorners)
+{
+    mPolygon.clear();
+    for (int i=0; i < 4; ++i) {
+        const Vec3f* edges[3][2] = {
+            { &nearCorners[i], &nearCorners[(i+1) & 3] },
+            { &farCorners[i],  &farCorners[(i+1) & 3] },
+            { &nearCorners[i], &farCorners[i] }
+        };
+        for (int e=0; e < 3; ++e) {
+            const Vec3f& a = *edges[e][0];
+            const Vec3f& b = *edges[e][1];
+            if ((a.z <= 0) == (b.z <= 0)) {
+                continue;
             }
+            float t = a.z / (a.z - b.z);
+            mPolygon.push_back(Vec2f(a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t));
         }
+    }
+    if (mPolygon.size() < 3) {
+        mPolygon.clear();
+        return;
+    }
+
+    //  the crossings are the corners of a convex polygon, put them in order
+    Vec2f centre(0, 0);
+    FOREACH (const Vec2f& p, mPolygon) {
+        centre += p;
+    }
+    centre /= float(mPolygon.size());
+    std::sort(mPolygon.begin(), mPolygon.end(), AngleOrder(centre));
+}
 
-        FOREACH (HexDir validDir, validDirs) {
-            HexCoord adjacent = adjacents.getAdjacent(validDir);
-            // test for an untouched border cell
-            if (borderCells.find(adjacent) != borderCells.end()) {
-               nextHex = adjacent;
-               borderCells.erase(adjacent);
-               break;
+bool HexViewRegion::spanY(float x0, float x1, float& y0, float& y1)
+{
+    bool found = false;
+    for (size_t i=0; i < mPolygon.size(); ++i) {
+        const Vec2f& a = mPolygon[i];
+        const Vec2f& b = mPolygon[(i+1) % mPolygon.size()];
+        float ys[3];
+        int count = 0;
+        if (a.x >= x0 && a.x <= x1) {
+            ys[count++] = a.y;
+        }
+        //  where the edge crosses either side of the strip
+        float xs[2] = { x0, x1 };
+        for (int s=0; s < 2; ++s) {
+            if ((a.x < xs[s]) != (b.x < xs[s])) {
+                ys[count++] = a.y + (b.y - a.y) * (xs[s] - a.x) / (b.x - a.x);
             }
         }
-        // assert (nextHex != coord);
-        coord = nextHex;
+        for (int k=0; k < count; ++k) {
+            y0 = found ? std::min(y0, ys[k]) : ys[k];
+            y1 = found ? std::max(y1, ys[k]) : ys[k];
+            found = true;
+        }
+    }
+    return found;
+}
 
-    } while (coord != start && result.size() < conn.borderCells.size()); // XXX DEBUGGING TERMINATE CONDITION
+bool HexViewRegion::cellBounds(HexMap& map, HexCoord& lo, HexCoord& hi, float margin)
+{
+    if (mPolygon.empty()) {
+        return false;
+    }
+    Vec2f pmin = mPolygon[0], pmax = mPolygon[0];
+    FOREACH (const Vec2f& p, mPolygon) {
+        pmin.x = std::min(pmin.x, p.x);
+        pmin.y = std::min(pmin.y, p.y);
+        pmax.x = std::max(pmax.x, p.x);
+        pmax.y = std::max(pmax.y, p.y);
+    }
 
-    // XXX assert pending queue is empty
-    
-    return result;
+    //  column x is centred at x * xspacing, row y at (y + 0.5 (x&1)) * yspacing
+    HexGrid& grid = map.hexGrid();
+    float xspacing = grid.HexToWorld(HexCoord(1, 0)).x;
+    float yspacing = grid.HexToWorld(HexCoord(0, 1)).y;
+    Vec2i size = map.getSize();
+    lo.x = std::max(static_cast<int>(ceil((pmin.x - margin) / xspacing)), 0);
+    hi.x = std::min(static_cast<int>(floor((pmax.x + margin) / xspacing)), size.x - 1);
+    lo.y = std::max(static_cast<int>(ceil((pmin.y - margin) / yspacing - 0.5f)), 0);
+    hi.y = std::min(static_cast<int>(floor((pmax.y + margin) / yspacing)), size.y - 1);
+    return lo.x <= hi.x && lo.y <= hi.y;
 }
 
+void HexViewRegion::findChunks(HexMap& map, vector<int>& chunks, float margin)
+{
+    chunks.clear();
+    HexCoord lo, hi;
+    if (!cellBounds(map, lo, hi, margin)) {
+        return;
+    }
+
+    HexGrid& grid = map.hexGrid();
+    float xspacing = grid.HexToWorld(HexCoord(1, 0)).x;
+    float yspacing = grid.HexToWorld(HexCoord(0, 1)).y;
+    Vec2i size = map.getSize();
+    for (int cx = lo.x >> HEX_CHUNK_SHIFT; cx <= hi.x >> HEX_CHUNK_SHIFT; ++cx) {
+        //  the polygon's span over the centres of the chunk's columns,
+        //  widened by the margin either way
+        int x0 = cx << HEX_CHUNK_SHIFT;
+        int x1 = std::min(x0 + HEX_CHUNK_MASK, size.x - 1);
+        float y0, y1;
+        if (!spanY(x0 * xspacing - margin, x1 * xspacing + margin, y0, y1)) {
+            continue;
+        }
+        int row0 = std::max(static_cast<int>(ceil((y0 - margin) / yspacing - 0.5f)), 0);
+        int row1 = std::min(static_cast<int>(floor((y1 + margin) / yspacing)), size.y - 1);
+        for (int cy = row0 >> HEX_CHUNK_SHIFT; row0 <= row1 && cy <= row1 >> HEX_CHUNK_SHIFT; ++cy) {
+            chunks.push_back(map.chunkAt(cx, cy));
+        }
+    }
+}
@@ -0,0 +1,349 @@
+#include "HexBitboard.h"
+
+#include <algorithm>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#define HEX_BITBOARD_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace ci;
+using namespace war;
+
+using std::vector;
+
+void HexBitboard::reset(Vec2i size)
+{
+    mSize = size;
+    mColumnWords = (size.y + 63) >> 6;
+    mWords.assign(size.x * mColumnWords, 0);
+
+    int lastBits = size.y & 63;
+    mLastWordMask = lastBits ? (HexBitWord(1) << lastBits) - 1 : ~HexBitWord(0);
+}
+
+void HexBitboard::clear()
+{
+    std::fill(mWords.begin(), mWords.end(), 0);
+}
+
+void HexBitboard::maskPadding()
+{
+    for (int x=0; x < mSize.x; ++x) {
+        column(x)[mColumnWords-1] &= mLastWordMask;
+    }
+}
+
+int HexBitboard::popCount(HexBitWord bits)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(bits);
+#else
+    bits = bits - ((bits >> 1) & 0x5555555555555555ULL);
+    bits = (bits & 0x3333333333333333ULL) + ((bits >> 2) & 0x3333333333333333ULL);
+    bits = (bits + (bits >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return static_cast<int>((bits * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+int HexBitboard::lowestBit(HexBitWord bits)
+{
+#if defined(__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    //  count the trailing zeros below the lowest set bit
+    return popCount((bits & (~bits + 1)) - 1);
+#endif
+}
+
+int HexBitboard::count() const
+{
+    int total = 0;
+    for (vector<HexBitWord>::const_iterator it=mWords.begin(); it != mWords.end(); ++it) {
+        total += popCount(*it);
+    }
+    return total;
+}
+
+bool HexBitboard::empty() const
+{
+    for (vector<HexBitWord>::const_iterator it=mWords.begin(); it != mWords.end(); ++it) {
+        if (*it) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//  Apply a word-wise boolean operation over two boards, two words at a time
+//  with SSE2.  Op provides both a scalar and an __m128i overload.
+template <typename Op>
+static void combineWords(HexBitWord* dst, const HexBitWord* src, size_t count, Op op)
+{
+    size_t i = 0;
+#ifdef HEX_BITBOARD_SSE2
+    for (; i + 2 <= count; i += 2) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), op(a, b));
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] = op(dst[i], src[i]);
+    }
+}
+
+struct AndOp {
+    HexBitWord operator()(HexBitWord a, HexBitWord b) { return a & b; }
+#ifdef HEX_BITBOARD_SSE2
+    __m128i operator()(__m128i a, __m128i b) { return _mm_and_si128(a, b); }
+#endif
+};
+
+struct OrOp {
+    HexBitWord operator()(HexBitWord a, HexBitWord b) { return a | b; }
+#ifdef HEX_BITBOARD_SSE2
+    __m128i operator()(__m128i a, __m128i b) { return _mm_or_si128(a, b); }
+#endif
+};
+
+struct XorOp {
+    HexBitWord operator()(HexBitWord a, HexBitWord b) { return a ^ b; }
+#ifdef HEX_BITBOARD_SSE2
+    __m128i operator()(__m128i a, __m128i b) { return _mm_xor_si128(a, b); }
+#endif
+};
+
+struct AndNotOp {
+    HexBitWord operator()(HexBitWord a, HexBitWord b) { return a & ~b; }
+#ifdef HEX_BITBOARD_SSE2
+    //  _mm_andnot_si128 negates its first argument
+    __m128i operator()(__m128i a, __m128i b) { return _mm_andnot_si128(b, a); }
+#endif
+};
+
+HexBitboard& HexBitboard::operator&=(const HexBitboard& other)
+{
+    assert(mSize == other.mSize);
+    combineWords(&mWords[0], &other.mWords[0], mWords.size(), AndOp());
+    return *this;
+}
+
+HexBitboard& HexBitboard::operator|=(const HexBitboard& other)
+{
+    assert(mSize == other.mSize);
+    combineWords(&mWords[0], &other.mWords[0], mWords.size(), OrOp());
+    return *this;
+}
+
+HexBitboard& HexBitboard::operator^=(const HexBitboard& other)
+{
+    assert(mSize == other.mSize);
+    combineWords(&mWords[0], &other.mWords[0], mWords.size(), XorOp());
+    return *this;
+}
+
+HexBitboard& HexBitboard::andNot(const HexBitboard& other)
+{
+    assert(mSize == other.mSize);
+    combineWords(&mWords[0], &other.mWords[0], mWords.size(), AndNotOp());
+    return *this;
+}
+
+void HexBitboard::invert()
+{
+    for (vector<HexBitWord>::iterator it=mWords.begin(); it != mWords.end(); ++it) {
+        *it = ~*it;
+    }
+    maskPadding();
+}
+
+//  Reads a column of a board, flipping each word first when flip is all ones.
+//  The padding bits of a flipped column stay clear, so cells off the end of a
+//  column read as unset either way.
+struct ColumnReader
+{
+    const HexBitWord* col;
+    int               words;
+    HexBitWord        flip;
+    HexBitWord        lastMask;
+
+    ColumnReader(const HexBitWord* col, int words, HexBitWord flip, HexBitWord lastMask)
+        : col(col), words(words), flip(flip), lastMask(lastMask) { }
+
+    HexBitWord word(int w) const {
+        HexBitWord bits = col[w] ^ flip;
+        return w+1 < words ? bits : bits & lastMask;
+    }
+
+    //  up moves bit y to y+1, down moves bit y to y-1, carrying between words
+    HexBitWord up(int w) const { return (word(w) << 1) | (w > 0 ? word(w-1) >> 63 : 0); }
+    HexBitWord down(int w) const { return (word(w) >> 1) | (w+1 < words ? word(w+1) << 63 : 0); }
+
+#ifdef HEX_BITBOARD_SSE2
+    //  Words w and w+1, for 1 <= w and w+2 < words, so neither lane is the
+    //  last word and its padding needs no mask.  The shifted-in bits come
+    //  from loads one word either side rather than a shuffle between the
+    //  two lanes.  down() can load the last word, but only its bit 0 is
+    //  shifted in, and that is always a cell of the column, never padding.
+    __m128i word(int w, __m128i flips) const {
+        return _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(col + w)), flips);
+    }
+    __m128i up(int w, __m128i flips) const {
+        return _mm_or_si128(_mm_slli_epi64(word(w, flips), 1), _mm_srli_epi64(word(w-1, flips), 63));
+    }
+    __m128i down(int w, __m128i flips) const {
+        return _mm_or_si128(_mm_srli_epi64(word(w, flips), 1), _mm_slli_epi64(word(w+1, flips), 63));
+    }
+#endif
+};
+
+void HexBitboard::spread(HexBitboard& out, HexBitWord flip) const
+{
+    assert(&out != this);
+    if (out.mSize != mSize) {
+        out.reset(mSize);
+    }
+
+    for (int x=0; x < mSize.x; ++x) {
+        ColumnReader col(column(x), mColumnWords, flip, mLastWordMask);
+        HexBitWord* dst = out.column(x);
+        bool left  = x > 0;
+        bool right = x+1 < mSize.x;
+        ColumnReader prev(left ? column(x-1) : 0, mColumnWords, flip, mLastWordMask);
+        ColumnReader next(right ? column(x+1) : 0, mColumnWords, flip, mLastWordMask);
+
+        //  even columns neighbour (x+-1, y) and (x+-1, y-1),
+        //  odd columns neighbour (x+-1, y) and (x+-1, y+1)
+        bool odd = (x & 1) != 0;
+
+        int w = 0;
+#ifdef HEX_BITBOARD_SSE2
+        if (mColumnWords >= 4) {
+            //  the first word takes no carry from below, do it scalar
+            dst[0] = col.word(0) | col.up(0) | col.down(0);
+            if (left) {
+                dst[0] |= prev.word(0) | (odd ? prev.down(0) : prev.up(0));
+            }
+            if (right) {
+                dst[0] |= next.word(0) | (odd ? next.down(0) : next.up(0));
+            }
+
+            __m128i flips = _mm_set1_epi32(flip ? -1 : 0);
+            for (w=1; w+2 < mColumnWords; w += 2) {
+                __m128i bits = _mm_or_si128(col.word(w, flips),
+                               _mm_or_si128(col.up(w, flips), col.down(w, flips)));
+                if (left) {
+                    bits = _mm_or_si128(bits, _mm_or_si128(prev.word(w, flips),
+                                        odd ? prev.down(w, flips) : prev.up(w, flips)));
+                }
+                if (right) {
+                    bits = _mm_or_si128(bits, _mm_or_si128(next.word(w, flips),
+                                        odd ? next.down(w, flips) : next.up(w, flips)));
+                }
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + w), bits);
+            }
+        }
+#endif
+        for (; w < mColumnWords; ++w) {
+            HexBitWord bits = col.word(w) | col.up(w) | col.down(w);
+            if (left) {
+                bits |= prev.word(w) | (odd ? prev.down(w) : prev.up(w));
+            }
+            if (right) {
+                bits |= next.word(w) | (odd ? next.down(w) : next.up(w));
+            }
+            dst[w] = bits;
+        }
+    }
+
+    if (flip) {
+        out.invert();
+    }
+    else {
+        out.maskPadding();
+    }
+}
+
+void HexBitboard::dilate(HexBitboard& out) const
+{
+    spread(out, 0);
+}
+
+void HexBitboard::erode(HexBitboard& out) const
+{
+    //  a cell survives unless it neighbours an unset cell, so dilate the
+    //  unset cells, reading the board inverted rather than copying it
+    spread(out, ~HexBitWord(0));
+}
+
+void HexBitboard::border(HexBitboard& out) const
+{
+    erode(out);
+    out.invert();
+    out &= *this;
+}
+
+void HexBitboard::frontier(HexBitboard& out) const
+{
+    dilate(out);
+    out.andNot(*this);
+}
+
+void HexBitboards::build(HexMap& map, int ownerCount)
+{
+    Vec2i size = map.getSize();
+    mLand.reset(size);
+    mOwners.resize(ownerCount);
+    for (int i=0; i < ownerCount; ++i) {
+        mOwners[i].reset(size);
+    }
+
+    //  Each chunk column is HEX_CHUNK_SIZE cells which always fall within a
+    //  single 64 bit word, so gather the bits and OR them in once
+    for (int c=0; c < map.getChunkCount(); ++c) {
+        const HexChunk* chunk = map.getChunk(c);
+        if (!chunk) {
+            continue;
+        }
+
+        HexCoord origin = map.chunkOrigin(c);
+        int word  = origin.y >> 6;
+        int shift = origin.y & 63;
+        int xend  = std::min(origin.x + HEX_CHUNK_SIZE, size.x);
+        int yend  = std::min<int>(HEX_CHUNK_SIZE, size.y - origin.y);
+
+        for (int x=origin.x; x < xend; ++x) {
+            int base = (x - origin.x) << HEX_CHUNK_SHIFT;
+            HexBitWord land = 0;
+            for (int y=0; y < yend; ++y) {
+                HexBitWord bit = HexBitWord(1) << (shift + y);
+                if (chunk->land[base + y]) {
+                    land |= bit;
+                }
+                int owner = chunk->owner[base + y];
+                if (owner >= 0 && owner < ownerCount) {
+                    mOwners[owner].column(x)[word] |= bit;
+                }
+            }
+            mLand.column(x)[word] |= land;
+        }
+    }
+}
+
+void HexBitboards::owned(HexBitboard& out)
+{
+    out.reset(mLand.getSize());
+    FOREACH (HexBitboard& board, mOwners) {
+        out |= board;
+    }
+}
+
+vector<int> HexBitboards::countHexes()
+{
+    vector<int> counts;
+    FOREACH (HexBitboard& board, mOwners) {
+        counts.push_back(board.count());
+    }
+    return counts;
+}
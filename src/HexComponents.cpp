@@ -0,0 +1,716 @@
+#include "HexComponents.h"
+
+#include <algorithm>
+#include <climits>
+
+#include "boost/bind.hpp"
+#include "boost/function.hpp"
+#include "boost/thread.hpp"
+#include "boost/unordered_map.hpp"
+
+using namespace ci;
+using namespace war;
+
+using std::vector;
+using std::multiset;
+
+HexComponentIndex::HexComponentIndex(HexMap& map) 
+    : mHexMap(map), mRoots(0), mCells(0), mMarkStamp(0)
+{
+    rebuild();
+    mHexMap.addListener(this);
+}
+
+HexComponentIndex::~HexComponentIndex()
+{
+    mHexMap.removeListener(this);
+}
+
+int HexComponentIndex::newNode(int owner, int size)
+{
+    int node = static_cast<int>(mParent.size());
+    mParent.push_back(node);
+    mSize.push_back(0);
+    mOwner.push_back(owner);
+    if (owner >= static_cast<int>(mOwnerSizes.size())) {
+        mOwnerSizes.resize(owner + 1);
+    }
+    setSize(node, size);
+    return node;
+}
+
+int HexComponentIndex::find(int node)
+{
+    int root = node;
+    while (mParent[root] != root) {
+        root = mParent[root];
+    }
+    //  path compression
+    while (mParent[node] != root) {
+        int next = mParent[node];
+        mParent[node] = root;
+        node = next;
+    }
+    return root;
+}
+
+//  Update a root's size, components exist while their size is non-zero
+void HexComponentIndex::setSize(int root, int size)
+{
+    multiset<int>& sizes = mOwnerSizes[mOwner[root]];
+    int oldSize = mSize[root];
+    if (oldSize > 0) {
+        sizes.erase(sizes.find(oldSize));
+    }
+    mSize[root] = size;
+    if (size > 0) {
+        sizes.insert(size);
+    }
+    mRoots += (size > 0) - (oldSize > 0);
+}
+
+void HexComponentIndex::unite(int a, int b)
+{
+    int ra = find(a);
+    int rb = find(b);
+    if (ra == rb) {
+        return;
+    }
+    //  union by size, the smaller tree goes under the larger
+    if (mSize[ra] < mSize[rb]) {
+        std::swap(ra, rb);
+    }
+    int total = mSize[ra] + mSize[rb];
+    setSize(rb, 0);
+    mParent[rb] = ra;
+    setSize(ra, total);
+}
+
+void HexComponentIndex::sameOwnerNeighbours(int cell, int owner, int* out)
+{
+    const int* adjacent = mHexMap.neighbourIndex() + cell*6;
+    for (int i=0; i < 6; ++i) {
+        out[i] = -1;
+        if (adjacent[i] >= 0 && mHexMap.getOwner(adjacent[i]) == owner) {
+            out[i] = adjacent[i];
+        }
+    }
+}
+
+void HexComponentIndex::addCell(int cell, int owner)
+{
+    int node = newNode(owner, 1);
+    mCellNode[cell] = node;
+    ++mCells;
+
+    int neighbours[6];
+    sameOwnerNeighbours(cell, owner, neighbours);
+    for (int i=0; i < 6; ++i) {
+        if (neighbours[i] >= 0) {
+            unite(node, mCellNode[neighbours[i]]);
+        }
+    }
+}
+
+void HexComponentIndex::removeCell(int cell, int owner)
+{
+    int root = find(mCellNode[cell]);
+    mCellNode[cell] = -1;
+    --mCells;
+
+    //  Neighbours are listed in order around the cell, and consecutive ones
+    //  touch each other, so each unbroken run of same-owner neighbours is
+    //  still connected.  The region can only split between runs.
+    int neighbours[6];
+    sameOwnerNeighbours(cell, owner, neighbours);
+
+    int starts[6];
+    int runs = 0;
+    for (int i=0; i < 6; ++i) {
+        if (neighbours[i] >= 0 && neighbours[(i+5) % 6] < 0) {
+            starts[runs++] = neighbours[i];
+        }
+    }
+    if (runs == 0 && neighbours[0] >= 0) {
+        //  surrounded on all sides
+        starts[runs++] = neighbours[0];
+    }
+
+    if (runs <= 1) {
+        setSize(root, mSize[root] - 1);
+        return;
+    }
+
+    //  Search out from each run in lockstep.  Searches that meet are joined
+    //  (joined[] is a tiny union-find over searches), and a group of searches
+    //  that runs out of cells while others are still going is a part that
+    //  has split off.  Stop once one group is left, it keeps the old root.
+    if (mMark.empty()) {
+        mMark.assign(mHexMap.getIndexLimit(), 0);
+        mMarkSearch.assign(mHexMap.getIndexLimit(), 0);
+    }
+    if (++mMarkStamp == UINT_MAX) {
+        std::fill(mMark.begin(), mMark.end(), 0);
+        mMarkStamp = 1;
+    }
+
+    int    joined[6];
+    bool   finished[6];
+    size_t head[6];
+    for (int s=0; s < runs; ++s) {
+        joined[s] = s;
+        finished[s] = false;
+        head[s] = 0;
+        mQueues[s].clear();
+        mQueues[s].push_back(starts[s]);
+        mMark[starts[s]] = mMarkStamp;
+        mMarkSearch[starts[s]] = static_cast<unsigned char>(s);
+    }
+
+    int groups = runs;
+    int splitCells = 0;
+    while (groups > 1) {
+        //  advance each live search by one cell
+        for (int s=0; s < runs && groups > 1; ++s) {
+            int group = s;
+            while (joined[group] != group) group = joined[group];
+            if (finished[group] || head[s] == mQueues[s].size()) {
+                continue;
+            }
+
+            int next[6];
+            sameOwnerNeighbours(mQueues[s][head[s]++], owner, next);
+            for (int i=0; i < 6; ++i) {
+                int n = next[i];
+                if (n < 0) {
+                    continue;
+                }
+                if (mMark[n] == mMarkStamp) {
+                    int other = mMarkSearch[n];
+                    while (joined[other] != other) other = joined[other];
+                    if (other != group) {
+                        joined[other] = group;
+                        --groups;
+                    }
+                }
+                else {
+                    mMark[n] = mMarkStamp;
+                    mMarkSearch[n] = static_cast<unsigned char>(s);
+                    mQueues[s].push_back(n);
+                }
+            }
+        }
+
+        //  groups with no cells left to search have split off
+        for (int g=0; g < runs && groups > 1; ++g) {
+            if (joined[g] != g || finished[g]) {
+                continue;
+            }
+            bool exhausted = true;
+            for (int s=0; s < runs && exhausted; ++s) {
+                int group = s;
+                while (joined[group] != group) group = joined[group];
+                exhausted = (group != g || head[s] == mQueues[s].size());
+            }
+            if (!exhausted) {
+                continue;
+            }
+
+            int count = 0;
+            for (int s=0; s < runs; ++s) {
+                int group = s;
+                while (joined[group] != group) group = joined[group];
+                if (group == g) {
+                    count += static_cast<int>(mQueues[s].size());
+                }
+            }
+            int part = newNode(owner, count);
+            for (int s=0; s < runs; ++s) {
+                int group = s;
+                while (joined[group] != group) group = joined[group];
+                if (group == g) {
+                    FOREACH (int c, mQueues[s]) {
+                        mCellNode[c] = part;
+                    }
+                }
+            }
+            splitCells += count;
+            finished[g] = true;
+            --groups;
+        }
+    }
+
+    setSize(root, mSize[root] - 1 - splitCells);
+}
+
+void HexComponentIndex::rebuild()
+{
+    mCellNode.assign(mHexMap.getIndexLimit(), -1);
+    mParent.clear();
+    mSize.clear();
+    mOwner.clear();
+    mOwnerSizes.clear();
+    mRoots = 0;
+    mCells = 0;
+
+    Vec2i size = mHexMap.getSize();
+    vector<int>& queue = mQueues[0];
+
+    //  flood fill each region from its first cell, only resident chunks can
+    //  hold owned cells
+    for (int c=0; c < mHexMap.getChunkCount(); ++c) {
+        if (!mHexMap.getChunk(c)) {
+            continue;
+        }
+        HexCoord origin = mHexMap.chunkOrigin(c);
+        for (int x=origin.x; x < std::min(origin.x + HEX_CHUNK_SIZE, size.x); ++x) {
+            for (int y=origin.y; y < std::min(origin.y + HEX_CHUNK_SIZE, size.y); ++y) {
+                int cell = mHexMap.index(HexCoord(x, y));
+                int owner = mHexMap.getOwner(cell);
+                if (owner < 0 || mCellNode[cell] >= 0) {
+                    continue;
+                }
+
+                int root = newNode(owner, 0);
+                queue.clear();
+                queue.push_back(cell);
+                mCellNode[cell] = root;
+                for (size_t head=0; head < queue.size(); ++head) {
+                    int neighbours[6];
+                    sameOwnerNeighbours(queue[head], owner, neighbours);
+                    for (int i=0; i < 6; ++i) {
+                        if (neighbours[i] >= 0 && mCellNode[neighbours[i]] < 0) {
+                            mCellNode[neighbours[i]] = root;
+                            queue.push_back(neighbours[i]);
+                        }
+                    }
+                }
+                setSize(root, static_cast<int>(queue.size()));
+                mCells += static_cast<int>(queue.size());
+            }
+        }
+    }
+}
+
+int HexComponentIndex::componentId(const HexCoord& pos)
+{
+    int node = mCellNode[mHexMap.index(pos)];
+    return node < 0 ? -1 : find(node);
+}
+
+int HexComponentIndex::componentSize(const HexCoord& pos)
+{
+    int id = componentId(pos);
+    return id < 0 ? 0 : mSize[id];
+}
+
+int HexComponentIndex::largestRegion(int owner)
+{
+    if (owner < 0 || owner >= static_cast<int>(mOwnerSizes.size()) || mOwnerSizes[owner].empty()) {
+        return 0;
+    }
+    return *mOwnerSizes[owner].rbegin();
+}
+
+bool HexComponentIndex::validate()
+{
+    Vec2i size = mHexMap.getSize();
+    vector<bool> seen(mHexMap.getIndexLimit(), false);
+    vector<int> largest(mOwnerSizes.size(), 0);
+    int regions = 0;
+    HexConnectivity conn;
+
+    for (int x=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y) {
+            HexCoord pos(x, y);
+            int cell = mHexMap.index(pos);
+            int owner = mHexMap.getOwner(cell);
+            if (owner < 0) {
+                if (componentId(pos) >= 0) 
+                    return false;
+                continue;
+            }
+            if (seen[cell]) {
+                continue;
+            }
+
+            mHexMap.connected(pos, ConnectedByOwner(owner), conn);
+            int id = componentId(pos);
+            if (id < 0 || mOwner[id] != owner || mSize[id] != static_cast<int>(conn.cells.size())) {
+                return false;
+            }
+            FOREACH (HexCoord& c, conn.cells) {
+                seen[mHexMap.index(c)] = true;
+                if (componentId(c) != id) 
+                    return false;
+            }
+            if (owner >= static_cast<int>(largest.size())) {
+                return false;
+            }
+            largest[owner] = std::max(largest[owner], mSize[id]);
+            ++regions;
+        }
+    }
+
+    for (int owner=0; owner < static_cast<int>(largest.size()); ++owner) {
+        if (largestRegion(owner) != largest[owner]) 
+            return false;
+    }
+    return regions == mRoots;
+}
+
+void HexComponentIndex::ownerChanged(int index, int oldOwner, int newOwner)
+{
+    if (oldOwner >= 0) {
+        removeCell(index, oldOwner);
+    }
+    if (newOwner >= 0) {
+        addCell(index, newOwner);
+    }
+
+    //  removed and relabelled cells leave unused nodes behind
+    if (mParent.size() > 2 * static_cast<size_t>(mCells) + 4096) {
+        rebuild();
+    }
+}
+
+void HexComponentIndex::mapCleared()
+{
+    rebuild();
+}
+
+void HexComponentIndex::mapLoaded()
+{
+    rebuild();
+}
+
+//  A band of whole chunk rows labelled by one thread
+struct HexRegionLabeling::Band
+{
+    int cy0, cy1;  //  chunk rows [cy0, cy1)
+    int y0, y1;    //  cell rows [y0, y1)
+    Mode mode;
+    int roots;
+    int offset;
+    boost::unordered_map<int, HexRegionStats> stats;
+};
+
+//  Region key of a cell, cells are connected when their keys match, -1 for
+//  cells that belong to no region
+static inline int regionKey(const HexChunk* chunk, int local, HexRegionLabeling::Mode mode)
+{
+    if (mode == HexRegionLabeling::BY_OWNER) {
+        return chunk->owner[local];
+    }
+    return chunk->land[local] ? 1 : -1;
+}
+
+static int findRoot(vector<int>& parent, int cell)
+{
+    int root = cell;
+    while (parent[root] != root) {
+        root = parent[root];
+    }
+    while (parent[cell] != root) {
+        int next = parent[cell];
+        parent[cell] = root;
+        cell = next;
+    }
+    return root;
+}
+
+static void uniteCells(vector<int>& parent, int a, int b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a < b) {
+        parent[b] = a;
+    }
+    else if (b < a) {
+        parent[a] = b;
+    }
+}
+
+//  Call f(cell index, chunk, local index, position) for each map cell of the
+//  resident chunks in a band
+template <typename F>
+static void forEachBandCell(HexMap& map, int cy0, int cy1, F& f)
+{
+    Vec2i size = map.getSize();
+    Vec2i grid = map.getChunkGrid();
+    for (int cx=0; cx < grid.x; ++cx) {
+        for (int cy=cy0; cy < cy1; ++cy) {
+            int c = map.chunkAt(cx, cy);
+            const HexChunk* chunk = map.getChunk(c);
+            if (!chunk) {
+                continue;
+            }
+            HexCoord origin = map.chunkOrigin(c);
+            int w = std::min<int>(HEX_CHUNK_SIZE, size.x - origin.x);
+            int h = std::min<int>(HEX_CHUNK_SIZE, size.y - origin.y);
+            for (int x=0; x < w; ++x) {
+                for (int y=0; y < h; ++y) {
+                    int local = (x << HEX_CHUNK_SHIFT) | y;
+                    f((c << (2*HEX_CHUNK_SHIFT)) | local, chunk, local, origin + HexCoord(x, y));
+                }
+            }
+        }
+    }
+}
+
+struct InitParents
+{
+    vector<int>& parent;
+    HexRegionLabeling::Mode mode;
+    InitParents(vector<int>& p, HexRegionLabeling::Mode m) : parent(p), mode(m) { }
+    void operator()(int cell, const HexChunk* chunk, int local, const HexCoord& pos) {
+        parent[cell] = regionKey(chunk, local, mode) >= 0 ? cell : -1;
+    }
+};
+
+struct UniteInBand
+{
+    HexMap& map;
+    const int* neighbours;
+    vector<int>& parent;
+    HexRegionLabeling::Mode mode;
+    int y0, y1;
+    UniteInBand(HexMap& m, vector<int>& p, HexRegionLabeling::Mode md, int lo, int hi) 
+        : map(m), neighbours(m.neighbourIndex()), parent(p), mode(md), y0(lo), y1(hi) { }
+
+    void operator()(int cell, const HexChunk* chunk, int local, const HexCoord& pos) {
+        int key = regionKey(chunk, local, mode);
+        if (key < 0) {
+            return;
+        }
+        //  the n, ne and se neighbours cover every adjacent pair once
+        const int* adjacent = neighbours + cell*6;
+        const int* dy = HEX_NEIGHBOUR_DY[pos.x & 1];
+        for (int i=NORTH; i <= SOUTHEAST; ++i) {
+            int other = adjacent[i];
+            int y = pos.y + dy[i];
+            if (other < 0 || y < y0 || y >= y1) {
+                continue;
+            }
+            const HexChunk* otherChunk = map.getChunk(other >> (2*HEX_CHUNK_SHIFT));
+            if (otherChunk && regionKey(otherChunk, other & (HEX_CHUNK_CELLS-1), mode) == key) {
+                uniteCells(parent, cell, other);
+            }
+        }
+    }
+};
+
+struct CountRoots
+{
+    vector<int>& parent;
+    int count;
+    CountRoots(vector<int>& p) : parent(p), count(0) { }
+    void operator()(int cell, const HexChunk*, int, const HexCoord&) {
+        if (parent[cell] == cell) 
+            ++count;
+    }
+};
+
+struct NumberRoots
+{
+    vector<int>& parent;
+    vector<int>& region;
+    int next;
+    NumberRoots(vector<int>& p, vector<int>& r, int first) : parent(p), region(r), next(first) { }
+    void operator()(int cell, const HexChunk*, int, const HexCoord&) {
+        if (parent[cell] == cell) 
+            region[cell] = next++;
+    }
+};
+
+struct ResolveRegions
+{
+    vector<int>& parent;
+    vector<int>& region;
+    boost::unordered_map<int, HexRegionStats>& stats;
+    HexRegionLabeling::Mode mode;
+    ResolveRegions(vector<int>& p, vector<int>& r, boost::unordered_map<int, HexRegionStats>& s, 
+                   HexRegionLabeling::Mode m) 
+        : parent(p), region(r), stats(s), mode(m) { }
+
+    void operator()(int cell, const HexChunk* chunk, int local, const HexCoord& pos) {
+        if (parent[cell] < 0) {
+            return;
+        }
+        //  read-only walk to the root, other bands are reading the same trees
+        int root = cell;
+        while (parent[root] != root) {
+            root = parent[root];
+        }
+        //  roots were numbered by their own band and are read by every band,
+        //  so only the other cells are written
+        int id = region[root];
+        if (cell != root) {
+            region[cell] = id;
+        }
+
+        boost::unordered_map<int, HexRegionStats>::iterator it = stats.find(id);
+        if (it == stats.end()) {
+            HexRegionStats first;
+            first.owner = mode == HexRegionLabeling::BY_OWNER ? chunk->owner[local] : -1;
+            first.size  = 1;
+            first.min   = pos;
+            first.max   = pos;
+            stats[id] = first;
+        }
+        else {
+            HexRegionStats& s = it->second;
+            ++s.size;
+            s.min = HexCoord(std::min(s.min.x, pos.x), std::min(s.min.y, pos.y));
+            s.max = HexCoord(std::max(s.max.x, pos.x), std::max(s.max.y, pos.y));
+        }
+    }
+};
+
+void HexRegionLabeling::unionBand(HexMap& map, Mode mode, Band& band)
+{
+    InitParents init(mParent, mode);
+    forEachBandCell(map, band.cy0, band.cy1, init);
+    UniteInBand unite(map, mParent, mode, band.y0, band.y1);
+    forEachBandCell(map, band.cy0, band.cy1, unite);
+}
+
+void HexRegionLabeling::countRoots(HexMap& map, Band& band)
+{
+    CountRoots count(mParent);
+    forEachBandCell(map, band.cy0, band.cy1, count);
+    band.roots = count.count;
+}
+
+void HexRegionLabeling::numberRoots(HexMap& map, Band& band)
+{
+    NumberRoots number(mParent, mRegion, band.offset);
+    forEachBandCell(map, band.cy0, band.cy1, number);
+}
+
+void HexRegionLabeling::resolveBand(HexMap& map, Band& band)
+{
+    band.stats.clear();
+    ResolveRegions resolve(mParent, mRegion, band.stats, band.mode);
+    forEachBandCell(map, band.cy0, band.cy1, resolve);
+}
+
+//  Run each job on its own thread and wait for them all
+template <typename F>
+static void runBands(vector<F>& jobs)
+{
+    if (jobs.size() == 1) {
+        jobs[0]();
+        return;
+    }
+    boost::thread_group threads;
+    for (size_t i=0; i < jobs.size(); ++i) {
+        threads.create_thread(jobs[i]);
+    }
+    threads.join_all();
+}
+
+void HexRegionLabeling::label(HexMap& map, Mode mode, int threads)
+{
+    int chunkRows = map.getChunkGrid().y;
+    if (threads <= 0) {
+        threads = std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+    }
+    threads = std::max(1, std::min(threads, chunkRows));
+
+    mParent.assign(map.getIndexLimit(), -1);
+    mRegion.assign(map.getIndexLimit(), -1);
+
+    //  build the neighbour table up front, the band threads only read it
+    const int* neighbours = map.neighbourIndex();
+
+    vector<Band> bands(threads);
+    for (int b=0; b < threads; ++b) {
+        bands[b].cy0 = chunkRows * b / threads;
+        bands[b].cy1 = chunkRows * (b+1) / threads;
+        bands[b].y0  = bands[b].cy0 * HEX_CHUNK_SIZE;
+        bands[b].y1  = bands[b].cy1 * HEX_CHUNK_SIZE;
+        bands[b].mode = mode;
+    }
+
+    typedef boost::function<void ()> Job;
+    vector<Job> jobs(threads);
+
+    //  union within each band
+    for (int b=0; b < threads; ++b) {
+        jobs[b] = boost::bind(&HexRegionLabeling::unionBand, this, boost::ref(map), mode, boost::ref(bands[b]));
+    }
+    runBands(jobs);
+
+    //  join across the seams, cells on the bottom row of a band and the
+    //  neighbours below them in the band underneath
+    Vec2i size = map.getSize();
+    for (int b=1; b < threads; ++b) {
+        int y = bands[b].y0;
+        if (y >= size.y) {
+            continue;
+        }
+        for (int x=0; x < size.x; ++x) {
+            HexCoord pos(x, y);
+            int cell = map.index(pos);
+            if (mParent[cell] < 0) {
+                continue;
+            }
+            int key = mode == BY_OWNER ? map.getOwner(cell) : (map.getLand(cell) ? 1 : -1);
+            const int* adjacent = neighbours + cell*6;
+            const int* dy = HEX_NEIGHBOUR_DY[x & 1];
+            for (int i=0; i < 6; ++i) {
+                int other = adjacent[i];
+                if (other < 0 || dy[i] != -1) {
+                    continue;
+                }
+                int otherKey = mode == BY_OWNER ? map.getOwner(other) : (map.getLand(other) ? 1 : -1);
+                if (otherKey == key) {
+                    uniteCells(mParent, cell, other);
+                }
+            }
+        }
+    }
+
+    //  number the roots band by band
+    for (int b=0; b < threads; ++b) {
+        jobs[b] = boost::bind(&HexRegionLabeling::countRoots, this, boost::ref(map), boost::ref(bands[b]));
+    }
+    runBands(jobs);
+
+    int regions = 0;
+    for (int b=0; b < threads; ++b) {
+        bands[b].offset = regions;
+        regions += bands[b].roots;
+    }
+
+    for (int b=0; b < threads; ++b) {
+        jobs[b] = boost::bind(&HexRegionLabeling::numberRoots, this, boost::ref(map), boost::ref(bands[b]));
+    }
+    runBands(jobs);
+
+    //  label every cell and gather per band statistics
+    for (int b=0; b < threads; ++b) {
+        jobs[b] = boost::bind(&HexRegionLabeling::resolveBand, this, boost::ref(map), boost::ref(bands[b]));
+    }
+    runBands(jobs);
+
+    HexRegionStats empty;
+    empty.owner = -1;
+    empty.size  = 0;
+    mStats.assign(regions, empty);
+    FOREACH (Band& band, bands) {
+        for (boost::unordered_map<int, HexRegionStats>::iterator it=band.stats.begin(); 
+             it != band.stats.end(); ++it) {
+            HexRegionStats& total = mStats[it->first];
+            const HexRegionStats& part = it->second;
+            if (total.size == 0) {
+                total = part;
+                continue;
+            }
+            total.size += part.size;
+            total.min = HexCoord(std::min(total.min.x, part.min.x), std::min(total.min.y, part.min.y));
+            total.max = HexCoord(std::max(total.max.x, part.max.x), std::max(total.max.y, part.max.y));
+        }
+    }
+}
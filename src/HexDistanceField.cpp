@@ -0,0 +1,41 @@
+#include "HexDistanceField.h"
+
+using namespace ci;
+using namespace war;
+
+using std::vector;
+
+//  orders seed list positions by weight, then by position
+struct SeedWeightOrder
+{
+    const vector<HexSeed>& seeds;
+
+    SeedWeightOrder(const vector<HexSeed>& seeds) : seeds(seeds) { }
+    bool operator()(int a, int b) const {
+        return seeds[a].weight < seeds[b].weight || (seeds[a].weight == seeds[b].weight && a < b);
+    }
+};
+
+void HexDistanceField::begin(HexMap& map, const vector<HexSeed>& seeds)
+{
+    //  the marks cover every cell index, allocated on first use
+    if (mMark.size() != static_cast<size_t>(map.getIndexLimit())) {
+        mMark.assign(map.getIndexLimit(), 0);
+        mDist.resize(map.getIndexLimit());
+        mNearest.resize(map.getIndexLimit());
+        mStamp = 0;
+    }
+
+    if (mStamp == UINT_MAX) {
+        std::fill(mMark.begin(), mMark.end(), 0);
+        mStamp = 0;
+    }
+    ++mStamp;
+
+    mCells.clear();
+    mSeedOrder.resize(seeds.size());
+    for (size_t i=0; i < seeds.size(); ++i) {
+        mSeedOrder[i] = static_cast<int>(i);
+    }
+    std::sort(mSeedOrder.begin(), mSeedOrder.end(), SeedWeightOrder(seeds));
+}
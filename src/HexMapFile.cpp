@@ -0,0 +1,534 @@
+#include "HexMapFile.h"
+#include "Territory.h"
+
+#include <climits>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "boost/static_assert.hpp"
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace ci;
+using namespace war;
+
+using std::string;
+using std::vector;
+
+//  chunks are written and read as raw HexChunk images
+BOOST_STATIC_ASSERT(sizeof(HexMapFileHeader) == 128);
+BOOST_STATIC_ASSERT(sizeof(HexTerritoryRecord) == 16);
+BOOST_STATIC_ASSERT(sizeof(HexColorChunk) % 64 == 0);
+BOOST_STATIC_ASSERT(sizeof(HexPaletteChunk) % 64 == 0);
+
+static const char HEX_MAP_MAGIC[4] = { 'H', 'E', 'X', 'M' };
+
+static inline boost::uint64_t alignUp(boost::uint64_t offset, boost::uint64_t alignment)
+{
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+HexMapFile::HexMapFile()
+    : mData(0), mFileSize(0), mColorMode(HEX_FULL_COLOR), mFile(0), mMapping(0)
+{
+}
+
+HexMapFile::~HexMapFile()
+{
+    close();
+}
+
+bool HexMapFile::open(const string& path)
+{
+    close();
+
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, 
+                              FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, 0);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart < LONGLONG(sizeof(HexMapFileHeader))) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READONLY, 0, 0, 0);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+    void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+    mFile     = file;
+    mMapping  = mapping;
+    mData     = static_cast<const unsigned char*>(data);
+    mFileSize = size.QuadPart;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < off_t(sizeof(HexMapFileHeader))) {
+        ::close(fd);
+        return false;
+    }
+    void* data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //  the mapping holds its own reference to the file
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    mData     = static_cast<const unsigned char*>(data);
+    mFileSize = st.st_size;
+#endif
+
+    if (!validate()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void HexMapFile::close()
+{
+    if (!mData) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(mData);
+    CloseHandle(mMapping);
+    CloseHandle(mFile);
+#else
+    munmap(const_cast<unsigned char*>(mData), mFileSize);
+#endif
+    mData     = 0;
+    mFileSize = 0;
+    mFile     = 0;
+    mMapping  = 0;
+    mPalette  = HexPalette();
+}
+
+//  true if count items of size bytes from offset lie within a file, written
+//  so no sum can wrap however large a damaged offset is
+static bool fitsInFile(boost::uint64_t offset, boost::uint64_t count, boost::uint64_t size, 
+                       boost::uint64_t fileSize)
+{
+    return offset <= fileSize && count <= (fileSize - offset) / size;
+}
+
+bool HexMapFile::validate()
+{
+    //  header, table and territory record bounds only, chunk offsets are
+    //  checked as they are used so open() does not touch the rest of the file
+    const HexMapFileHeader& h = header();
+    if (memcmp(h.magic, HEX_MAP_MAGIC, 4) != 0 || h.version != HEX_MAP_FILE_VERSION 
+            || h.chunkSize != HEX_CHUNK_SIZE || h.fileSize != mFileSize 
+            || h.width <= 0 || h.height <= 0 
+            || h.territoryCount < 0 || h.territoryCount > HEX_MAX_TERRITORIES) {
+        return false;
+    }
+
+    //  in 64 bits, the grid of a huge damaged size overflows an int
+    boost::int64_t gridX = (boost::int64_t(h.width) + HEX_CHUNK_MASK) >> HEX_CHUNK_SHIFT;
+    boost::int64_t gridY = (boost::int64_t(h.height) + HEX_CHUNK_MASK) >> HEX_CHUNK_SHIFT;
+    if (h.chunkCount != gridX * gridY) {
+        return false;
+    }
+    mChunkGrid = Vec2i(static_cast<int>(gridX), static_cast<int>(gridY));
+
+    if ((h.chunkTableOffset & 7) != 0 
+            || !fitsInFile(h.chunkTableOffset, h.chunkCount, sizeof(boost::uint64_t), mFileSize)
+            || (h.territoryOffset & 7) != 0 
+            || !fitsInFile(h.territoryOffset, h.territoryCount, sizeof(HexTerritoryRecord), mFileSize)) {
+        return false;
+    }
+    boost::uint64_t recordsEnd = h.territoryOffset + boost::uint64_t(h.territoryCount) * sizeof(HexTerritoryRecord);
+
+    //  each territory's cells within the cell array after the records
+    boost::uint64_t cellCapacity = (mFileSize - recordsEnd) / (2 * sizeof(boost::int32_t));
+    for (int t=0; t < h.territoryCount; ++t) {
+        const HexTerritoryRecord& record = territories()[t];
+        if (boost::uint64_t(record.firstCell) + record.cellCount > cellCapacity) {
+            return false;
+        }
+    }
+
+    //  the palette is at most a few kilobytes, read it up front
+    if (h.colorMode == HEX_FULL_COLOR) {
+        mColorMode = HEX_FULL_COLOR;
+        return true;
+    }
+    if (h.colorMode != HEX_PALETTE_COLOR || h.paletteSize <= 0 || h.paletteSize > HexPalette::MAX_COLORS 
+            || (h.paletteOffset & 3) != 0 
+            || !fitsInFile(h.paletteOffset, h.paletteSize, 3 * sizeof(float), mFileSize)) {
+        return false;
+    }
+    mColorMode = HEX_PALETTE_COLOR;
+    const float* rgb = reinterpret_cast<const float*>(mData + h.paletteOffset);
+    for (int i=0; i < h.paletteSize; ++i, rgb += 3) {
+        //  entries must be distinct to keep their indices
+        if (mPalette.add(Color(rgb[0], rgb[1], rgb[2])) != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ColorA HexMapFile::getDefaultColor() const
+{
+    const float* c = header().defaultColor;
+    return ColorA(c[0], c[1], c[2], c[3]);
+}
+
+const HexChunk* HexMapFile::getChunk(int chunk) const
+{
+    boost::uint64_t offset = chunkTable()[chunk];
+    if (offset == 0 || (offset & 63) != 0 || !fitsInFile(offset, 1, hexChunkBytes(mColorMode), mFileSize)) {
+        return 0;
+    }
+    return reinterpret_cast<const HexChunk*>(mData + offset);
+}
+
+int HexMapFile::getOwner(const HexCoord& pos) const
+{
+    const HexChunk* chunk = getChunk((pos.x >> HEX_CHUNK_SHIFT) * mChunkGrid.y + (pos.y >> HEX_CHUNK_SHIFT));
+    return chunk ? chunk->owner[((pos.x & HEX_CHUNK_MASK) << HEX_CHUNK_SHIFT) | (pos.y & HEX_CHUNK_MASK)] : -1;
+}
+
+int HexMapFile::getLand(const HexCoord& pos) const
+{
+    const HexChunk* chunk = getChunk((pos.x >> HEX_CHUNK_SHIFT) * mChunkGrid.y + (pos.y >> HEX_CHUNK_SHIFT));
+    return chunk ? chunk->land[((pos.x & HEX_CHUNK_MASK) << HEX_CHUNK_SHIFT) | (pos.y & HEX_CHUNK_MASK)] : 0;
+}
+
+int HexMapFile::getTerritory(const HexCoord& pos) const
+{
+    const HexChunk* chunk = getChunk((pos.x >> HEX_CHUNK_SHIFT) * mChunkGrid.y + (pos.y >> HEX_CHUNK_SHIFT));
+    return chunk ? chunk->territory[((pos.x & HEX_CHUNK_MASK) << HEX_CHUNK_SHIFT) | (pos.y & HEX_CHUNK_MASK)] : -1;
+}
+
+ColorA HexMapFile::getColor(const HexCoord& pos) const
+{
+    const HexChunk* chunk = getChunk((pos.x >> HEX_CHUNK_SHIFT) * mChunkGrid.y + (pos.y >> HEX_CHUNK_SHIFT));
+    return chunk ? hexChunkColor(chunk, ((pos.x & HEX_CHUNK_MASK) << HEX_CHUNK_SHIFT) | (pos.y & HEX_CHUNK_MASK), 
+                                 mColorMode, mPalette) 
+                 : getDefaultColor();
+}
+
+HexCoord HexMapFile::getTerritoryOrigin(int territory) const
+{
+    const HexTerritoryRecord& record = territories()[territory];
+    return HexCoord(record.originX, record.originY);
+}
+
+HexCoord HexMapFile::getTerritoryCell(int territory, int cell) const
+{
+    const HexTerritoryRecord& record = territories()[territory];
+    assert(cell >= 0 && boost::uint32_t(cell) < record.cellCount);
+    const boost::int32_t* xy = territoryCells() + 2 * (record.firstCell + cell);
+    assert(reinterpret_cast<const unsigned char*>(xy + 2) <= mData + mFileSize);
+    return HexCoord(xy[0], xy[1]);
+}
+
+bool HexMapFile::load(HexMap& map) const
+{
+    if (map.getSize() != getSize()) {
+        return false;
+    }
+    if (map.getColorMode() != mColorMode) {
+        //  drop the old cells first so there is nothing to convert
+        for (int c=0; c < map.getChunkCount(); ++c) {
+            map.replaceChunk(c, 0);
+        }
+        map.setColorMode(mColorMode);
+    }
+    if (mColorMode == HEX_PALETTE_COLOR) {
+        map.setPalette(mPalette);
+    }
+    //  files keep chunks column-major whatever the map's cell order
+    for (int c=0; c < header().chunkCount; ++c) {
+        map.replaceChunk(map.chunkAt(c / mChunkGrid.y, c % mChunkGrid.y), getChunk(c));
+    }
+    map.endReplace();
+    return true;
+}
+
+bool HexMapFile::loadTerritories(vector<Territory>& result) const
+{
+    result.clear();
+    Vec2i size = getSize();
+    for (int t=0; t < getTerritoryCount(); ++t) {
+        Territory terr(getTerritoryOrigin(t));
+        for (int i=0; i < getTerritorySize(t); ++i) {
+            HexCoord cell = getTerritoryCell(t, i);
+            if (cell.x < 0 || cell.y < 0 || cell.x >= size.x || cell.y >= size.y) {
+                result.clear();
+                return false;
+            }
+            terr.addCell(cell);
+        }
+        result.push_back(terr);
+    }
+    return true;
+}
+
+bool HexMapFile::save(const string& path, HexMap& map, const vector<Territory>& territories)
+{
+    std::ofstream out(path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+
+    HexMapFileHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, HEX_MAP_MAGIC, 4);
+    h.version        = HEX_MAP_FILE_VERSION;
+    h.width          = map.getSize().x;
+    h.height         = map.getSize().y;
+    h.chunkSize      = HEX_CHUNK_SIZE;
+    h.chunkCount     = map.getChunkGrid().x * map.getChunkGrid().y;
+    h.residentChunks = map.getResidentChunkCount();
+    h.territoryCount = static_cast<boost::int32_t>(territories.size());
+    ColorA defaultColor = map.getDefaultColor();
+    h.defaultColor[0] = defaultColor.r;
+    h.defaultColor[1] = defaultColor.g;
+    h.defaultColor[2] = defaultColor.b;
+    h.defaultColor[3] = defaultColor.a;
+    h.colorMode = map.getColorMode();
+
+    vector<float> palette;
+    if (h.colorMode == HEX_PALETTE_COLOR) {
+        const HexPalette& entries = map.getPalette();
+        for (int i=0; i < entries.size(); ++i) {
+            palette.push_back(entries[i].r);
+            palette.push_back(entries[i].g);
+            palette.push_back(entries[i].b);
+        }
+        h.paletteSize = entries.size();
+    }
+
+    //  lay out the chunk table and palette, then the resident chunks
+    h.chunkTableOffset = sizeof(HexMapFileHeader);
+    h.paletteOffset = h.chunkTableOffset + h.chunkCount * sizeof(boost::uint64_t);
+    boost::uint64_t chunkStart = alignUp(h.paletteOffset + palette.size() * sizeof(float), 64);
+    size_t chunkBytes = hexChunkBytes(map.getColorMode());
+    vector<boost::uint64_t> table(h.chunkCount, 0);
+    boost::uint64_t offset = chunkStart;
+    //  chunks are stored column-major, see load()
+    Vec2i grid = map.getChunkGrid();
+    for (int c=0; c < h.chunkCount; ++c) {
+        if (map.getChunk(map.chunkAt(c / grid.y, c % grid.y))) {
+            table[c] = offset;
+            offset += chunkBytes;
+        }
+    }
+
+    vector<HexTerritoryRecord> records(territories.size());
+    boost::uint32_t cells = 0;
+    for (size_t t=0; t < territories.size(); ++t) {
+        const Territory& terr = territories[t];
+        records[t].originX   = terr.mOrigin.x;
+        records[t].originY   = terr.mOrigin.y;
+        records[t].firstCell = cells;
+        records[t].cellCount = static_cast<boost::uint32_t>(terr.mCells.size());
+        cells += records[t].cellCount;
+    }
+    h.territoryOffset = offset;
+    h.fileSize = offset + records.size() * sizeof(HexTerritoryRecord) + cells * 2 * sizeof(boost::int32_t);
+
+    out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+    if (!table.empty()) {
+        out.write(reinterpret_cast<const char*>(&table[0]), table.size() * sizeof(boost::uint64_t));
+    }
+    if (!palette.empty()) {
+        out.write(reinterpret_cast<const char*>(&palette[0]), palette.size() * sizeof(float));
+    }
+    static const char padding[64] = { 0 };
+    out.write(padding, chunkStart - (h.paletteOffset + palette.size() * sizeof(float)));
+
+    for (int c=0; c < h.chunkCount; ++c) {
+        if (const HexChunk* chunk = map.getChunk(map.chunkAt(c / grid.y, c % grid.y))) {
+            out.write(reinterpret_cast<const char*>(chunk), chunkBytes);
+        }
+    }
+
+    if (!records.empty()) {
+        out.write(reinterpret_cast<const char*>(&records[0]), records.size() * sizeof(HexTerritoryRecord));
+    }
+    FOREACH (const Territory& terr, territories) {
+        FOREACH (const HexCoord& cell, terr.mCells) {
+            boost::int32_t xy[2] = { cell.x, cell.y };
+            out.write(reinterpret_cast<const char*>(xy), sizeof(xy));
+        }
+    }
+
+    return out.good();
+}
+
+//  Text form:
+//
+//      hexmap 2
+//      size <width> <height>
+//      default <r> <g> <b> <a>
+//      palette <count> <r> <g> <b> ...                 palette mode only
+//      cell <x> <y> <owner> <land> <r> <g> <b> <a>     one per non-default cell
+//      territory <x> <y> <count> <x> <y> ...           origin, then cells
+//      end
+//
+//  Colors are written with 9 significant digits so they read back exactly.
+//  The territory plane is rebuilt from the territory lines, so the text
+//  form is the same for every version and older text files still read.
+
+bool HexMapFile::writeText(std::ostream& out) const
+{
+    if (!isOpen()) {
+        return false;
+    }
+    out.precision(9);
+
+    Vec2i size = getSize();
+    ColorA defaultColor = getDefaultColor();
+    out << "hexmap " << HEX_MAP_FILE_VERSION << "\n";
+    out << "size " << size.x << " " << size.y << "\n";
+    out << "default " << defaultColor.r << " " << defaultColor.g << " " 
+        << defaultColor.b << " " << defaultColor.a << "\n";
+    if (mColorMode == HEX_PALETTE_COLOR) {
+        out << "palette " << mPalette.size();
+        for (int i=0; i < mPalette.size(); ++i) {
+            out << " " << mPalette[i].r << " " << mPalette[i].g << " " << mPalette[i].b;
+        }
+        out << "\n";
+    }
+
+    for (int c=0; c < header().chunkCount; ++c) {
+        const HexChunk* chunk = getChunk(c);
+        if (!chunk) {
+            continue;
+        }
+        HexCoord origin((c / mChunkGrid.y) << HEX_CHUNK_SHIFT, (c % mChunkGrid.y) << HEX_CHUNK_SHIFT);
+        for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+            HexCoord pos = origin + HexCoord(i >> HEX_CHUNK_SHIFT, i & HEX_CHUNK_MASK);
+            if (pos.x >= size.x || pos.y >= size.y) {
+                continue;
+            }
+            ColorA color = hexChunkColor(chunk, i, mColorMode, mPalette);
+            if (chunk->owner[i] == -1 && chunk->land[i] == 0 && color == defaultColor) {
+                continue;
+            }
+            out << "cell " << pos.x << " " << pos.y << " " << chunk->owner[i] << " " << int(chunk->land[i]) 
+                << " " << color.r << " " << color.g << " " << color.b << " " << color.a << "\n";
+        }
+    }
+
+    for (int t=0; t < getTerritoryCount(); ++t) {
+        HexCoord origin = getTerritoryOrigin(t);
+        out << "territory " << origin.x << " " << origin.y << " " << getTerritorySize(t);
+        for (int i=0; i < getTerritorySize(t); ++i) {
+            HexCoord cell = getTerritoryCell(t, i);
+            out << " " << cell.x << " " << cell.y;
+        }
+        out << "\n";
+    }
+    out << "end\n";
+
+    return out.good();
+}
+
+bool HexMapFile::readText(std::istream& in, const string& path)
+{
+    string keyword;
+    int version = 0;
+    Vec2i size;
+    if (!(in >> keyword >> version) || keyword != "hexmap" || version < 1 || version > HEX_MAP_FILE_VERSION) {
+        return false;
+    }
+    if (!(in >> keyword >> size.x >> size.y) || keyword != "size" || size.x <= 0 || size.y <= 0) {
+        return false;
+    }
+
+    HexGrid grid;
+    HexMap map(grid, size.x, size.y);
+    vector<Territory> territories;
+
+    while (in >> keyword) {
+        if (keyword == "end") {
+            return save(path, map, territories);
+        }
+        else if (keyword == "default") {
+            //  the map's default color is fixed, the value is informational
+            ColorA color;
+            in >> color.r >> color.g >> color.b >> color.a;
+        }
+        else if (keyword == "palette") {
+            //  entries keep their order, so cells get their original indices
+            int count;
+            if (!(in >> count) || count <= 0 || count > HexPalette::MAX_COLORS) {
+                return false;
+            }
+            HexPalette palette;
+            for (int i=0; i < count; ++i) {
+                Color color;
+                if (!(in >> color.r >> color.g >> color.b) || palette.add(color) != i) {
+                    return false;
+                }
+            }
+            map.setColorMode(HEX_PALETTE_COLOR);
+            map.setPalette(palette);
+        }
+        else if (keyword == "cell") {
+            HexCoord pos;
+            int owner, land;
+            ColorA color;
+            //  owners are stored as shorts and land as bytes
+            if (!(in >> pos.x >> pos.y >> owner >> land >> color.r >> color.g >> color.b >> color.a) 
+                    || !map.isValid(pos) || owner < -1 || owner > SHRT_MAX || land < 0 || land > UCHAR_MAX) {
+                return false;
+            }
+            int index = map.index(pos);
+            map.setOwner(index, owner);
+            map.setLand(index, land);
+            map.setColor(index, color);
+        }
+        else if (keyword == "territory") {
+            HexCoord origin;
+            int count;
+            //  territory IDs must fit the map's territory plane
+            if (!(in >> origin.x >> origin.y >> count) || count < 0 
+                    || territories.size() >= HEX_MAX_TERRITORIES) {
+                return false;
+            }
+            Territory terr(origin);
+            int id = static_cast<int>(territories.size());
+            for (int i=0; i < count; ++i) {
+                HexCoord cell;
+                if (!(in >> cell.x >> cell.y) || !map.isValid(cell)) {
+                    return false;
+                }
+                terr.addCell(cell);
+                map.setTerritory(map.index(cell), id);
+            }
+            territories.push_back(terr);
+        }
+        else {
+            return false;
+        }
+    }
+
+    //  missing end line
+    return false;
+}
@@ -0,0 +1,542 @@
+#include "HexPath.h"
+
+#include <climits>
+#include <set>
+
+#include "boost/thread.hpp"
+
+using namespace ci;
+using namespace war;
+
+using std::vector;
+
+HexPathFinder::HexPathFinder(HexMap& map)
+    : mHexMap(map), mStamp(0), mExpanded(0)
+{
+}
+
+void HexPathFinder::begin()
+{
+    //  node arrays cover every cell index, allocated on first use
+    if (mState.empty()) {
+        int limit = mHexMap.getIndexLimit();
+        mState.assign(limit, 0);
+        mCost.resize(limit);
+        mParentDir.resize(limit);
+    }
+
+    //  two stamps per search, when they run out clear the marks and restart
+    if (mStamp == 0 || mStamp >= UINT_MAX - 2) {
+        std::fill(mState.begin(), mState.end(), 0);
+        mStamp = 1;
+    }
+    else {
+        mStamp += 2;
+    }
+
+    mOpen.clear();
+    mExpanded = 0;
+}
+
+void HexPathFinder::tracePath(int start, int goal, HexPath& path)
+{
+    const int* neighbours = mHexMap.neighbourIndex();
+    for (int cell=goal; cell != start; cell = neighbours[cell*6 + mParentDir[cell]]) {
+        path.cells.push_back(mHexMap.coord(cell));
+    }
+    path.cells.push_back(mHexMap.coord(start));
+    std::reverse(path.cells.begin(), path.cells.end());
+}
+
+HexPathBatch::HexPathBatch(HexMap& map, int threads)
+    : mHexMap(map)
+{
+    if (threads <= 0) {
+        threads = std::max(1, static_cast<int>(boost::thread::hardware_concurrency()));
+    }
+    for (int t=0; t < threads; ++t) {
+        mFinders.push_back(HexPathFinderPtr(new HexPathFinder(map)));
+    }
+}
+
+//  Run each job on its own thread and wait for them all
+void HexPathBatch::run(vector<Job>& jobs)
+{
+    if (jobs.size() == 1) {
+        jobs[0]();
+        return;
+    }
+    boost::thread_group threads;
+    for (size_t i=0; i < jobs.size(); ++i) {
+        threads.create_thread(jobs[i]);
+    }
+    threads.join_all();
+}
+
+//  runs of at least this many cell pairs get an entrance at each end
+static const int LONG_ENTRANCE = 6;
+
+HexPathGraph::HexPathGraph(HexMap& map, Passable passable, int clusterShift)
+    : mHexMap(map), mPassable(passable), 
+      mTracker(map, HexDirtyTracker::OWNER | HexDirtyTracker::LAND), mStamp(0)
+{
+    mShift = std::max<int>(clusterShift, HEX_CHUNK_SHIFT);
+    mClusterSize = 1 << mShift;
+    Vec2i size = map.getSize();
+    mClusterGrid = Vec2i((size.x + mClusterSize - 1) >> mShift, (size.y + mClusterSize - 1) >> mShift);
+
+    int cells = mClusterSize * mClusterSize;
+    mDist.resize(cells);
+    mFromDir.resize(cells);
+    mQueue.reserve(cells);
+
+    build();
+}
+
+HexCoord HexPathGraph::clusterEnd(int cluster)
+{
+    Vec2i size = mHexMap.getSize();
+    HexCoord end = clusterOrigin(cluster) + Vec2i(mClusterSize, mClusterSize);
+    return HexCoord(std::min(end.x, size.x), std::min(end.y, size.y));
+}
+
+void HexPathGraph::refreshOpen(int cluster)
+{
+    HexCoord origin = clusterOrigin(cluster);
+    HexCoord end = clusterEnd(cluster);
+    for (int x=origin.x; x < end.x; ++x) {
+        for (int y=origin.y; y < end.y; ++y) {
+            HexCoord pos(x, y);
+            if (mPassable(HexCell(mHexMap, mHexMap.index(pos)))) {
+                mOpen.set(pos);
+            }
+            else {
+                mOpen.unset(pos);
+            }
+        }
+    }
+}
+
+//  Breadth first from a cell through the passable cells of a cluster.
+//  mDist gets the steps to each cell (-1 if unreachable) and mFromDir the
+//  direction back towards from.
+void HexPathGraph::searchCluster(int cluster, const HexCoord& from)
+{
+    HexCoord origin = clusterOrigin(cluster);
+    HexCoord end = clusterEnd(cluster);
+
+    std::fill(mDist.begin(), mDist.end(), -1);
+    mQueue.clear();
+    int first = local(cluster, from);
+    mDist[first] = 0;
+    mQueue.push_back(first);
+
+    for (size_t head=0; head < mQueue.size(); ++head) {
+        int cell = mQueue[head];
+        HexCoord pos = origin + HexCoord(cell >> mShift, cell & (mClusterSize-1));
+        for (HexNeighbours it(pos); it; ++it) {
+            HexCoord next = *it;
+            if (next.x < origin.x || next.y < origin.y || next.x >= end.x || next.y >= end.y 
+                || !mOpen.get(next)) {
+                continue;
+            }
+            int index = local(cluster, next);
+            if (mDist[index] < 0) {
+                mDist[index] = mDist[cell] + 1;
+                mFromDir[index] = static_cast<unsigned char>((it.dir() + 3) % 6);
+                mQueue.push_back(index);
+            }
+        }
+    }
+}
+
+int HexPathGraph::newNode(const HexCoord& pos, int cluster)
+{
+    int id;
+    if (mFreeNodes.empty()) {
+        id = static_cast<int>(mNodes.size());
+        mNodes.push_back(Node());
+    }
+    else {
+        id = mFreeNodes.back();
+        mFreeNodes.pop_back();
+    }
+    Node& node = mNodes[id];
+    node.pos = pos;
+    node.cluster = cluster;
+    node.partner = -1;
+    node.edges.clear();
+    mClusterNodes[cluster].push_back(id);
+    return id;
+}
+
+void HexPathGraph::addEntrance(int side, const HexCoord& a, const HexCoord& b)
+{
+    int clusterA = clusterAt(a);
+    int nodeA = newNode(a, clusterA);
+    int nodeB = newNode(b, clusterAt(b));
+    mNodes[nodeA].partner = nodeB;
+    mNodes[nodeB].partner = nodeA;
+    mSideNodes[clusterA*3 + side].push_back(nodeA);
+    mSideNodes[clusterA*3 + side].push_back(nodeB);
+}
+
+//  Find the entrances between a cluster and its neighbour on one side.  The
+//  cells along the side are walked in order, so consecutive open cells and
+//  their open neighbours across the side are each connected and form a run.
+void HexPathGraph::buildSide(int cluster, int side)
+{
+    int other = sideNeighbour(cluster, side);
+    if (other < 0) {
+        return;
+    }
+
+    HexCoord origin = clusterOrigin(cluster);
+    HexCoord end = clusterEnd(cluster);
+    HexCoord cell, step;
+    int length;
+    if (side == 0) {
+        cell = HexCoord(end.x - 1, origin.y);
+        step = HexCoord(0, 1);
+        length = end.y - origin.y;
+    }
+    else if (side == 1) {
+        cell = HexCoord(origin.x, end.y - 1);
+        step = HexCoord(1, 0);
+        length = end.x - origin.x;
+    }
+    else {
+        cell = end - Vec2i(1, 1);
+        step = HexCoord(0, 0);
+        length = 1;
+    }
+
+    //  cell pairs of the current run
+    std::vector<HexCoord> runA, runB;
+    for (int i=0; i <= length; ++i, cell += step) {
+        bool open = false;
+        if (i < length && mOpen.get(cell)) {
+            for (HexNeighbours it(cell); it; ++it) {
+                if (mHexMap.isValid(*it) && clusterAt(*it) == other && mOpen.get(*it)) {
+                    runA.push_back(cell);
+                    runB.push_back(*it);
+                    open = true;
+                    break;
+                }
+            }
+        }
+        if (open || runA.empty()) {
+            continue;
+        }
+
+        int count = static_cast<int>(runA.size());
+        if (count < LONG_ENTRANCE) {
+            addEntrance(side, runA[count / 2], runB[count / 2]);
+        }
+        else {
+            addEntrance(side, runA.front(), runB.front());
+            addEntrance(side, runA.back(), runB.back());
+        }
+        runA.clear();
+        runB.clear();
+    }
+}
+
+int HexPathGraph::sideNeighbour(int cluster, int side)
+{
+    int x = cluster / mClusterGrid.y + (side != 1);
+    int y = cluster % mClusterGrid.y + (side != 0);
+    if (x >= mClusterGrid.x || y >= mClusterGrid.y) {
+        return -1;
+    }
+    return x * mClusterGrid.y + y;
+}
+
+void HexPathGraph::clearSide(int cluster, int side)
+{
+    std::vector<int>& nodes = mSideNodes[cluster*3 + side];
+    FOREACH (int id, nodes) {
+        std::vector<int>& clusterNodes = mClusterNodes[mNodes[id].cluster];
+        clusterNodes.erase(std::find(clusterNodes.begin(), clusterNodes.end(), id));
+        mNodes[id].cluster = -1;
+        mNodes[id].edges.clear();
+        mFreeNodes.push_back(id);
+    }
+    nodes.clear();
+}
+
+//  Join every pair of nodes in a cluster by their distance within it
+void HexPathGraph::linkCluster(int cluster)
+{
+    std::vector<int>& nodes = mClusterNodes[cluster];
+    FOREACH (int id, nodes) {
+        mNodes[id].edges.clear();
+    }
+    for (size_t i=0; i < nodes.size(); ++i) {
+        searchCluster(cluster, mNodes[nodes[i]].pos);
+        for (size_t j=i+1; j < nodes.size(); ++j) {
+            int dist = mDist[local(cluster, mNodes[nodes[j]].pos)];
+            if (dist >= 0) {
+                mNodes[nodes[i]].edges.push_back(Edge(nodes[j], dist));
+                mNodes[nodes[j]].edges.push_back(Edge(nodes[i], dist));
+            }
+        }
+    }
+}
+
+void HexPathGraph::build()
+{
+    int clusters = getClusterCount();
+    mOpen.reset(mHexMap.getSize());
+    mNodes.clear();
+    mFreeNodes.clear();
+    mClusterNodes.assign(clusters, std::vector<int>());
+    mSideNodes.assign(clusters * 3, std::vector<int>());
+
+    for (int c=0; c < clusters; ++c) {
+        refreshOpen(c);
+    }
+    for (int c=0; c < clusters; ++c) {
+        for (int side=0; side < 3; ++side) {
+            buildSide(c, side);
+        }
+    }
+    for (int c=0; c < clusters; ++c) {
+        linkCluster(c);
+    }
+    mTracker.clear();
+}
+
+void HexPathGraph::update()
+{
+    if (mTracker.empty()) {
+        return;
+    }
+    if (mTracker.isAllDirty()) {
+        build();
+        return;
+    }
+
+    //  clusters holding changed cells.  Chunks never straddle clusters.
+    std::set<int> changed;
+    FOREACH (int chunk, mTracker.getChunks()) {
+        changed.insert(clusterAt(mHexMap.chunkOrigin(chunk)));
+    }
+    mTracker.clear();
+
+    //  every side a changed cluster shares, as (cluster, side), and the
+    //  clusters on both sides of them
+    std::set< std::pair<int, int> > sides;
+    std::set<int> relink;
+    FOREACH (int cluster, changed) {
+        refreshOpen(cluster);
+        int cx = cluster / mClusterGrid.y;
+        int cy = cluster % mClusterGrid.y;
+        for (int side=0; side < 3; ++side) {
+            sides.insert(std::make_pair(cluster, side));
+        }
+        if (cx > 0) {
+            sides.insert(std::make_pair(cluster - mClusterGrid.y, 0));
+        }
+        if (cy > 0) {
+            sides.insert(std::make_pair(cluster - 1, 1));
+        }
+        if (cx > 0 && cy > 0) {
+            sides.insert(std::make_pair(cluster - mClusterGrid.y - 1, 2));
+        }
+    }
+
+    typedef std::pair<int, int> Side;
+    FOREACH (const Side& side, sides) {
+        clearSide(side.first, side.second);
+    }
+    FOREACH (const Side& side, sides) {
+        buildSide(side.first, side.second);
+        relink.insert(side.first);
+        int other = sideNeighbour(side.first, side.second);
+        if (other >= 0) {
+            relink.insert(other);
+        }
+    }
+    FOREACH (int cluster, relink) {
+        linkCluster(cluster);
+    }
+}
+
+bool HexPathGraph::findWaypoints(const HexCoord& start, const HexCoord& goal, HexPath& path)
+{
+    path.cells.clear();
+    path.cost = -1;
+    if (!mHexMap.isValid(start) || !mHexMap.isValid(goal)) {
+        return false;
+    }
+    update();
+    if (start == goal) {
+        path.cells.push_back(start);
+        path.cost = 0;
+        return true;
+    }
+    //  entrances only join passable cells, so a route can not leave an
+    //  impassable start
+    if (!mOpen.get(start) || !mOpen.get(goal)) {
+        return false;
+    }
+
+    //  start and goal take the two ids after the graph's nodes
+    const int startNode = static_cast<int>(mNodes.size());
+    const int goalNode  = startNode + 1;
+    const int startCluster = clusterAt(start);
+    const int goalCluster  = clusterAt(goal);
+
+    mGoalEdges.clear();
+    searchCluster(goalCluster, goal);
+    FOREACH (int id, mClusterNodes[goalCluster]) {
+        int dist = mDist[local(goalCluster, mNodes[id].pos)];
+        if (dist >= 0) {
+            mGoalEdges.push_back(Edge(id, dist));
+        }
+    }
+
+    mStartEdges.clear();
+    searchCluster(startCluster, start);
+    FOREACH (int id, mClusterNodes[startCluster]) {
+        int dist = mDist[local(startCluster, mNodes[id].pos)];
+        if (dist >= 0) {
+            mStartEdges.push_back(Edge(id, dist));
+        }
+    }
+    if (startCluster == goalCluster && mDist[local(goalCluster, goal)] >= 0) {
+        mStartEdges.push_back(Edge(goalNode, mDist[local(goalCluster, goal)]));
+    }
+
+    //  two stamps per search like HexPathFinder
+    if (mState.size() < mNodes.size() + 2) {
+        mState.assign(mNodes.size() + 2, 0);
+        mCost.resize(mNodes.size() + 2);
+        mParent.resize(mNodes.size() + 2);
+        mStamp = 0;
+    }
+    if (mStamp == 0 || mStamp >= UINT_MAX - 2) {
+        std::fill(mState.begin(), mState.end(), 0);
+        mStamp = 1;
+    }
+    else {
+        mStamp += 2;
+    }
+    const unsigned int open = mStamp;
+
+    mOpenList.clear();
+    mState[startNode]  = open;
+    mCost[startNode]   = 0;
+    mParent[startNode] = -1;
+    Open first = { hexDistance(start, goal), 0, startNode };
+    mOpenList.push_back(first);
+
+    while (!mOpenList.empty()) {
+        Open node = mOpenList.front();
+        std::pop_heap(mOpenList.begin(), mOpenList.end(), OpenOrder());
+        mOpenList.pop_back();
+
+        if (mState[node.node] != open || node.g != mCost[node.node]) {
+            continue;
+        }
+        if (node.node == goalNode) {
+            for (int id=goalNode; id >= 0; id = mParent[id]) {
+                HexCoord pos = id == goalNode ? goal : id == startNode ? start : mNodes[id].pos;
+                if (path.cells.empty() || path.cells.back() != pos) {
+                    path.cells.push_back(pos);
+                }
+            }
+            std::reverse(path.cells.begin(), path.cells.end());
+            path.cost = node.g;
+            return true;
+        }
+        mState[node.node] = open + 1;   //  closed
+
+        if (node.node == startNode) {
+            FOREACH (const Edge& edge, mStartEdges) {
+                relax(node, edge, goal);
+            }
+            continue;
+        }
+
+        //  edges within the cluster, across to the partner and to the goal
+        const Node& from = mNodes[node.node];
+        FOREACH (const Edge& edge, from.edges) {
+            relax(node, edge, goal);
+        }
+        relax(node, Edge(from.partner, 1), goal);
+        if (from.cluster == goalCluster) {
+            FOREACH (const Edge& edge, mGoalEdges) {
+                if (edge.node == node.node) {
+                    relax(node, Edge(goalNode, edge.cost), goal);
+                }
+            }
+        }
+    }
+    return false;
+}
+
+//  Push a node reached from an expanded one unless it is closed or already
+//  open at a lower cost
+void HexPathGraph::relax(const Open& from, const Edge& edge, const HexCoord& goal)
+{
+    unsigned int& state = mState[edge.node];
+    int g = from.g + edge.cost;
+    if (state == mStamp + 1 || (state == mStamp && g >= mCost[edge.node])) {
+        return;
+    }
+    state = mStamp;
+    mCost[edge.node] = g;
+    mParent[edge.node] = from.node;
+
+    //  the goal is the only node past the graph's own
+    HexCoord pos = edge.node < static_cast<int>(mNodes.size()) ? mNodes[edge.node].pos : goal;
+    //  weighting the distance left by 5/4 trades a few percent of route
+    //  length for a fraction of the expansions on long routes
+    int h = hexDistance(pos, goal);
+    Open push = { g + h + h/4, g, edge.node };
+    mOpenList.push_back(push);
+    std::push_heap(mOpenList.begin(), mOpenList.end(), OpenOrder());
+}
+
+void HexPathGraph::refine(const HexPath& waypoints, size_t segment, HexPath& path)
+{
+    HexCoord from = waypoints.cells[segment];
+    HexCoord to = waypoints.cells[segment + 1];
+    path.cells.clear();
+
+    //  waypoints are either a step apart across a cluster side or in the
+    //  same cluster
+    if (hexDistance(from, to) <= 1) {
+        path.cells.push_back(from);
+        path.cells.push_back(to);
+        path.cost = 1;
+        return;
+    }
+
+    int cluster = clusterAt(from);
+    searchCluster(cluster, from);
+    path.cost = mDist[local(cluster, to)];
+    for (HexCoord pos=to; pos != from; pos = hexNeighbour(pos, mFromDir[local(cluster, pos)])) {
+        path.cells.push_back(pos);
+    }
+    path.cells.push_back(from);
+    std::reverse(path.cells.begin(), path.cells.end());
+}
+
+bool HexPathGraph::find(const HexCoord& start, const HexCoord& goal, HexPath& path)
+{
+    path.cells.clear();
+    if (!findWaypoints(start, goal, mWaypoints)) {
+        path.cost = -1;
+        return false;
+    }
+    path.cost = mWaypoints.cost;
+    path.cells.push_back(start);
+    for (size_t i=0; i+1 < mWaypoints.cells.size(); ++i) {
+        refine(mWaypoints, i, mSegment);
+        path.cells.insert(path.cells.end(), mSegment.cells.begin() + 1, mSegment.cells.end());
+    }
+    return true;
+}
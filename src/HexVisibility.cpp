@@ -0,0 +1,187 @@
+#include "HexVisibility.h"
+
+#include <algorithm>
+
+using namespace ci;
+using namespace war;
+
+using std::vector;
+
+//  arcs closer than this are treated as touching
+static const double ARC_EPSILON = 1e-9;
+
+HexVisibility::HexVisibility(HexMap& map, Blocks blocks, int fields)
+    : mHexMap(map), mBlocks(blocks), mTracker(map, fields), mRecomputed(0)
+{
+}
+
+//  True if a single shadow covers begin to end, the shadows being merged
+bool HexVisibility::inShadow(double begin, double end)
+{
+    FOREACH (const Arc& arc, mShadows) {
+        if (arc.begin > begin + ARC_EPSILON) {
+            break;
+        }
+        if (arc.end >= end - ARC_EPSILON) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void HexVisibility::addShadow(double begin, double end)
+{
+    //  insert in order, then merge with the arcs it touches
+    vector<Arc>::iterator it = mShadows.begin();
+    while (it != mShadows.end() && it->begin < begin) {
+        ++it;
+    }
+    it = mShadows.insert(it, Arc(begin, end));
+
+    if (it != mShadows.begin() && (it-1)->end >= it->begin - ARC_EPSILON) {
+        --it;
+        it->end = std::max(it->end, (it+1)->end);
+        mShadows.erase(it+1);
+    }
+    while (it+1 != mShadows.end() && (it+1)->begin <= it->end + ARC_EPSILON) {
+        it->end = std::max(it->end, (it+1)->end);
+        mShadows.erase(it+1);
+    }
+}
+
+void HexVisibility::fieldOfView(const HexCoord& origin, int radius, vector<int>& cells)
+{
+    cells.clear();
+    if (!mHexMap.isValid(origin)) {
+        return;
+    }
+    cells.push_back(mHexMap.index(origin));
+    mShadows.clear();
+
+    Vec2i size = mHexMap.getSize();
+    for (int ring=1; ring <= radius; ++ring) {
+        //  the whole way round is dark, nothing further can be seen
+        if (mShadows.size() == 1 && mShadows[0].begin <= ARC_EPSILON
+            && mShadows[0].end >= 1.0 - ARC_EPSILON) {
+            break;
+        }
+
+        double share = 1.0 / (6 * ring);
+        mCast.clear();
+
+        for (HexRing it(origin, ring, size); it; ++it) {
+            //  the cell's share of the ring is centred on step * share,
+            //  the first cell's straddles 0
+            double centre = it.step() * share;
+            double begin = centre - share * 0.25;
+            double end   = centre + share * 0.25;
+            bool dark = begin < 0
+                ? inShadow(begin + 1.0, 1.0) && inShadow(0.0, end)
+                : inShadow(begin, end);
+
+            int index = mHexMap.index(*it);
+            if (!dark) {
+                cells.push_back(index);
+            }
+            if (mBlocks(HexCell(mHexMap, index))) {
+                mCast.push_back(Arc(centre - share * 0.5, centre + share * 0.5));
+            }
+        }
+
+        //  this ring's blockers only shade the rings beyond it
+        FOREACH (const Arc& arc, mCast) {
+            if (arc.begin < 0) {
+                addShadow(arc.begin + 1.0, 1.0);
+                addShadow(0.0, arc.end);
+            }
+            else {
+                addShadow(arc.begin, arc.end);
+            }
+        }
+    }
+}
+
+int HexVisibility::addObserver(const HexCoord& pos, int radius)
+{
+    int id;
+    if (mFreeObservers.empty()) {
+        id = static_cast<int>(mObservers.size());
+        mObservers.push_back(Observer());
+    }
+    else {
+        id = mFreeObservers.back();
+        mFreeObservers.pop_back();
+    }
+    Observer& observer = mObservers[id];
+    observer.pos = pos;
+    observer.radius = radius;
+    observer.valid = false;
+    return id;
+}
+
+void HexVisibility::moveObserver(int id, const HexCoord& pos)
+{
+    Observer& observer = mObservers[id];
+    if (observer.pos != pos) {
+        observer.pos = pos;
+        observer.valid = false;
+    }
+}
+
+void HexVisibility::removeObserver(int id)
+{
+    mObservers[id].radius = -1;
+    mObservers[id].cells.clear();
+    mFreeObservers.push_back(id);
+}
+
+void HexVisibility::update()
+{
+    if (mTracker.empty()) {
+        return;
+    }
+
+    if (mTracker.isAllDirty()) {
+        FOREACH (Observer& observer, mObservers) {
+            observer.valid = false;
+        }
+    }
+    else {
+        FOREACH (int chunk, mTracker.getChunks()) {
+            HexCoord origin = mHexMap.chunkOrigin(chunk);
+            FOREACH (Observer& observer, mObservers) {
+                if (!observer.valid) {
+                    continue;
+                }
+                //  a column within radius steps spans radius rows either
+                //  way, plus one for the odd column shift
+                int rx = observer.radius;
+                int ry = observer.radius + 1;
+                if (observer.pos.x + rx >= origin.x && observer.pos.x - rx < origin.x + HEX_CHUNK_SIZE
+                    && observer.pos.y + ry >= origin.y && observer.pos.y - ry < origin.y + HEX_CHUNK_SIZE) {
+                    observer.valid = false;
+                }
+            }
+        }
+    }
+    mTracker.clear();
+}
+
+const vector<int>& HexVisibility::visible(int id)
+{
+    update();
+    Observer& observer = mObservers[id];
+    if (!observer.valid) {
+        fieldOfView(observer.pos, observer.radius, observer.cells);
+        observer.valid = true;
+        ++mRecomputed;
+    }
+    return observer.cells;
+}
+
+void HexVisibility::markVisible(int id, HexBitboard& board)
+{
+    FOREACH (int index, visible(id)) {
+        board.set(mHexMap.coord(index));
+    }
+}
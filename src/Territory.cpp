@@ -0,0 +1,73 @@
+#include "Territory.h"
+
+#include <algorithm>
+
+using namespace ci;
+using namespace war;
+
+using std::vector;
+
+int TerritoryList::add(HexMap& map, const HexCoord& origin)
+{
+    if (!map.isValid(origin) || size() >= HEX_MAX_TERRITORIES) {
+        return -1;
+    }
+    mTerritories.push_back(Territory(origin));
+    int territory = size() - 1;
+    addCell(map, territory, origin);
+    return territory;
+}
+
+void TerritoryList::addCell(HexMap& map, int territory, const HexCoord& pos)
+{
+    int index = map.index(pos);
+    int previous = map.getTerritory(index);
+    if (previous == territory) {
+        return;
+    }
+    //  cells rarely move between territories, so this search is the only
+    //  linear step
+    if (previous >= 0) {
+        vector<HexCoord>& cells = mTerritories[previous].mCells;
+        vector<HexCoord>::iterator it = std::find(cells.begin(), cells.end(), pos);
+        if (it != cells.end()) {
+            cells.erase(it);
+        }
+    }
+    mTerritories[territory].mCells.push_back(pos);
+    map.setTerritory(index, territory);
+}
+
+void TerritoryList::setOwner(HexMap& map, int territory, int owner)
+{
+    FOREACH (const HexCoord& cell, mTerritories[territory].mCells) {
+        map.setOwner(map.index(cell), owner);
+    }
+}
+
+bool TerritoryList::assign(HexMap& map, const vector<Territory>& territories)
+{
+    clear(map);
+    if (territories.size() > HEX_MAX_TERRITORIES) {
+        return false;
+    }
+    //  cells go through addCell() so a cell listed twice ends up in one
+    //  territory, the last to list it
+    for (size_t t=0; t < territories.size(); ++t) {
+        mTerritories.push_back(Territory(territories[t].mOrigin));
+        FOREACH (const HexCoord& cell, territories[t].mCells) {
+            if (!map.isValid(cell)) {
+                clear(map);
+                return false;
+            }
+            addCell(map, static_cast<int>(t), cell);
+        }
+    }
+    return true;
+}
+
+void TerritoryList::clear(HexMap& map)
+{
+    mTerritories.clear();
+    map.clearTerritories();
+}
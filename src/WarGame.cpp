@@ -1,10 +1,12 @@
 #include "WarGame.h"
 #include "StateManager.h"
+#include "../Resources.h"
 
 #include "cinder/app/AppBasic.h"
 
 #include <string>
 #include <sstream>
+#include <algorithm>
 
 using namespace ci;
 using namespace ci::app;
@@ -71,8 +73,33 @@ void WarGame::reset()
     mPlayers.clear();
 }
 
+//  hexes in chunk meshes are six corners and four triangles
+static const int HEX_MESH_VERTICES    = 6;
+static const int HEX_MESH_INDICES     = 12;
+static const int HEX_MESH_COLOR_BYTES = HEX_MESH_VERTICES * 4;
+
+//  changed instances or cells at most this far apart are uploaded together
+static const int UPLOAD_GAP = 16;
+
+//  chunks a side in an impostor texture, and its size in texels
+static const int HEX_IMPOSTOR_SHIFT  = 3;
+static const int HEX_IMPOSTOR_CHUNKS = 1 << HEX_IMPOSTOR_SHIFT;
+static const int HEX_IMPOSTOR_TEXELS = HEX_IMPOSTOR_CHUNKS * HEX_CHUNK_SIZE;
+
+//  a text resource, such as a shader, as a string
+static string resourceText(DataSourceRef source)
+{
+    Buffer& buffer = source->getBuffer();
+    return string(static_cast<const char*>(buffer.getData()), buffer.getDataSize());
+}
+
 HexRender::HexRender(HexMap& map)
-    : mHexMap(map), mHexGrid(map.hexGrid())
+    : mHexMap(map), mHexGrid(map.hexGrid()), mInstancing(false), 
+      mOffsetAttrib(-1), mColorAttrib(-1), mInstanceMode(HEX_FULL_COLOR), mColorStride(4), 
+      mColorChanges(map, HexDirtyTracker::COLOR), mLodHexSize(3.0f), mHexPixels(0), 
+      mImpostorChanges(map, HexDirtyTracker::COLOR), mFrame(0), 
+      mProcedural(false), mProceduralReady(false), mMaxTextureSize(0), 
+      mCellChanges(map, HexDirtyTracker::COLOR | HexDirtyTracker::OWNER)
 {
 }
 
@@ -98,6 +125,68 @@ void HexRender::setup(Vec2i wsize)
 
     gl::Texture::Format format;
     format.setInternalFormat(GL_RGBA_FLOAT32_ATI);
+
+    //  Instanced drawing needs per-instance attributes as well as the draw
+    //  call, without them (or the shader) hexes are drawn one at a time
+    if (GLEE_ARB_draw_instanced && GLEE_ARB_instanced_arrays) {
+        try {
+            mInstanceShader = gl::GlslProg(loadResource(RES_INSTANCED_VERT), loadResource(RES_INSTANCED_FRAG));
+            mOffsetAttrib = mInstanceShader.getAttribLocation("instanceOffset");
+            mColorAttrib  = mInstanceShader.getAttribLocation("instanceColor");
+            mInstancing = mOffsetAttrib >= 0 && mColorAttrib >= 0;
+
+            //  offsets from a chunk's origin and the cell within the chunk,
+            //  the same for every chunk
+            mBatchCells.clear();
+            for (int x=0; x < HEX_CHUNK_SIZE; ++x) {
+                for (int y=0; y < HEX_CHUNK_SIZE; ++y) {
+                    mBatchCells.push_back(HexCoord(x, y));
+                }
+            }
+            mBatchPositions.resize(HEX_CHUNK_CELLS);
+            mHexGrid.HexToWorld(&mBatchCells[0], &mBatchPositions[0], HEX_CHUNK_CELLS);
+            vector<Vec4f> offsets(HEX_CHUNK_CELLS);
+            for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+                offsets[i] = Vec4f(mBatchPositions[i].x, mBatchPositions[i].y, 
+                                   float(mBatchCells[i].x), float(mBatchCells[i].y));
+            }
+            mInstanceOffsets = gl::Vbo(GL_ARRAY_BUFFER);
+            mInstanceOffsets.bufferData(offsets.size() * sizeof(Vec4f), &offsets[0], GL_STATIC_DRAW);
+
+            //  one texel per palette entry, looked up exactly
+            gl::Texture::Format paletteFormat;
+            paletteFormat.setMinFilter(GL_NEAREST);
+            paletteFormat.setMagFilter(GL_NEAREST);
+            mPaletteTexture = gl::Texture(HexPalette::MAX_COLORS, 1, paletteFormat);
+        }
+        catch (gl::GlslProgCompileExc&) {
+            mInstancing = false;
+        }
+    }
+
+    //  procedural drawing is only ever turned on by setProcedural().  The
+    //  fragment shader's cell lookup is kept in its own file, shared with
+    //  hextest, and compiled in front of it.
+    try {
+        string frag = resourceText(loadResource(RES_PROCEDURAL_HEX)) + resourceText(loadResource(RES_PROCEDURAL_FRAG));
+        mProceduralShader = gl::GlslProg(resourceText(loadResource(RES_PROCEDURAL_VERT)).c_str(), frag.c_str());
+        mProceduralReady = true;
+    }
+    catch (gl::GlslProgCompileExc&) {
+        mProceduralReady = false;
+    }
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &mMaxTextureSize);
+}
+
+void HexRender::setInstancing(bool enable)
+{
+    bool instancing = enable && mOffsetAttrib >= 0 && mColorAttrib >= 0;
+    if (instancing != mInstancing) {
+        //  both ways of drawing keep their own copy of the colors and take
+        //  changes from mColorChanges, so the other copy is out of date
+        mColorChanges.markAll();
+    }
+    mInstancing = instancing;
 }
 
 void HexRender::generateMeshes()
@@ -128,6 +217,20 @@ void HexRender::generateMeshes()
         indices.push_back(i);        
     }
     mHexOutlineMesh.bufferIndices( indices );
+
+    //  four triangles fanned from the first corner of each chunk mesh hex
+    vector<GLushort> chunkIndices;
+    chunkIndices.reserve(HEX_CHUNK_CELLS * HEX_MESH_INDICES);
+    for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+        GLushort base = static_cast<GLushort>(i * HEX_MESH_VERTICES);
+        for (int t=1; t <= 4; ++t) {
+            chunkIndices.push_back(base);
+            chunkIndices.push_back(base + t);
+            chunkIndices.push_back(base + t + 1);
+        }
+    }
+    mChunkIndices = gl::Vbo(GL_ELEMENT_ARRAY_BUFFER);
+    mChunkIndices.bufferData(chunkIndices.size() * sizeof(GLushort), &chunkIndices[0], GL_STATIC_DRAW);
 }
 
 Vec3f HexRender::raycastHexPlane(float u, float v)
@@ -146,8 +249,26 @@ void HexRender::update()
     //mSelectedHex = mHexGrid.WorldToHex(planeHit);
 
     gl::setMatrices(mCamera);
-    mTopRight = mHexGrid.WorldToHex(raycastHexPlane(1.0f, 1.0f));
-    mBottomLeft = mHexGrid.WorldToHex(raycastHexPlane(0, 0));
+
+    //  the frustum's corners along the rays through the corners of the
+    //  view, at the near and far clip distances
+    static const float corners[4][2] = { {0, 0}, {1, 0}, {1, 1}, {0, 1} };
+    Vec3f nearCorners[4], farCorners[4];
+    Vec3f viewDir = mCamera.getViewDirection();
+    for (int i=0; i < 4; ++i) {
+        Ray ray = mCamera.generateRay(corners[i][0], corners[i][1], mCamera.getAspectRatio());
+        float scale = 1.0f / ray.getDirection().dot(viewDir);
+        nearCorners[i] = ray.calcPosition(mCamera.getNearClip() * scale);
+        farCorners[i]  = ray.calcPosition(mCamera.getFarClip() * scale);
+    }
+    mView.setFrustum(nearCorners, farCorners);
+
+    //  at the plane's distance along the centre of the view, half the
+    //  window's height covers halfHeight units and a hex two
+    Ray centre = mCamera.generateRay(0.5f, 0.5f, mCamera.getAspectRatio());
+    float distance = -centre.getOrigin().z / centre.getDirection().z;
+    float halfHeight = distance * tan(mCamera.getFov() * float(M_PI) / 360.0f);
+    mHexPixels = distance > 0 ? mWindowSize.y / halfHeight : 0;
 
     Vec3f dir = (mCameraTo - mCamera.getEyePoint()) * 0.05f;
     Vec3f eyePoint = mCamera.getEyePoint();
@@ -155,36 +276,678 @@ void HexRender::update()
     mCamera.setEyePoint(eyePoint);
 }
 
-void HexRender::drawHexes()
+static inline unsigned char colorByte(float value)
 {
-    Vec2i mapSize = mHexMap.getSize();
+    return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
 
-    for (int ix=mBottomLeft.x-1; ix <= mTopRight.x+1; ++ix) {
-        for (int iy=mBottomLeft.y-1; iy <= mTopRight.y+1; ++iy) {
+//  Palette as RGBA bytes
+static void paletteBytes(const HexPalette& palette, vector<unsigned char>& data)
+{
+    data.resize(palette.size() * 4);
+    for (int i=0; i < palette.size(); ++i) {
+        data[i*4]   = colorByte(palette[i].r);
+        data[i*4+1] = colorByte(palette[i].g);
+        data[i*4+2] = colorByte(palette[i].b);
+        data[i*4+3] = 255;
+    }
+}
 
-            ColorA cellColor;
-            HexCoord loc(ix, iy);
-            if (!mHexMap.isValid(loc)) {
-                // cellColor = ColorA(0.2, 0.2, 0.2);
-                continue;
+//  Upload the items from begin to end, sorted positions in data of stride
+//  bytes each counted from base.  Items close together go in one call, the
+//  gaps between them being cheaper to send than another call.  Returns the
+//  bytes uploaded.
+static size_t uploadRuns(gl::Vbo& vbo, vector<int>::const_iterator begin, vector<int>::const_iterator end, 
+                         int base, const unsigned char* data, int stride)
+{
+    size_t bytes = 0;
+    while (begin != end) {
+        int first = *begin - base, last = first;
+        for (++begin; begin != end && *begin - base - last <= UPLOAD_GAP; ++begin) {
+            last = *begin - base;
+        }
+        size_t offset = first * stride, size = (last - first + 1) * stride;
+        vbo.bufferSubData(offset, size, data + offset);
+        bytes += size;
+    }
+    return bytes;
+}
+
+void HexRender::setInstanceColor(ChunkInstances& instances, int cell)
+{
+    unsigned char* out = &instances.colorData[(cell & (HEX_CHUNK_CELLS-1)) * mColorStride];
+    if (mInstanceMode == HEX_PALETTE_COLOR) {
+        out[0] = static_cast<unsigned char>(mHexMap.getColorIndex(cell));
+        out[1] = static_cast<unsigned char>(mHexMap.getAlpha(cell));
+        return;
+    }
+    ColorA color = mHexMap.getColor(cell);
+    out[0] = colorByte(color.r);
+    out[1] = colorByte(color.g);
+    out[2] = colorByte(color.b);
+    out[3] = colorByte(color.a);
+}
+
+void HexRender::updatePalette()
+{
+    //  the palette is at most 1KB as bytes, compare it rather than track
+    //  which palette object the map holds
+    const HexPalette& palette = mHexMap.getPalette();
+    vector<unsigned char> data;
+    paletteBytes(palette, data);
+    if (data == mPaletteData) {
+        return;
+    }
+
+    mPaletteData.swap(data);
+    mPaletteTexture.bind();
+    glTexSubImage2D(mPaletteTexture.getTarget(), 0, 0, 0, palette.size(), 1, 
+                    GL_RGBA, GL_UNSIGNED_BYTE, &mPaletteData[0]);
+    mPaletteTexture.unbind();
+    mStats.instanceBytes += mPaletteData.size();
+}
+
+void HexRender::updateInstances()
+{
+    Vec2i size = mHexMap.getSize();
+    if (size != mInstanceSize) {
+        //  the chunks are numbered again, and every cell is redrawn
+        mInstanceSize = size;
+        mChunkInstances.clear();
+        mChunkInstances.resize(mHexMap.getChunkCount());
+        mColorChanges.clear();
+    }
+
+    if (mHexMap.getColorMode() != mInstanceMode) {
+        mInstanceMode = mHexMap.getColorMode();
+        mColorStride  = mInstanceMode == HEX_PALETTE_COLOR ? 2 : 4;
+        mColorChanges.markAll();
+    }
+    if (mInstanceMode == HEX_PALETTE_COLOR) {
+        updatePalette();
+    }
+
+    if (mColorChanges.empty()) {
+        return;
+    }
+    if (mColorChanges.isAllDirty()) {
+        FOREACH (ChunkInstances& instances, mChunkInstances) {
+            instances.stale = true;
+        }
+        mColorChanges.clear();
+        return;
+    }
+
+    //  as in updateChunkMeshes(), sorted changes come a chunk at a time
+    mChanged.assign(mColorChanges.getCells().begin(), mColorChanges.getCells().end());
+    std::sort(mChanged.begin(), mChanged.end());
+    vector<int>::const_iterator it = mChanged.begin();
+    while (it != mChanged.end()) {
+        int chunk = *it >> (2*HEX_CHUNK_SHIFT);
+        int base  = chunk << (2*HEX_CHUNK_SHIFT);
+        vector<int>::const_iterator end = it;
+        while (end != mChanged.end() && *end - base < HEX_CHUNK_CELLS) {
+            ++end;
+        }
+
+        ChunkInstances& instances = mChunkInstances[chunk];
+        if (!mHexMap.getChunk(chunk)) {
+            instances.stale = true;
+        }
+        else if (!instances.colorData.empty() && !instances.stale) {
+            for (vector<int>::const_iterator cell=it; cell != end; ++cell) {
+                setInstanceColor(instances, *cell);
+            }
+            mStats.instanceBytes += uploadRuns(instances.colors, it, end, base, 
+                                               &instances.colorData[0], mColorStride);
+        }
+        it = end;
+    }
+    mColorChanges.clear();
+}
+
+void HexRender::drawInstanced()
+{
+    updateInstances();
+
+    bool palette = mInstanceMode == HEX_PALETTE_COLOR;
+    mInstanceShader.bind();
+    mInstanceShader.uniform("usePalette", palette ? 1 : 0);
+    if (palette) {
+        mPaletteTexture.bind();
+        mInstanceShader.uniform("palette", 0);
+    }
+
+    mInstanceOffsets.bind();
+    glEnableVertexAttribArray(mOffsetAttrib);
+    glVertexAttribPointer(mOffsetAttrib, 4, GL_FLOAT, GL_FALSE, 0, 0);
+    glVertexAttribDivisorARB(mOffsetAttrib, 1);
+    glEnableVertexAttribArray(mColorAttrib);
+    glVertexAttribDivisorARB(mColorAttrib, 1);
+    mHexMesh.enableClientStates();
+
+    Vec2i size = mHexMap.getSize();
+    FOREACH (int chunk, mVisibleChunks) {
+        if (!mHexMap.getChunk(chunk)) {
+            continue;
+        }
+
+        ChunkInstances& instances = mChunkInstances[chunk];
+        if (instances.colorData.empty() || instances.stale) {
+            if (instances.colorData.empty()) {
+                instances.colors = gl::Vbo(GL_ARRAY_BUFFER);
             }
-            else {
-                cellColor = mHexMap.at(loc).getColor();
+            instances.colorData.resize(HEX_CHUNK_CELLS * mColorStride);
+            int base = chunk << (2*HEX_CHUNK_SHIFT);
+            for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+                setInstanceColor(instances, base | i);
             }
+            instances.colors.bufferData(instances.colorData.size(), &instances.colorData[0], GL_DYNAMIC_DRAW);
+            mStats.instanceBytes += instances.colorData.size();
+            instances.stale = false;
+        }
+
+        HexCoord origin = mHexMap.chunkOrigin(chunk);
+        Vec3f world = mHexGrid.HexToWorld(origin);
+        mInstanceShader.uniform("chunkOrigin", Vec2f(world.x, world.y));
+        mInstanceShader.uniform("chunkCells", Vec2f(float(std::min<int>(HEX_CHUNK_SIZE, size.x - origin.x)), 
+                                                    float(std::min<int>(HEX_CHUNK_SIZE, size.y - origin.y))));
+
+        instances.colors.bind();
+        glVertexAttribPointer(mColorAttrib, mColorStride, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+        mHexMesh.bindAllData();
+        glDrawElementsInstancedARB(mHexMesh.getPrimitiveType(), mHexMesh.getNumIndices(), 
+                                   GL_UNSIGNED_INT, 0, HEX_CHUNK_CELLS);
+        ++mStats.drawCalls;
+        mStats.instances += HEX_CHUNK_CELLS;
+    }
+
+    gl::VboMesh::unbindBuffers();
+    mHexMesh.disableClientStates();
 
-            gl::pushMatrices();
-            gl::color(cellColor);
-            gl::translate(mHexGrid.HexToWorld(HexCoord(ix, iy)));
-            gl::draw(mHexMesh);
+    glVertexAttribDivisorARB(mOffsetAttrib, 0);
+    glVertexAttribDivisorARB(mColorAttrib, 0);
+    glDisableVertexAttribArray(mOffsetAttrib);
+    glDisableVertexAttribArray(mColorAttrib);
+    if (palette) {
+        mPaletteTexture.unbind();
+    }
+    mInstanceShader.unbind();
+}
+
+//  True if the map is in palette mode and its palette differs from seen,
+//  which is updated
+bool HexRender::paletteChanged(vector<unsigned char>& seen)
+{
+    if (mHexMap.getColorMode() != HEX_PALETTE_COLOR) {
+        return false;
+    }
+    vector<unsigned char> data;
+    paletteBytes(mHexMap.getPalette(), data);
+    if (data == seen) {
+        return false;
+    }
+    seen.swap(data);
+    return true;
+}
+
+void HexRender::setMeshColor(ChunkMesh& mesh, const HexChunk* cells, int cell)
+{
+    ColorA color = hexChunkColor(cells, cell, mHexMap.getColorMode(), mHexMap.getPalette());
+    unsigned char rgba[4] = { colorByte(color.r), colorByte(color.g), colorByte(color.b), colorByte(color.a) };
+    unsigned char* out = &mesh.colorData[cell * HEX_MESH_COLOR_BYTES];
+    for (int i=0; i < HEX_MESH_VERTICES; ++i) {
+        std::copy(rgba, rgba + 4, out + i*4);
+    }
+}
+
+void HexRender::buildChunkMesh(int chunk)
+{
+    ChunkMesh& mesh = mChunkMeshes[chunk];
+    Vec2i size = mHexMap.getSize();
+    HexCoord origin = mHexMap.chunkOrigin(chunk);
+
+    mBatchCells.clear();
+    for (int x=0; x < HEX_CHUNK_SIZE; ++x) {
+        for (int y=0; y < HEX_CHUNK_SIZE; ++y) {
+            mBatchCells.push_back(HexCoord(origin.x + x, origin.y + y));
+        }
+    }
+    mBatchPositions.resize(HEX_CHUNK_CELLS);
+    mHexGrid.HexToWorld(&mBatchCells[0], &mBatchPositions[0], HEX_CHUNK_CELLS);
+
+    //  corners as in mHexMesh, cells off the map collapse to their centre
+    Vec2f corners[HEX_MESH_VERTICES];
+    for (int i=0; i < HEX_MESH_VERTICES; ++i) {
+        corners[i] = Vec2f(float(cos(i*M_PI/3)), float(sin(i*M_PI/3)));
+    }
+    vector<Vec2f> positions(HEX_CHUNK_CELLS * HEX_MESH_VERTICES);
+    for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+        Vec2f centre(mBatchPositions[i].x, mBatchPositions[i].y);
+        bool onMap = mBatchCells[i].x < size.x && mBatchCells[i].y < size.y;
+        for (int v=0; v < HEX_MESH_VERTICES; ++v) {
+            positions[i * HEX_MESH_VERTICES + v] = onMap ? centre + corners[v] : centre;
+        }
+    }
+    mesh.positions = gl::Vbo(GL_ARRAY_BUFFER);
+    mesh.positions.bufferData(positions.size() * sizeof(Vec2f), &positions[0], GL_STATIC_DRAW);
+    mStats.instanceBytes += positions.size() * sizeof(Vec2f);
+
+    mesh.colors = gl::Vbo(GL_ARRAY_BUFFER);
+    mesh.colorData.resize(HEX_CHUNK_CELLS * HEX_MESH_COLOR_BYTES);
+    mesh.built = true;
+    mesh.stale = true;
+}
+
+void HexRender::updateChunkMeshes()
+{
+    Vec2i size = mHexMap.getSize();
+    if (size != mMeshSize) {
+        //  the chunks are numbered again, and every cell is redrawn
+        mMeshSize = size;
+        mChunkMeshes.clear();
+        mChunkMeshes.resize(mHexMap.getChunkCount());
+        mColorChanges.clear();
+        return;
+    }
 
-            // if (mHexMap.isValid(loc)) {
-            //     gl::color(ColorA(0, 0, 0, 0.6));
-            //     gl::draw(mHexOutlineMesh);
-            // }
+    //  palette mode colors are resolved here, so a new palette recolors
+    //  every mesh
+    if (paletteChanged(mMeshPalette)) {
+        mColorChanges.markAll();
+    }
+
+    if (mColorChanges.empty()) {
+        return;
+    }
+    if (mColorChanges.isAllDirty()) {
+        FOREACH (ChunkMesh& mesh, mChunkMeshes) {
+            mesh.stale = true;
+        }
+        mColorChanges.clear();
+        return;
+    }
+
+    //  cell indices are chunk by chunk, so sorted changes come a chunk at
+    //  a time.  Meshes not yet built are filled when first drawn, those of
+    //  chunks no longer resident when they are resident and drawn again.
+    mChanged.assign(mColorChanges.getCells().begin(), mColorChanges.getCells().end());
+    std::sort(mChanged.begin(), mChanged.end());
+    vector<int>::const_iterator it = mChanged.begin();
+    while (it != mChanged.end()) {
+        int chunk = *it >> (2*HEX_CHUNK_SHIFT);
+        int base  = chunk << (2*HEX_CHUNK_SHIFT);
+        vector<int>::const_iterator end = it;
+        while (end != mChanged.end() && *end - base < HEX_CHUNK_CELLS) {
+            ++end;
+        }
+
+        ChunkMesh& mesh = mChunkMeshes[chunk];
+        const HexChunk* cells = mHexMap.getChunk(chunk);
+        if (!cells) {
+            mesh.stale = true;
+        }
+        else if (mesh.built && !mesh.stale) {
+            for (vector<int>::const_iterator cell=it; cell != end; ++cell) {
+                setMeshColor(mesh, cells, *cell - base);
+            }
+            mStats.instanceBytes += uploadRuns(mesh.colors, it, end, base, 
+                                               &mesh.colorData[0], HEX_MESH_COLOR_BYTES);
+        }
+        it = end;
+    }
+    mColorChanges.clear();
+}
+
+void HexRender::drawChunkMesh(int chunk)
+{
+    ChunkMesh& mesh = mChunkMeshes[chunk];
+    if (!mesh.built) {
+        buildChunkMesh(chunk);
+    }
+    if (mesh.stale) {
+        const HexChunk* cells = mHexMap.getChunk(chunk);
+        for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+            setMeshColor(mesh, cells, i);
+        }
+        mesh.colors.bufferData(mesh.colorData.size(), &mesh.colorData[0], GL_DYNAMIC_DRAW);
+        mStats.instanceBytes += mesh.colorData.size();
+        mesh.stale = false;
+    }
+
+    mesh.positions.bind();
+    glVertexPointer(2, GL_FLOAT, 0, 0);
+    mesh.colors.bind();
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, 0);
+    glDrawElements(GL_TRIANGLES, HEX_CHUNK_CELLS * HEX_MESH_INDICES, GL_UNSIGNED_SHORT, 0);
+    ++mStats.drawCalls;
+}
+
+void HexRender::setProcedural(bool enable)
+{
+    bool procedural = enable && mProceduralReady;
+    if (procedural && !mProcedural) {
+        //  changes were not kept while off
+        mCellChanges.markAll();
+    }
+    mProcedural = procedural;
+}
+
+bool HexRender::drawsProcedural()
+{
+    Vec2i size = mHexMap.getSize();
+    return mProcedural && size.x <= mMaxTextureSize && size.y <= mMaxTextureSize;
+}
+
+void HexRender::writeCellTexels(int chunk)
+{
+    //  texel rows are map rows, owners are stored plus one as two bytes
+    Vec2i size = mHexMap.getSize();
+    HexCoord origin = mHexMap.chunkOrigin(chunk);
+    int w = std::min<int>(HEX_CHUNK_SIZE, size.x - origin.x);
+    int h = std::min<int>(HEX_CHUNK_SIZE, size.y - origin.y);
+    if (w <= 0 || h <= 0) {
+        return;
+    }
+    const HexChunk* cells = mHexMap.getChunk(chunk);
+    HexColorMode mode = mHexMap.getColorMode();
+    const HexPalette& palette = mHexMap.getPalette();
+    ColorA fill = mHexMap.getDefaultColor();
+
+    mCellTexels.resize(w * h * 4);
+    mOwnerTexels.resize(w * h * 2);
+    for (int y=0; y < h; ++y) {
+        for (int x=0; x < w; ++x) {
+            int cell = (x << HEX_CHUNK_SHIFT) | y;
+            ColorA color = cells ? hexChunkColor(cells, cell, mode, palette) : fill;
+            unsigned char* out = &mCellTexels[(y * w + x) * 4];
+            out[0] = colorByte(color.r);
+            out[1] = colorByte(color.g);
+            out[2] = colorByte(color.b);
+            out[3] = colorByte(color.a);
+
+            int owner = (cells ? cells->owner[cell] : -1) + 1;
+            mOwnerTexels[(y * w + x) * 2]     = static_cast<unsigned char>(owner & 0xff);
+            mOwnerTexels[(y * w + x) * 2 + 1] = static_cast<unsigned char>(owner >> 8);
+        }
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    mCellTexture.bind();
+    glTexSubImage2D(mCellTexture.getTarget(), 0, origin.x, origin.y, w, h, 
+                    GL_RGBA, GL_UNSIGNED_BYTE, &mCellTexels[0]);
+    mOwnerTexture.bind();
+    glTexSubImage2D(mOwnerTexture.getTarget(), 0, origin.x, origin.y, w, h, 
+                    GL_LUMINANCE_ALPHA, GL_UNSIGNED_BYTE, &mOwnerTexels[0]);
+    mOwnerTexture.unbind();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    mStats.instanceBytes += mCellTexels.size() + mOwnerTexels.size();
+}
+
+void HexRender::updateCellTextures()
+{
+    Vec2i size = mHexMap.getSize();
+    if (size != mCellTextureSize) {
+        mCellTextureSize = size;
+        gl::Texture::Format format;
+        format.setMinFilter(GL_NEAREST);
+        format.setMagFilter(GL_NEAREST);
+        format.setWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+        format.setInternalFormat(GL_RGBA);
+        mCellTexture = gl::Texture(size.x, size.y, format);
+        format.setInternalFormat(GL_LUMINANCE_ALPHA);
+        mOwnerTexture = gl::Texture(size.x, size.y, format);
+        mCellChanges.markAll();
+    }
+    if (paletteChanged(mCellPalette)) {
+        mCellChanges.markAll();
+    }
+
+    if (mCellChanges.isAllDirty()) {
+        for (int chunk=0; chunk < mHexMap.getChunkCount(); ++chunk) {
+            writeCellTexels(chunk);
+        }
+    }
+    else {
+        FOREACH (int chunk, mCellChanges.getChunks()) {
+            writeCellTexels(chunk);
+        }
+    }
+    mCellChanges.clear();
+}
+
+void HexRender::drawProcedural(const HexCoord& lo, const HexCoord& hi)
+{
+    updateCellTextures();
+
+    //  a spacing beyond the centres of the cells in view either way covers
+    //  their hexes
+    float xspacing = mHexGrid.HexToWorld(HexCoord(1, 0)).x;
+    float yspacing = mHexGrid.HexToWorld(HexCoord(0, 1)).y;
+    Rectf rect((lo.x - 1) * xspacing, (lo.y - 1) * yspacing, 
+               (hi.x + 1) * xspacing, (hi.y + 2) * yspacing);
+
+    //  line widths in pixels as world units, from the size of a hex
+    float pixel = mHexPixels > 0 ? 2.0f / mHexPixels : 0;
+    Vec2f selected = mHexMap.isValid(mSelectedHex) ? Vec2f(mSelectedHex) : Vec2f(-1, -1);
+    float pulse = 0.5f + 0.5f * float(abs(sin(2.5*app::getElapsedSeconds())));
+
+    mProceduralShader.bind();
+    mProceduralShader.uniform("cells", 0);
+    mProceduralShader.uniform("owners", 1);
+    mProceduralShader.uniform("mapSize", Vec2f(mHexMap.getSize()));
+    mProceduralShader.uniform("spacing", Vec2f(xspacing, yspacing));
+    mProceduralShader.uniform("borderWidth", pixel);
+    mProceduralShader.uniform("selected", selected);
+    mProceduralShader.uniform("selectColor", ColorA(1.0f, 1.0f, 0, pulse));
+    mProceduralShader.uniform("selectWidth", 3.0f * pixel);
+    mCellTexture.bind(0);
+    mOwnerTexture.bind(1);
+
+    gl::drawSolidRect(rect);
+    ++mStats.drawCalls;
+
+    mOwnerTexture.unbind(1);
+    mCellTexture.unbind(0);
+    mProceduralShader.unbind();
+}
+
+int HexRender::impostorTile(int chunk)
+{
+    HexCoord origin = mHexMap.chunkOrigin(chunk);
+    Vec2i grid = mHexMap.getChunkGrid();
+    int rows = (grid.y + HEX_IMPOSTOR_CHUNKS - 1) >> HEX_IMPOSTOR_SHIFT;
+    int shift = HEX_CHUNK_SHIFT + HEX_IMPOSTOR_SHIFT;
+    return (origin.x >> shift) * rows + (origin.y >> shift);
+}
+
+void HexRender::updateImpostors()
+{
+    //  changes are taken every frame, whatever is drawn, so only the
+    //  stale flags of changed chunks are touched
+    Vec2i size = mHexMap.getSize();
+    if (size != mImpostorSize) {
+        mImpostorSize = size;
+        Vec2i grid = mHexMap.getChunkGrid();
+        int tiles = ((grid.x + HEX_IMPOSTOR_CHUNKS - 1) >> HEX_IMPOSTOR_SHIFT) 
+                  * ((grid.y + HEX_IMPOSTOR_CHUNKS - 1) >> HEX_IMPOSTOR_SHIFT);
+        mImpostors.clear();
+        mImpostors.resize(tiles);
+        mImpostorStale.assign(mHexMap.getChunkCount(), 1);
+        mImpostorChanges.clear();
+        return;
+    }
+
+    if (paletteChanged(mImpostorPalette)) {
+        mImpostorChanges.markAll();
+    }
+    if (mImpostorChanges.isAllDirty()) {
+        std::fill(mImpostorStale.begin(), mImpostorStale.end(), 1);
+    }
+    else {
+        FOREACH (int chunk, mImpostorChanges.getChunks()) {
+            mImpostorStale[chunk] = 1;
+        }
+    }
+    mImpostorChanges.clear();
+}
+
+void HexRender::writeImpostor(Impostor& impostor, int chunk)
+{
+    //  texel rows are map rows, cells off the map are left clear
+    Vec2i size = mHexMap.getSize();
+    HexCoord origin = mHexMap.chunkOrigin(chunk);
+    const HexChunk* cells = mHexMap.getChunk(chunk);
+    HexColorMode mode = mHexMap.getColorMode();
+    const HexPalette& palette = mHexMap.getPalette();
+    ColorA fill = mHexMap.getDefaultColor();
+
+    mImpostorTexels.resize(HEX_CHUNK_CELLS * 4);
+    for (int y=0; y < HEX_CHUNK_SIZE; ++y) {
+        for (int x=0; x < HEX_CHUNK_SIZE; ++x) {
+            unsigned char* out = &mImpostorTexels[(y * HEX_CHUNK_SIZE + x) * 4];
+            if (origin.x + x >= size.x || origin.y + y >= size.y) {
+                std::fill(out, out + 4, 0);
+                continue;
+            }
+            ColorA color = cells ? hexChunkColor(cells, (x << HEX_CHUNK_SHIFT) | y, mode, palette) : fill;
+            out[0] = colorByte(color.r);
+            out[1] = colorByte(color.g);
+            out[2] = colorByte(color.b);
+            out[3] = colorByte(color.a);
+        }
+    }
+
+    int mask = HEX_IMPOSTOR_TEXELS - 1;
+    impostor.texture.bind();
+    glTexSubImage2D(impostor.texture.getTarget(), 0, origin.x & mask, origin.y & mask, 
+                    HEX_CHUNK_SIZE, HEX_CHUNK_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, &mImpostorTexels[0]);
+    impostor.texture.unbind();
+    mStats.instanceBytes += mImpostorTexels.size();
+}
+
+void HexRender::drawImpostors()
+{
+    //  bring the chunks in view up to date, noting their textures
+    ++mFrame;
+    mImpostorTiles.clear();
+    FOREACH (int chunk, mVisibleChunks) {
+        int tile = impostorTile(chunk);
+        Impostor& impostor = mImpostors[tile];
+        if (!impostor.built) {
+            gl::Texture::Format format;
+            format.setMinFilter(GL_LINEAR);
+            format.setMagFilter(GL_LINEAR);
+            format.setWrap(GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE);
+            impostor.texture = gl::Texture(HEX_IMPOSTOR_TEXELS, HEX_IMPOSTOR_TEXELS, format);
+            impostor.built = true;
+        }
+        if (mImpostorStale[chunk]) {
+            writeImpostor(impostor, chunk);
+            mImpostorStale[chunk] = 0;
+        }
+        if (impostor.frame != mFrame) {
+            impostor.frame = mFrame;
+            mImpostorTiles.push_back(tile);
+        }
+    }
+
+    //  a quad for the cells of each texture that are on the map.  Columns
+    //  are a column spacing wide and rows sit a quarter row up, between
+    //  the even and odd columns.
+    Vec2i size = mHexMap.getSize();
+    Vec2i grid = mHexMap.getChunkGrid();
+    int rows = (grid.y + HEX_IMPOSTOR_CHUNKS - 1) >> HEX_IMPOSTOR_SHIFT;
+    float xspacing = mHexGrid.HexToWorld(HexCoord(1, 0)).x;
+    float yspacing = mHexGrid.HexToWorld(HexCoord(0, 1)).y;
+    gl::color(ColorA(1, 1, 1, 1));
+    FOREACH (int tile, mImpostorTiles) {
+        int x0 = (tile / rows) * HEX_IMPOSTOR_TEXELS;
+        int y0 = (tile % rows) * HEX_IMPOSTOR_TEXELS;
+        int w = std::min(HEX_IMPOSTOR_TEXELS, size.x - x0);
+        int h = std::min(HEX_IMPOSTOR_TEXELS, size.y - y0);
+        Rectf rect((x0 - 0.5f) * xspacing, (y0 - 0.25f) * yspacing, 
+                   (x0 + w - 0.5f) * xspacing, (y0 + h - 0.25f) * yspacing);
+        gl::draw(mImpostors[tile].texture, Area(0, 0, w, h), rect);
+        ++mStats.drawCalls;
+    }
+    mStats.impostors = static_cast<int>(mImpostorTiles.size());
+}
+
+void HexRender::drawUnwrittenChunks()
+{
+    //  Unwritten chunks are uniform, fill each with a single rectangle
+    //  first so resident cells are drawn over the overlap at chunk edges
+    //  (column spacing, row spacing)
+    Vec2i mapSize = mHexMap.getSize();
+    Vec3f spacing = mHexGrid.HexToWorld(HexCoord(2, 1)) - mHexGrid.HexToWorld(HexCoord(0, 0));
+    spacing.x *= 0.5f;
+    gl::color(mHexMap.getDefaultColor());
+    FOREACH (int chunk, mVisibleChunks) {
+        if (mHexMap.getChunk(chunk)) {
+            continue;
+        }
+        HexCoord lo = mHexMap.chunkOrigin(chunk);
+        HexCoord hi(std::min(lo.x + HEX_CHUNK_SIZE, mapSize.x) - 1, 
+                    std::min(lo.y + HEX_CHUNK_SIZE, mapSize.y) - 1);
+        //  odd columns sit half a row higher than even ones
+        Vec3f wlo = mHexGrid.HexToWorld(lo);
+        Vec3f whi = mHexGrid.HexToWorld(HexCoord(hi.x & ~1, hi.y));
+        gl::drawSolidRect(Rectf(wlo.x - spacing.x * 0.5f, wlo.y - spacing.y * 0.5f, 
+                                whi.x + spacing.x * 1.5f, whi.y + spacing.y));
+        ++mStats.drawCalls;
+    }
+}
+
+void HexRender::drawHexes()
+{
+    mStats = HexRenderStats();
+    updateImpostors();
+
+    //  Cells of the map that can be in view, hexes reach a unit from
+    //  their centres
+    HexCoord lo, hi;
+    if (!mView.cellBounds(mHexMap, lo, hi)) {
+        return;
+    }
+
+    //  The same single quad however far out
+    if (drawsProcedural()) {
+        drawProcedural(lo, hi);
+        return;
+    }
+    mCellChanges.clear();
+
+    //  Far enough out for a chunk at a time
+    if (mHexPixels < mLodHexSize) {
+        mView.findChunks(mHexMap, mVisibleChunks);
+        mStats.chunks = static_cast<int>(mVisibleChunks.size());
+        drawImpostors();
+        return;
+    }
+
+    mView.findChunks(mHexMap, mVisibleChunks);
+    mStats.chunks = static_cast<int>(mVisibleChunks.size());
+    drawUnwrittenChunks();
+
+    if (mInstancing) {
+        drawInstanced();
+        return;
+    }
 
-            gl::popMatrices();
+    //  Resident chunks, each a single draw of its baked mesh
+    updateChunkMeshes();
+    mChunkIndices.bind();
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    FOREACH (int chunk, mVisibleChunks) {
+        if (mHexMap.getChunk(chunk)) {
+            drawChunkMesh(chunk);
         }
     }
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    gl::VboMesh::unbindBuffers();
 }
 
 void HexRender::setCameraTo(Vec3f& cameraTo)
@@ -199,13 +962,14 @@ Camera& HexRender::getCamera()
 
 void HexRender::drawSelection()
 {
-    //  Draw highlighted hex
-    if (mHexMap.isValid(mSelectedHex)) {
+    //  Draw highlighted hex, the procedural shader draws its own
+    if (mHexMap.isValid(mSelectedHex) && !drawsProcedural()) {
         glLineWidth(3.0f);
         gl::pushMatrices();
         gl::color(ColorA(1.0f, 1.0f, 0, 0.5f + 0.5f * float(abs(sin(2.5*app::getElapsedSeconds())))));
         gl::translate(mHexGrid.HexToWorld(mSelectedHex));
         gl::draw(mHexOutlineMesh);
+        ++mStats.drawCalls;
         gl::popMatrices();
         glLineWidth(1.0f);
     }
@@ -251,8 +1015,8 @@ void Mouse::mouseWheel(ci::app::MouseEvent event)
 {
 }
 
-Shared::Shared(HexMap& hexmap, HexGrid& hexgrid, HexRender& hexrender, GuiController& gui, GuiFactory& factory, Mouse& mouse, WarGame& wargame, GuiConsolePtr console)
-    : hexMap(hexmap), hexGrid(hexgrid), hexRender(hexrender), gui(gui), guiFactory(factory), mouse(mouse), warGame(wargame), console(console)
+Shared::Shared(HexMap& hexmap, HexGrid& hexgrid, HexRender& hexrender, HexComponentIndex& components, GuiController& gui, GuiFactory& factory, Mouse& mouse, WarGame& wargame, GuiConsolePtr console)
+    : hexMap(hexmap), hexGrid(hexgrid), hexRender(hexrender), components(components), gui(gui), guiFactory(factory), mouse(mouse), warGame(wargame), console(console)
 {
 }
 
@@ -0,0 +1,714 @@
+//  Timings for HexMap storage and the searches over it
+//
+//      hexbench                run every benchmark
+//      hexbench <name> ...     run the named benchmarks
+//
+//  Each timing is the best of a few runs of wall clock time.  Build it
+//  optimised, debug builds mostly time the checked iterators.
+
+#include "Hex.h"
+#include "HexBitboard.h"
+#include "HexDistanceField.h"
+#include "HexMapFile.h"
+#include "Territory.h"
+
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/unordered_set.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace ci;
+using namespace war;
+
+using std::string;
+using std::vector;
+
+//  Best time in milliseconds of runs calls of f()
+template <typename F>
+static double bestOf(int runs, F& f)
+{
+    double best = 1e30;
+    for (int i=0; i < runs; ++i) {
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+        f();
+        boost::posix_time::time_duration took = boost::posix_time::microsec_clock::universal_time() - start;
+        best = std::min(best, took.total_microseconds() / 1000.0);
+    }
+    return best;
+}
+
+static void report(const char* bench, const Vec2i& size, const char* what, double ms, double items)
+{
+    printf("%-10s %5dx%-5d %-24s %10.3f ms %10.1f M/s\n", bench, size.x, size.y, what, ms,
+           ms > 0 ? items / ms / 1000.0 : 0.0);
+}
+
+//  results summed by the benchmarks so the work is not optimised away
+static volatile long gSink = 0;
+
+//  ---------------------------------------------------------------------------
+//  sweep: full map passes, the cell layout before contiguous planes against
+//  HexMap's chunk planes
+
+//  A cell as HexMap kept them, one heap array per column
+struct LegacyCell
+{
+    HexCoord   mPos;
+    ColorA     mColor;
+    int        mLand;
+    int        mOwner;
+};
+
+struct LegacyMap
+{
+    Vec2i        mSize;
+    LegacyCell** mCells;
+
+    LegacyMap(int width, int height) : mSize(width, height) {
+        mCells = new LegacyCell*[width];
+        for (int x=0; x < width; ++x) {
+            mCells[x] = new LegacyCell[height];
+        }
+    }
+    ~LegacyMap() {
+        for (int x=0; x < mSize.x; ++x) {
+            delete [] mCells[x];
+        }
+        delete [] mCells;
+    }
+};
+
+struct LegacyCount
+{
+    LegacyMap& map;
+    LegacyCount(LegacyMap& map) : map(map) { }
+    void operator()() {
+        long count = 0;
+        for (int x=0; x < map.mSize.x; ++x) {
+            for (int y=0; y < map.mSize.y; ++y) {
+                const LegacyCell& cell = map.mCells[x][y];
+                count += cell.mLand && cell.mOwner >= 0;
+            }
+        }
+        gSink += count;
+    }
+};
+
+struct LegacyClear
+{
+    LegacyMap& map;
+    LegacyClear(LegacyMap& map) : map(map) { }
+    void operator()() {
+        for (int x=0; x < map.mSize.x; ++x) {
+            for (int y=0; y < map.mSize.y; ++y) {
+                LegacyCell& cell = map.mCells[x][y];
+                cell.mPos = HexCoord(x, y);
+                cell.mColor = ColorA(0.15f, 0.15f, 0.15f, 1.0f);
+                cell.mOwner = -1;
+            }
+        }
+    }
+};
+
+//  through at(), as callers outside the map do
+struct CellCount
+{
+    HexMap& map;
+    CellCount(HexMap& map) : map(map) { }
+    void operator()() {
+        long count = 0;
+        Vec2i size = map.getSize();
+        for (int x=0; x < size.x; ++x) {
+            for (int y=0; y < size.y; ++y) {
+                HexCell cell = map.at(HexCoord(x, y));
+                count += cell.getLand() && cell.getOwner() >= 0;
+            }
+        }
+        gSink += count;
+    }
+};
+
+//  straight down the owner and land planes of each resident chunk
+struct PlaneCount
+{
+    HexMap& map;
+    PlaneCount(HexMap& map) : map(map) { }
+    void operator()() {
+        long count = 0;
+        for (int c=0; c < map.getChunkCount(); ++c) {
+            const HexChunk* chunk = map.getChunk(c);
+            if (!chunk) {
+                continue;
+            }
+            for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+                count += chunk->land[i] && chunk->owner[i] >= 0;
+            }
+        }
+        gSink += count;
+    }
+};
+
+struct MapClear
+{
+    HexMap& map;
+    MapClear(HexMap& map) : map(map) { }
+    void operator()() { map.clear(); }
+};
+
+//  every cell land and owned, so every chunk is resident
+static void fillMap(HexMap& map)
+{
+    Vec2i size = map.getSize();
+    for (int x=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y) {
+            int index = map.index(HexCoord(x, y));
+            map.setLand(index, 1);
+            map.setOwner(index, (x ^ y) & 3);
+        }
+    }
+}
+
+static void benchSweep()
+{
+    static const int sizes[][2] = { {64, 48}, {1024, 1024}, {4096, 4096} };
+    for (int s=0; s < 3; ++s) {
+        Vec2i size(sizes[s][0], sizes[s][1]);
+        double cells = double(size.x) * size.y;
+        int runs = cells > 1e6 ? 3 : 20;
+
+        {
+            LegacyMap legacy(size.x, size.y);
+            for (int x=0; x < size.x; ++x) {
+                for (int y=0; y < size.y; ++y) {
+                    legacy.mCells[x][y].mLand  = 1;
+                    legacy.mCells[x][y].mOwner = (x ^ y) & 3;
+                }
+            }
+            LegacyCount count(legacy);
+            LegacyClear clear(legacy);
+            report("sweep", size, "legacy count", bestOf(runs, count), cells);
+            report("sweep", size, "legacy clear", bestOf(runs, clear), cells);
+        }
+
+        HexGrid grid;
+        HexMap map(grid, size.x, size.y);
+        fillMap(map);
+        CellCount cellCount(map);
+        PlaneCount planeCount(map);
+        MapClear clear(map);
+        report("sweep", size, "HexMap at() count", bestOf(runs, cellCount), cells);
+        report("sweep", size, "HexMap plane count", bestOf(runs, planeCount), cells);
+        report("sweep", size, "HexMap clear", bestOf(runs, clear), cells);
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  bitboard: neighbourhood operations over map sized boards
+
+struct Dilate
+{
+    const HexBitboard& board;
+    HexBitboard&       out;
+    Dilate(const HexBitboard& board, HexBitboard& out) : board(board), out(out) { }
+    void operator()() { board.dilate(out); }
+};
+
+struct Erode
+{
+    const HexBitboard& board;
+    HexBitboard&       out;
+    Erode(const HexBitboard& board, HexBitboard& out) : board(board), out(out) { }
+    void operator()() { board.erode(out); }
+};
+
+//  erode as it was, through an inverted copy of the board
+struct CopyErode
+{
+    const HexBitboard& board;
+    HexBitboard&       out;
+    CopyErode(const HexBitboard& board, HexBitboard& out) : board(board), out(out) { }
+    void operator()() {
+        HexBitboard inverse(board);
+        inverse.invert();
+        inverse.dilate(out);
+        out.invert();
+    }
+};
+
+struct Border
+{
+    const HexBitboard& board;
+    HexBitboard&       out;
+    Border(const HexBitboard& board, HexBitboard& out) : board(board), out(out) { }
+    void operator()() { board.border(out); }
+};
+
+static void benchBitboard()
+{
+    static const int sizes[][2] = { {64, 48}, {1024, 1024}, {4096, 4096} };
+    for (int s=0; s < 3; ++s) {
+        Vec2i size(sizes[s][0], sizes[s][1]);
+        double cells = double(size.x) * size.y;
+        int runs = cells > 1e6 ? 5 : 50;
+
+        //  blobs of a few cells across, so erode leaves something
+        HexBitboard board(size);
+        for (int x=0; x < size.x; ++x) {
+            for (int y=0; y < size.y; ++y) {
+                if (((x / 5) ^ (y / 7)) & 1) {
+                    board.set(HexCoord(x, y));
+                }
+            }
+        }
+        HexBitboard out(size);
+
+        Dilate dilate(board, out);
+        Erode erode(board, out);
+        CopyErode copyErode(board, out);
+        Border border(board, out);
+        report("bitboard", size, "dilate", bestOf(runs, dilate), cells);
+        report("bitboard", size, "erode", bestOf(runs, erode), cells);
+        report("bitboard", size, "erode with copy", bestOf(runs, copyErode), cells);
+        report("bitboard", size, "border", bestOf(runs, border), cells);
+        gSink += out.count();
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  bfs: HexMap::connected() over one region filling most of the map, against
+//  the hash set search it replaced
+
+//  connected() as it was
+struct LegacyConnected
+{
+    HexMap&         map;
+    HexGrid&        grid;
+    HexConnectivity conn;
+    LegacyConnected(HexMap& map, HexGrid& grid) : map(map), grid(grid) { }
+    void operator()() {
+        ConnectedByOwner predicate(0);
+        boost::unordered_set<HexCoord> search;
+        boost::unordered_set<HexCoord> checked;
+        boost::unordered_set<HexCoord> matched;
+        boost::unordered_set<HexCoord> borders;
+
+        search.insert(HexCoord(0, 0));
+        while (!search.empty()) {
+            HexCoord check = *search.begin();
+            vector<HexCoord> adjacent = grid.adjacent(check).toVector();
+            if (predicate(map.at(check))) {
+                matched.insert(check);
+                FOREACH (HexCoord coord, adjacent) {
+                    if (map.isValid(coord) && checked.find(coord) == checked.end()) {
+                        search.insert(coord);
+                    }
+                }
+            }
+            else {
+                FOREACH (HexCoord coord, adjacent) {
+                    if (map.isValid(coord) && predicate(map.at(coord))) {
+                        borders.insert(coord);
+                    }
+                }
+            }
+            checked.insert(check);
+            search.erase(check);
+        }
+        conn.cells       = vector<HexCoord>(matched.begin(), matched.end());
+        conn.borderCells = vector<HexCoord>(borders.begin(), borders.end());
+        gSink += static_cast<long>(conn.cells.size());
+    }
+};
+
+struct Connected
+{
+    HexMap&         map;
+    HexConnectivity conn;
+    Connected(HexMap& map) : map(map) { }
+    void operator()() {
+        map.connected(HexCoord(0, 0), ConnectedByOwner(0), conn);
+        gSink += static_cast<long>(conn.cells.size());
+    }
+};
+
+static void benchBfs()
+{
+    static const int sizes[][2] = { {64, 48}, {256, 256}, {1024, 1024}, {2048, 2048}, {4096, 4096} };
+    for (int s=0; s < 5; ++s) {
+        Vec2i size(sizes[s][0], sizes[s][1]);
+        double cells = double(size.x) * size.y;
+        int runs = cells > 1e6 ? 3 : 20;
+
+        //  owner 0 everywhere but walls of owner 1 every eight columns, each
+        //  with a gap every eight rows to keep one region
+        HexGrid grid;
+        HexMap map(grid, size.x, size.y);
+        for (int x=0; x < size.x; ++x) {
+            for (int y=0; y < size.y; ++y) {
+                int index = map.index(HexCoord(x, y));
+                map.setLand(index, 1);
+                map.setOwner(index, (x & 7) == 7 && (y & 7) ? 1 : 0);
+            }
+        }
+
+        //  the hash sets take seconds a pass past a million cells
+        if (cells <= 1024 * 1024) {
+            LegacyConnected legacy(map, grid);
+            report("bfs", size, "hash set connected()", bestOf(cells > 1e5 ? 1 : runs, legacy), cells);
+        }
+        Connected connected(map);
+        report("bfs", size, "connected()", bestOf(runs, connected), cells);
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  order: the same searches and sweeps over maps in each HexCellOrder.
+//  There is no portable way to read the cache miss counters, so the share
+//  of neighbours whose cell indices fall in the same block is given
+//  alongside the times as the locality each order offers.  For a per-cell
+//  int array such as the search's visited stamps, 1K cells are a 4KB page
+//  and 64K cells about a second level cache.
+
+struct Edges
+{
+    HexMap&                 map;
+    const HexConnectivity&  conn;
+    vector<HexEdgeLoop>     loops;
+    Edges(HexMap& map, const HexConnectivity& conn) : map(map), conn(conn) { }
+    void operator()() {
+        map.extractEdges(conn, loops);
+        gSink += static_cast<long>(loops.size());
+    }
+};
+
+static double neighboursInBlock(HexMap& map, int blockShift)
+{
+    const int* neighbours = map.neighbourIndex();
+    Vec2i size = map.getSize();
+    double pairs = 0, near = 0;
+    for (int x=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y) {
+            int cell = map.index(HexCoord(x, y));
+            for (int i=0; i < 6; ++i) {
+                int other = neighbours[cell*6 + i];
+                if (other >= 0) {
+                    pairs += 1;
+                    near  += (other >> blockShift) == (cell >> blockShift);
+                }
+            }
+        }
+    }
+    return pairs > 0 ? near / pairs : 0;
+}
+
+static void benchOrder()
+{
+    static const int sizes[][2] = { {1024, 1024}, {4000, 4000} };
+    static const char* names[] = { "columns", "tiled" };
+    for (int s=0; s < 2; ++s) {
+        for (int order=HEX_ORDER_COLUMNS; order <= HEX_ORDER_TILED; ++order) {
+            Vec2i size(sizes[s][0], sizes[s][1]);
+            double cells = double(size.x) * size.y;
+            int runs = cells > 1e7 ? 3 : 10;
+            char what[64];
+
+            //  the bfs map: one region broken up by walls with gaps
+            HexGrid grid;
+            HexMap map(grid, size.x, size.y, static_cast<HexCellOrder>(order));
+            for (int x=0; x < size.x; ++x) {
+                for (int y=0; y < size.y; ++y) {
+                    int index = map.index(HexCoord(x, y));
+                    map.setLand(index, 1);
+                    map.setOwner(index, (x & 7) == 7 && (y & 7) ? 1 : 0);
+                }
+            }
+
+            printf("%-10s %5dx%-5d %-24s %9.1f %% in 1K, %.1f %% in 64K\n", "order", size.x, size.y, 
+                   (string(names[order]) + " neighbours").c_str(), 
+                   100.0 * neighboursInBlock(map, 10), 100.0 * neighboursInBlock(map, 16));
+
+            Connected connected(map);
+            sprintf(what, "%s connected()", names[order]);
+            report("order", size, what, bestOf(runs, connected), cells);
+
+            Edges edges(map, connected.conn);
+            sprintf(what, "%s extractEdges()", names[order]);
+            report("order", size, what, bestOf(runs, edges), cells);
+
+            CellCount cellCount(map);
+            sprintf(what, "%s at() count", names[order]);
+            report("order", size, what, bestOf(runs, cellCount), cells);
+
+            PlaneCount planeCount(map);
+            sprintf(what, "%s plane count", names[order]);
+            report("order", size, what, bestOf(runs, planeCount), cells);
+        }
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  load: binary map files saved, opened, read in place and copied into a
+//  map, up to 100M cells.  The file is read back straight after it is
+//  written, so these are warm page cache times.
+
+static const char* BENCH_MAP_PATH = "hexbench.hexmap";
+
+struct SaveFile
+{
+    HexMap& map;
+    SaveFile(HexMap& map) : map(map) { }
+    void operator()() { gSink += HexMapFile::save(BENCH_MAP_PATH, map, vector<Territory>()); }
+};
+
+struct OpenFile
+{
+    void operator()() {
+        HexMapFile file;
+        gSink += file.open(BENCH_MAP_PATH);
+    }
+};
+
+struct LoadFile
+{
+    HexMapFile& file;
+    HexMap&     map;
+    LoadFile(HexMapFile& file, HexMap& map) : file(file), map(map) { }
+    void operator()() { gSink += file.load(map); }
+};
+
+//  owned land counted in place, a chunk at a time
+struct FileCount
+{
+    HexMapFile& file;
+    int         chunks;
+    FileCount(HexMapFile& file, int chunks) : file(file), chunks(chunks) { }
+    void operator()() {
+        long count = 0;
+        for (int c=0; c < chunks; ++c) {
+            const HexChunk* chunk = file.getChunk(c);
+            if (!chunk) {
+                continue;
+            }
+            for (int i=0; i < HEX_CHUNK_CELLS; ++i) {
+                count += chunk->land[i] && chunk->owner[i] >= 0;
+            }
+        }
+        gSink += count;
+    }
+};
+
+static void benchLoad()
+{
+    static const int sizes[][2] = { {1024, 1024}, {4096, 4096}, {10000, 10000} };
+    for (int s=0; s < 3; ++s) {
+        Vec2i size(sizes[s][0], sizes[s][1]);
+        double cells = double(size.x) * size.y;
+        int runs = cells > 2e7 ? 1 : 3;
+
+        //  palette mode as the editor uses, every chunk resident
+        HexGrid grid;
+        {
+            HexMap map(grid, size.x, size.y);
+            map.setColorMode(HEX_PALETTE_COLOR);
+            fillMap(map);
+            SaveFile save(map);
+            report("load", size, "save", bestOf(1, save), cells);
+        }
+
+        OpenFile open;
+        report("load", size, "open", bestOf(runs, open), cells);
+
+        HexMapFile file;
+        if (!file.open(BENCH_MAP_PATH)) {
+            fprintf(stderr, "hexbench: unable to open %s\n", BENCH_MAP_PATH);
+            return;
+        }
+        Vec2i chunks = Vec2i((size.x + HEX_CHUNK_MASK) >> HEX_CHUNK_SHIFT, 
+                             (size.y + HEX_CHUNK_MASK) >> HEX_CHUNK_SHIFT);
+        FileCount count(file, chunks.x * chunks.y);
+        report("load", size, "count in place", bestOf(runs, count), cells);
+
+        HexMap map(grid, size.x, size.y);
+        LoadFile load(file, map);
+        report("load", size, "load into HexMap", bestOf(runs, load), cells);
+    }
+    remove(BENCH_MAP_PATH);
+}
+
+//  ---------------------------------------------------------------------------
+//  territory: territories of 4K to 64K cells grown from evenly spaced
+//  cities as the editor grows them, through TerritoryList and its map
+//  territory plane, against the linear search of Territory's cell list the
+//  plane replaced.
+
+//  Grow territories over the whole map, each cell to its nearest city
+struct GrowTerritories
+{
+    HexMap&                 map;
+    const vector<HexSeed>&  seeds;
+    HexDistanceField        field;
+    TerritoryList           territories;
+    GrowTerritories(HexMap& map, const vector<HexSeed>& seeds) : map(map), seeds(seeds) { }
+    void operator()() {
+        territories.clear(map);
+        FOREACH (const HexSeed& seed, seeds) {
+            territories.add(map, seed.pos);
+        }
+        field.compute(map, seeds, PassableAny());
+        FOREACH (int index, field.getCells()) {
+            territories.addCell(map, field.nearest(index), map.coord(index));
+        }
+        gSink += static_cast<long>(territories[territories.size() - 1].mCells.size());
+    }
+};
+
+//  The same with membership by searching each territory's cell list
+struct LegacyGrowTerritories
+{
+    HexMap&                 map;
+    const vector<HexSeed>&  seeds;
+    HexDistanceField        field;
+    vector<Territory>       territories;
+    LegacyGrowTerritories(HexMap& map, const vector<HexSeed>& seeds) : map(map), seeds(seeds) { }
+    void operator()() {
+        territories.clear();
+        FOREACH (const HexSeed& seed, seeds) {
+            territories.push_back(Territory(seed.pos));
+        }
+        field.compute(map, seeds, PassableAny());
+        FOREACH (int index, field.getCells()) {
+            HexCoord pos = map.coord(index);
+            vector<HexCoord>& cells = territories[field.nearest(index)].mCells;
+            if (std::find(cells.begin(), cells.end(), pos) == cells.end()) {
+                cells.push_back(pos);
+            }
+        }
+        gSink += static_cast<long>(territories.back().mCells.size());
+    }
+};
+
+//  Territory of every cell
+struct TerritoryLookup
+{
+    HexMap&         map;
+    TerritoryList&  territories;
+    TerritoryLookup(HexMap& map, TerritoryList& territories) : map(map), territories(territories) { }
+    void operator()() {
+        Vec2i size = map.getSize();
+        long sum = 0;
+        for (int x=0; x < size.x; ++x) {
+            for (int y=0; y < size.y; ++y) {
+                sum += territories.territoryAt(map, HexCoord(x, y));
+            }
+        }
+        gSink += sum;
+    }
+};
+
+//  Hand every territory to a new owner, alternating between two so each
+//  pass writes every cell
+struct ReassignTerritories
+{
+    HexMap&         map;
+    TerritoryList&  territories;
+    int             pass;
+    ReassignTerritories(HexMap& map, TerritoryList& territories) 
+        : map(map), territories(territories), pass(0) { }
+    void operator()() {
+        ++pass;
+        for (int t=0; t < territories.size(); ++t) {
+            territories.setOwner(map, t, t * 2 + (pass & 1));
+        }
+    }
+};
+
+static void benchTerritory()
+{
+    //  map sizes and cities a side
+    static const int sizes[][3] = { {256, 256, 2}, {1024, 1024, 8}, {4096, 4096, 16} };
+    for (int s=0; s < 3; ++s) {
+        Vec2i size(sizes[s][0], sizes[s][1]);
+        int side = sizes[s][2];
+        double cells = double(size.x) * size.y;
+        int runs = cells > 1e7 ? 3 : 10;
+        char what[64];
+
+        HexGrid grid;
+        HexMap map(grid, size.x, size.y);
+        vector<HexSeed> seeds;
+        for (int i=0; i < side; ++i) {
+            for (int j=0; j < side; ++j) {
+                seeds.push_back(HexSeed(HexCoord((2*i + 1) * size.x / (2*side), (2*j + 1) * size.y / (2*side))));
+            }
+        }
+        int perTerritory = static_cast<int>(cells) / (side * side);
+
+        //  the linear search is quadratic in territory size, seconds a pass
+        //  at 16K cells each
+        if (perTerritory <= 16384) {
+            LegacyGrowTerritories linear(map, seeds);
+            sprintf(what, "grow %dK linear", perTerritory / 1024);
+            report("territory", size, what, bestOf(1, linear), cells);
+        }
+        GrowTerritories grow(map, seeds);
+        sprintf(what, "grow %dK plane", perTerritory / 1024);
+        report("territory", size, what, bestOf(runs, grow), cells);
+
+        TerritoryLookup lookup(map, grow.territories);
+        report("territory", size, "lookup every cell", bestOf(runs, lookup), cells);
+
+        ReassignTerritories reassign(map, grow.territories);
+        report("territory", size, "reassign owners", bestOf(runs, reassign), cells);
+    }
+}
+
+//  ---------------------------------------------------------------------------
+
+struct Benchmark
+{
+    const char* name;
+    void (*run)();
+};
+
+static const Benchmark BENCHMARKS[] = {
+    { "sweep",    benchSweep },
+    { "bitboard", benchBitboard },
+    { "bfs",      benchBfs },
+    { "order",    benchOrder },
+    { "load",     benchLoad },
+    { "territory", benchTerritory }
+};
+static const int BENCHMARK_COUNT = sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]);
+
+int main(int argc, char* argv[])
+{
+    for (int i=1; i < argc; ++i) {
+        bool found = false;
+        for (int b=0; b < BENCHMARK_COUNT; ++b) {
+            found = found || strcmp(argv[i], BENCHMARKS[b].name) == 0;
+        }
+        if (!found) {
+            fprintf(stderr, "hexbench: no benchmark named %s, there are:", argv[i]);
+            for (int b=0; b < BENCHMARK_COUNT; ++b) {
+                fprintf(stderr, " %s", BENCHMARKS[b].name);
+            }
+            fprintf(stderr, "\n");
+            return 1;
+        }
+    }
+
+    for (int b=0; b < BENCHMARK_COUNT; ++b) {
+        bool wanted = argc == 1;
+        for (int i=1; i < argc; ++i) {
+            wanted = wanted || strcmp(argv[i], BENCHMARKS[b].name) == 0;
+        }
+        if (wanted) {
+            BENCHMARKS[b].run();
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+//  Converts maps between the binary map format and its text form
+//
+//      hexmapconv -text map.hexmap map.txt     binary to text
+//      hexmapconv -binary map.txt map.hexmap   text to binary
+
+#include "HexMapFile.h"
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+using namespace war;
+
+using std::string;
+
+static int usage()
+{
+    fprintf(stderr, "usage: hexmapconv -text <in.hexmap> <out.txt>\n");
+    fprintf(stderr, "       hexmapconv -binary <in.txt> <out.hexmap>\n");
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4) {
+        return usage();
+    }
+    string mode(argv[1]);
+
+    if (mode == "-text") {
+        HexMapFile file;
+        if (!file.open(argv[2])) {
+            fprintf(stderr, "hexmapconv: %s is not a valid map file\n", argv[2]);
+            return 1;
+        }
+        std::ofstream out(argv[3]);
+        if (!file.writeText(out)) {
+            fprintf(stderr, "hexmapconv: unable to write %s\n", argv[3]);
+            return 1;
+        }
+    }
+    else if (mode == "-binary") {
+        std::ifstream in(argv[2]);
+        if (!in) {
+            fprintf(stderr, "hexmapconv: unable to read %s\n", argv[2]);
+            return 1;
+        }
+        if (!HexMapFile::readText(in, argv[3])) {
+            fprintf(stderr, "hexmapconv: %s is not a valid text map, or %s could not be written\n", argv[2], argv[3]);
+            return 1;
+        }
+    }
+    else {
+        return usage();
+    }
+    return 0;
+}
@@ -0,0 +1,984 @@
+//  Checks of the hex map structures against simple reference versions
+//
+//      hextest                 run every test
+//      hextest <name> ...      run the named tests
+//
+//  Exits non-zero if any check fails.  Maps are filled from a fixed seed so
+//  a failure repeats from run to run.
+
+#include "Hex.h"
+#include "HexComponents.h"
+#include "HexMapFile.h"
+#include "Territory.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace ci;
+using namespace war;
+
+using std::string;
+using std::vector;
+
+static int gFailures = 0;
+
+static void fail(const char* test, const char* format, ...)
+{
+    fprintf(stderr, "hextest: %s: ", test);
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, "\n");
+    ++gFailures;
+}
+
+//  Park-Miller, so every platform draws the same maps
+static unsigned int gRandom = 1;
+
+static int randomInt(int n)
+{
+    gRandom = static_cast<unsigned int>((gRandom * 16807ULL) % 2147483647ULL);
+    return static_cast<int>(gRandom % n);
+}
+
+//  ---------------------------------------------------------------------------
+//  components: HexComponentIndex kept up to date through random owner
+//  changes, checked against regions found with HexMap::connected()
+
+//  Compare every region of the index with connected(), false on the first
+//  difference
+static bool checkComponents(HexMap& map, HexComponentIndex& index, int owners, const char* when)
+{
+    Vec2i size = map.getSize();
+    vector<int> regionOf(map.getIndexLimit(), -1);
+    vector<int> idOfRegion;
+    vector<int> largest(owners, 0);
+    HexConnectivity conn;
+
+    for (int x=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y) {
+            HexCoord pos(x, y);
+            int cell = map.index(pos);
+            int owner = map.getOwner(cell);
+            if (owner < 0) {
+                if (index.componentId(pos) != -1 || index.componentSize(pos) != 0) {
+                    fail("components", "%s: unowned cell %d,%d has a component", when, x, y);
+                    return false;
+                }
+                continue;
+            }
+            if (regionOf[cell] >= 0) {
+                continue;
+            }
+
+            map.connected(pos, ConnectedByOwner(owner), conn);
+            int region = static_cast<int>(idOfRegion.size());
+            int id = index.componentId(pos);
+            idOfRegion.push_back(id);
+
+            //  every cell of the region has the same ID and no other region
+            //  shares it
+            for (int i=0; i < region; ++i) {
+                if (idOfRegion[i] == id) {
+                    fail("components", "%s: cell %d,%d shares component %d with another region",
+                         when, x, y, id);
+                    return false;
+                }
+            }
+            FOREACH (HexCoord& c, conn.cells) {
+                regionOf[map.index(c)] = region;
+                if (index.componentId(c) != id) {
+                    fail("components", "%s: cells %d,%d and %d,%d are connected but in components %d and %d",
+                         when, x, y, c.x, c.y, id, index.componentId(c));
+                    return false;
+                }
+            }
+
+            int cells = static_cast<int>(conn.cells.size());
+            if (index.componentSize(pos) != cells || index.componentOwner(id) != owner) {
+                fail("components", "%s: region at %d,%d has %d cells of owner %d, index says %d of %d",
+                     when, x, y, cells, owner, index.componentSize(pos), index.componentOwner(id));
+                return false;
+            }
+            largest[owner] = std::max(largest[owner], cells);
+        }
+    }
+
+    if (index.getComponentCount() != static_cast<int>(idOfRegion.size())) {
+        fail("components", "%s: %d regions, index counts %d", when,
+             static_cast<int>(idOfRegion.size()), index.getComponentCount());
+        return false;
+    }
+    for (int owner=0; owner < owners; ++owner) {
+        if (index.largestRegion(owner) != largest[owner]) {
+            fail("components", "%s: largest region of owner %d is %d, index says %d",
+                 when, owner, largest[owner], index.largestRegion(owner));
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testComponents()
+{
+    static const int sizes[][2] = { {1, 1}, {7, 5}, {16, 16}, {37, 29}, {64, 48} };
+    static const int owners = 3;
+    int splits = 0;
+
+    for (int s=0; s < 5; ++s) {
+        for (int order=HEX_ORDER_COLUMNS; order <= HEX_ORDER_TILED; ++order) {
+            Vec2i size(sizes[s][0], sizes[s][1]);
+            HexGrid grid;
+            HexMap map(grid, size.x, size.y, static_cast<HexCellOrder>(order));
+            HexComponentIndex index(map);
+            char when[64];
+
+            //  owned cells come and go with about even odds, so regions keep
+            //  merging and splitting at around half the map
+            int changes = 40 * size.x * size.y + 50;
+            for (int i=0; i < changes; ++i) {
+                int cell = map.index(HexCoord(randomInt(size.x), randomInt(size.y)));
+                int before = index.getComponentCount();
+                int owner = randomInt(2) ? -1 : randomInt(owners);
+                bool removing = map.getOwner(cell) >= 0 && owner < 0;
+                map.setOwner(cell, owner);
+
+                //  a removal leaving more regions than it started with split one
+                splits += removing && index.getComponentCount() > before;
+
+                //  a full check after every change on the small maps
+                if (size.x * size.y <= 256 || i % 97 == 0) {
+                    sprintf(when, "%dx%d order %d change %d", size.x, size.y, order, i);
+                    if (!checkComponents(map, index, owners, when)) {
+                        return;
+                    }
+                }
+            }
+
+            sprintf(when, "%dx%d order %d after clear", size.x, size.y, order);
+            map.clear();
+            if (!checkComponents(map, index, owners, when)) {
+                return;
+            }
+        }
+    }
+
+    if (splits == 0) {
+        fail("components", "no removal split a region");
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  regions: HexRegionLabeling on one and several threads, checked against
+//  regions found with HexMap::connected()
+
+struct ConnectedByLand
+{
+    bool operator()(HexCell cell) { return cell.getLand() != 0; }
+};
+
+static bool checkRegions(HexMap& map, HexRegionLabeling& labeling, HexRegionLabeling::Mode mode,
+                         const char* when)
+{
+    Vec2i size = map.getSize();
+    vector<bool> seen(map.getIndexLimit(), false);
+    vector<bool> used(labeling.getRegionCount(), false);
+    int regions = 0;
+    HexConnectivity conn;
+
+    for (int x=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y) {
+            HexCoord pos(x, y);
+            int cell = map.index(pos);
+            int owner = map.getOwner(cell);
+            bool member = mode == HexRegionLabeling::BY_OWNER ? owner >= 0 : map.getLand(cell) != 0;
+            int id = labeling.regionAt(cell);
+            if (!member) {
+                if (id != -1) {
+                    fail("regions", "%s: cell %d,%d belongs to no region but has ID %d", when, x, y, id);
+                    return false;
+                }
+                continue;
+            }
+            if (seen[cell]) {
+                continue;
+            }
+
+            if (mode == HexRegionLabeling::BY_OWNER) {
+                map.connected(pos, ConnectedByOwner(owner), conn);
+            }
+            else {
+                map.connected(pos, ConnectedByLand(), conn);
+            }
+            if (id < 0 || id >= labeling.getRegionCount() || used[id]) {
+                fail("regions", "%s: region at %d,%d has ID %d, new IDs expected", when, x, y, id);
+                return false;
+            }
+            used[id] = true;
+            ++regions;
+
+            HexCoord min = pos;
+            HexCoord max = pos;
+            FOREACH (HexCoord& c, conn.cells) {
+                seen[map.index(c)] = true;
+                if (labeling.regionAt(map, c) != id) {
+                    fail("regions", "%s: cells %d,%d and %d,%d are connected but in regions %d and %d",
+                         when, x, y, c.x, c.y, id, labeling.regionAt(map, c));
+                    return false;
+                }
+                min = HexCoord(std::min(min.x, c.x), std::min(min.y, c.y));
+                max = HexCoord(std::max(max.x, c.x), std::max(max.y, c.y));
+            }
+
+            const HexRegionStats& stats = labeling.getRegions()[id];
+            int expectOwner = mode == HexRegionLabeling::BY_OWNER ? owner : -1;
+            if (stats.size != static_cast<int>(conn.cells.size()) || stats.owner != expectOwner
+                || stats.min != min || stats.max != max) {
+                fail("regions", "%s: region %d at %d,%d has wrong statistics", when, id, x, y);
+                return false;
+            }
+        }
+    }
+
+    if (regions != labeling.getRegionCount()) {
+        fail("regions", "%s: %d regions, labelling has %d", when, regions, labeling.getRegionCount());
+        return false;
+    }
+    return true;
+}
+
+static void testRegions()
+{
+    //  tall enough for several bands of chunk rows
+    static const int sizes[][2] = { {7, 5}, {37, 29}, {50, 100}, {70, 130} };
+    static const int threadCounts[] = { 1, 2, 5 };
+
+    for (int s=0; s < 4; ++s) {
+        for (int order=HEX_ORDER_COLUMNS; order <= HEX_ORDER_TILED; ++order) {
+            Vec2i size(sizes[s][0], sizes[s][1]);
+            HexGrid grid;
+            HexMap map(grid, size.x, size.y, static_cast<HexCellOrder>(order));
+
+            //  blotches of land and owners, leaving some chunks unwritten
+            for (int i=0; i < size.x * size.y / 2; ++i) {
+                HexCoord pos(randomInt(size.x), randomInt(size.y));
+                if (map.chunkIndex(pos) % 5 == 4) {
+                    continue;
+                }
+                int cell = map.index(pos);
+                map.setLand(cell, randomInt(3) != 0);
+                map.setOwner(cell, randomInt(4) - 1);
+            }
+
+            for (int t=0; t < 3; ++t) {
+                for (int mode=HexRegionLabeling::BY_OWNER; mode <= HexRegionLabeling::BY_LAND; ++mode) {
+                    HexRegionLabeling labeling;
+                    labeling.label(map, static_cast<HexRegionLabeling::Mode>(mode), threadCounts[t]);
+                    char when[64];
+                    sprintf(when, "%dx%d order %d threads %d mode %d", size.x, size.y, order,
+                            threadCounts[t], mode);
+                    if (!checkRegions(map, labeling, static_cast<HexRegionLabeling::Mode>(mode), when)) {
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  mapfile: binary map files round trip, and damaged or out of range files
+//  and text maps are turned away
+
+static const char* MAP_FILE_PATH = "hextest.hexmap";
+
+//  Overwrite bytes of a file in place
+static void patchFile(const char* path, size_t offset, const void* data, size_t size)
+{
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(offset);
+    file.write(static_cast<const char*>(data), size);
+}
+
+static bool readsText(const string& text)
+{
+    std::istringstream in(text);
+    return HexMapFile::readText(in, MAP_FILE_PATH);
+}
+
+static void testMapFile()
+{
+    HexGrid grid;
+    Vec2i size(40, 37);
+    HexMap map(grid, size.x, size.y);
+    for (int i=0; i < 300; ++i) {
+        int cell = map.index(HexCoord(randomInt(size.x), randomInt(size.y)));
+        map.setOwner(cell, randomInt(5) - 1);
+        map.setLand(cell, randomInt(2));
+        map.setColor(cell, ColorA(randomInt(4) / 3.0f, 0.5f, 0.25f, 1.0f));
+    }
+    vector<Territory> territories;
+    for (int t=0; t < 3; ++t) {
+        HexCoord origin(randomInt(size.x), randomInt(size.y));
+        territories.push_back(Territory(origin));
+        for (int i=0; i < 5 + t; ++i) {
+            HexCoord cell(randomInt(size.x), randomInt(size.y));
+            territories.back().addCell(cell);
+        }
+    }
+
+    if (!HexMapFile::save(MAP_FILE_PATH, map, territories)) {
+        fail("mapfile", "unable to write %s", MAP_FILE_PATH);
+        return;
+    }
+
+    //  everything reads back as written
+    {
+        HexMapFile file;
+        HexMap loaded(grid, size.x, size.y);
+        vector<Territory> loadedTerritories;
+        if (!file.open(MAP_FILE_PATH) || !file.load(loaded) || !file.loadTerritories(loadedTerritories)) {
+            fail("mapfile", "unable to read back a saved map");
+            return;
+        }
+        for (int x=0; x < size.x; ++x) {
+            for (int y=0; y < size.y; ++y) {
+                HexCoord pos(x, y);
+                if (loaded.at(pos).getOwner() != map.at(pos).getOwner() 
+                        || loaded.at(pos).getLand() != map.at(pos).getLand() 
+                        || loaded.at(pos).getColor() != map.at(pos).getColor()) {
+                    fail("mapfile", "cell %d,%d differs after loading", x, y);
+                    return;
+                }
+            }
+        }
+        bool same = loadedTerritories.size() == territories.size();
+        for (size_t t=0; same && t < territories.size(); ++t) {
+            same = loadedTerritories[t].mOrigin == territories[t].mOrigin 
+                && loadedTerritories[t].mCells == territories[t].mCells;
+        }
+        if (!same) {
+            fail("mapfile", "territories differ after loading");
+        }
+    }
+
+    //  a territory whose cells run past the end of the file
+    HexMapFileHeader h;
+    {
+        std::ifstream in(MAP_FILE_PATH, std::ios::binary);
+        in.read(reinterpret_cast<char*>(&h), sizeof(h));
+    }
+    size_t record = static_cast<size_t>(h.territoryOffset) + sizeof(HexTerritoryRecord);
+    HexTerritoryRecord saved;
+    {
+        std::ifstream in(MAP_FILE_PATH, std::ios::binary);
+        in.seekg(record);
+        in.read(reinterpret_cast<char*>(&saved), sizeof(saved));
+    }
+    HexTerritoryRecord damaged = saved;
+    damaged.cellCount = 1000;
+    patchFile(MAP_FILE_PATH, record, &damaged, sizeof(damaged));
+    {
+        HexMapFile file;
+        if (file.open(MAP_FILE_PATH)) {
+            fail("mapfile", "opened a file with territory cells past its end");
+        }
+    }
+    damaged = saved;
+    damaged.firstCell = 0xfffffff0u;
+    patchFile(MAP_FILE_PATH, record, &damaged, sizeof(damaged));
+    {
+        HexMapFile file;
+        if (file.open(MAP_FILE_PATH)) {
+            fail("mapfile", "opened a file with a territory's first cell past its end");
+        }
+    }
+    patchFile(MAP_FILE_PATH, record, &saved, sizeof(saved));
+
+    //  offsets and sizes so large their sums would wrap
+    boost::uint64_t savedChunk;
+    {
+        std::ifstream in(MAP_FILE_PATH, std::ios::binary);
+        in.seekg(static_cast<size_t>(h.chunkTableOffset));
+        in.read(reinterpret_cast<char*>(&savedChunk), sizeof(savedChunk));
+    }
+    boost::uint64_t wrapping = ~boost::uint64_t(63);
+    patchFile(MAP_FILE_PATH, static_cast<size_t>(h.chunkTableOffset), &wrapping, sizeof(wrapping));
+    {
+        HexMapFile file;
+        if (!file.open(MAP_FILE_PATH)) {
+            fail("mapfile", "unable to open a file with a damaged chunk offset");
+        }
+        else if (file.getChunk(0) != 0) {
+            fail("mapfile", "read a chunk at offset %llx", (unsigned long long)wrapping);
+        }
+    }
+    patchFile(MAP_FILE_PATH, static_cast<size_t>(h.chunkTableOffset), &savedChunk, sizeof(savedChunk));
+
+    HexMapFileHeader damagedHeader = h;
+    damagedHeader.width = 0x7ffffff0;
+    patchFile(MAP_FILE_PATH, 0, &damagedHeader, sizeof(damagedHeader));
+    {
+        HexMapFile file;
+        if (file.open(MAP_FILE_PATH)) {
+            fail("mapfile", "opened a file %d cells wide", damagedHeader.width);
+        }
+    }
+    damagedHeader = h;
+    damagedHeader.chunkTableOffset = ~boost::uint64_t(7);
+    patchFile(MAP_FILE_PATH, 0, &damagedHeader, sizeof(damagedHeader));
+    {
+        HexMapFile file;
+        if (file.open(MAP_FILE_PATH)) {
+            fail("mapfile", "opened a file with its chunk table at %llx", 
+                 (unsigned long long)damagedHeader.chunkTableOffset);
+        }
+    }
+    patchFile(MAP_FILE_PATH, 0, &h, sizeof(h));
+
+    //  a territory cell off the map opens, but the territories don't load
+    size_t cells = static_cast<size_t>(h.territoryOffset) + h.territoryCount * sizeof(HexTerritoryRecord);
+    boost::int32_t offMap[2] = { size.x, 0 };
+    patchFile(MAP_FILE_PATH, cells, offMap, sizeof(offMap));
+    {
+        HexMapFile file;
+        vector<Territory> loadedTerritories(1, Territory(HexCoord(0, 0)));
+        if (!file.open(MAP_FILE_PATH)) {
+            fail("mapfile", "unable to open a file with a territory cell off the map");
+        }
+        else if (file.loadTerritories(loadedTerritories) || !loadedTerritories.empty()) {
+            fail("mapfile", "loaded a territory cell off the map");
+        }
+    }
+
+    //  text maps, a valid one then values that don't fit the map
+    string head = "hexmap 1\nsize 4 3\n";
+    string tail = "end\n";
+    if (!readsText(head + "cell 1 2 3 1 0.5 0.5 0.5 1\nterritory 1 1 2 1 1 3 2\n" + tail)) {
+        fail("mapfile", "rejected a valid text map");
+    }
+    static const char* invalid[] = {
+        "cell 1 2 32768 1 0.5 0.5 0.5 1\n",
+        "cell 1 2 -2 1 0.5 0.5 0.5 1\n",
+        "cell 1 2 0 256 0.5 0.5 0.5 1\n",
+        "cell 1 2 0 -1 0.5 0.5 0.5 1\n",
+        "cell 4 0 0 1 0.5 0.5 0.5 1\n",
+        "territory 1 1 2 1 1 4 0\n",
+        "territory 1 1 1 0 -1\n"
+    };
+    for (int i=0; i < 7; ++i) {
+        if (readsText(head + invalid[i] + tail)) {
+            fail("mapfile", "accepted the text map line %s", invalid[i]);
+        }
+    }
+
+    remove(MAP_FILE_PATH);
+}
+
+//  ---------------------------------------------------------------------------
+//  palette: a palette mode map's palette holds the colors in use, across
+//  clear() and undo
+
+static void testPalette()
+{
+    HexGrid grid;
+    Vec2i size(64, 48);
+    HexMap map(grid, size.x, size.y);
+    map.setColorMode(HEX_PALETTE_COLOR);
+
+    //  generations of random colors as the editor's 'g' key makes them
+    for (int generation=0; generation < 40; ++generation) {
+        map.clear();
+        if (map.getPalette().size() != 1) {
+            fail("palette", "generation %d: %d palette entries after clear()", generation, map.getPalette().size());
+            return;
+        }
+        for (int c=0; c < 10; ++c) {
+            ColorA color(randomInt(256) / 255.0f, randomInt(256) / 255.0f, randomInt(256) / 255.0f, 1.0f);
+            for (int i=0; i < 50; ++i) {
+                map.setColor(map.index(HexCoord(randomInt(size.x), randomInt(size.y))), color);
+            }
+        }
+    }
+    if (map.getPalette().size() > 11) {
+        fail("palette", "%d palette entries for 10 colors", map.getPalette().size());
+    }
+
+    //  writing a cell's own color changes nothing
+    int entries = map.getPalette().size();
+    for (int x=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y) {
+            int cell = map.index(HexCoord(x, y));
+            map.setColor(cell, map.getColor(cell));
+        }
+    }
+    if (map.getPalette().size() != entries) {
+        fail("palette", "rewriting every cell's color took the palette from %d to %d entries", 
+             entries, map.getPalette().size());
+    }
+
+    //  undo across a clear() gets the colors back with their palette
+    vector<ColorA> before;
+    for (int x=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y) {
+            before.push_back(map.at(HexCoord(x, y)).getColor());
+        }
+    }
+    HexMapSnapshotPtr snapshot = map.snapshot();
+    map.clear();
+    map.setColor(map.index(HexCoord(3, 3)), ColorA(0.0f, 1.0f, 0.0f, 1.0f));
+    map.restore(*snapshot);
+    for (int x=0, i=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y, ++i) {
+            if (map.at(HexCoord(x, y)).getColor() != before[i]) {
+                fail("palette", "cell %d,%d changed color after undoing a clear()", x, y);
+                return;
+            }
+        }
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  territory: the map's territory plane through copy-on-write, clear(),
+//  restore() and both file forms
+
+//  Compare a map's territory plane with the expected IDs, by column
+static bool checkTerritories(HexMap& map, const vector<int>& expected, const char* when)
+{
+    Vec2i size = map.getSize();
+    for (int x=0, i=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y, ++i) {
+            int territory = map.getTerritory(map.index(HexCoord(x, y)));
+            if (territory != expected[i]) {
+                fail("territory", "%s: cell %d,%d in territory %d, expected %d", when, x, y, territory, expected[i]);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static void testTerritories()
+{
+    HexGrid grid;
+    Vec2i size(100, 90);
+    HexMap map(grid, size.x, size.y);
+
+    //  unwritten chunks are in no territory, and stay unwritten
+    map.setTerritory(map.index(HexCoord(50, 50)), -1);
+    if (map.getResidentChunkCount() != 0) {
+        fail("territory", "writing no territory allocated a chunk");
+    }
+
+    vector<int> expected(size.x * size.y, -1);
+    for (int i=0; i < 2000; ++i) {
+        HexCoord pos(randomInt(size.x), randomInt(size.y));
+        int territory = randomInt(12) - 1;
+        map.setTerritory(map.index(pos), territory);
+        expected[pos.x * size.y + pos.y] = territory;
+    }
+    if (!checkTerritories(map, expected, "after setTerritory()")) {
+        return;
+    }
+
+    //  a snapshot keeps its territories while the map changes
+    HexMapSnapshotPtr snapshot = map.snapshot();
+    vector<int> before = expected;
+    for (int i=0; i < 500; ++i) {
+        HexCoord pos(randomInt(size.x), randomInt(size.y));
+        map.setTerritory(map.index(pos), 20);
+        expected[pos.x * size.y + pos.y] = 20;
+    }
+    for (int x=0, i=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y, ++i) {
+            if (snapshot->getTerritory(snapshot->index(HexCoord(x, y))) != before[i]) {
+                fail("territory", "cell %d,%d changed in a snapshot", x, y);
+                return;
+            }
+        }
+    }
+
+    //  clear() resets owners but keeps territories, on chunks with no land
+    //  too
+    map.clear();
+    if (!checkTerritories(map, expected, "after clear()")) {
+        return;
+    }
+
+    //  restore() brings back the territories with the cells
+    map.clearTerritories();
+    std::fill(expected.begin(), expected.end(), -1);
+    if (!checkTerritories(map, expected, "after clearTerritories()")) {
+        return;
+    }
+    map.restore(*snapshot);
+    if (!checkTerritories(map, before, "after restore()")) {
+        return;
+    }
+
+    //  saved chunks carry the plane, and the text form rebuilds it from the
+    //  territory lists
+    vector<Territory> territories;
+    for (int t=0; t < 11; ++t) {
+        territories.push_back(Territory(HexCoord(0, 0)));
+    }
+    for (int x=0, i=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y, ++i) {
+            if (before[i] >= 0) {
+                HexCoord pos(x, y);
+                territories[before[i]].addCell(pos);
+            }
+        }
+    }
+    if (!HexMapFile::save(MAP_FILE_PATH, map, territories)) {
+        fail("territory", "unable to write %s", MAP_FILE_PATH);
+        return;
+    }
+    std::ostringstream text;
+    {
+        HexMapFile file;
+        HexMap loaded(grid, size.x, size.y);
+        if (!file.open(MAP_FILE_PATH) || !file.load(loaded)) {
+            fail("territory", "unable to read back a saved map");
+            return;
+        }
+        for (int x=0, i=0; x < size.x; ++x) {
+            for (int y=0; y < size.y; ++y, ++i) {
+                if (file.getTerritory(HexCoord(x, y)) != before[i]) {
+                    fail("territory", "cell %d,%d in the wrong territory in the file", x, y);
+                    return;
+                }
+            }
+        }
+        if (!checkTerritories(loaded, before, "after loading") || !file.writeText(text)) {
+            return;
+        }
+    }
+    {
+        HexMapFile file;
+        HexMap loaded(grid, size.x, size.y);
+        if (!readsText(text.str()) || !file.open(MAP_FILE_PATH) || !file.load(loaded)) {
+            fail("territory", "unable to read back the text form");
+            return;
+        }
+        checkTerritories(loaded, before, "after the text form");
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  territories: TerritoryList keeps its cell lists and the map's plane in
+//  step, and refuses territories the plane cannot number
+
+static bool listMatchesPlane(HexMap& map, TerritoryList& territories, const char* when)
+{
+    int listed = 0;
+    for (int t=0; t < territories.size(); ++t) {
+        FOREACH (const HexCoord& cell, territories[t].mCells) {
+            if (territories.territoryAt(map, cell) != t) {
+                fail("territories", "%s: cell %d,%d listed in territory %d, the map has %d", 
+                     when, cell.x, cell.y, t, territories.territoryAt(map, cell));
+                return false;
+            }
+            ++listed;
+        }
+    }
+    Vec2i size = map.getSize();
+    int inPlane = 0;
+    for (int x=0; x < size.x; ++x) {
+        for (int y=0; y < size.y; ++y) {
+            inPlane += territories.territoryAt(map, HexCoord(x, y)) >= 0;
+        }
+    }
+    if (inPlane != listed) {
+        fail("territories", "%s: %d cells listed, %d in the map's plane", when, listed, inPlane);
+        return false;
+    }
+    return true;
+}
+
+static void testTerritoryList()
+{
+    HexGrid grid;
+    Vec2i size(60, 50);
+    HexMap map(grid, size.x, size.y);
+    TerritoryList territories;
+
+    if (territories.add(map, HexCoord(size.x, 0)) != -1 || territories.size() != 0) {
+        fail("territories", "added a territory with its origin off the map");
+    }
+    for (int t=0; t < 8; ++t) {
+        HexCoord origin(randomInt(size.x), randomInt(size.y));
+        int id = territories.add(map, origin);
+        if (id != t || territories.territoryAt(map, origin) != t) {
+            fail("territories", "territory %d got ID %d, its origin is in %d", 
+                 t, id, territories.territoryAt(map, origin));
+            return;
+        }
+    }
+
+    //  cells moved between territories leave their old list
+    for (int i=0; i < 5000; ++i) {
+        territories.addCell(map, randomInt(8), HexCoord(randomInt(size.x), randomInt(size.y)));
+    }
+    if (!listMatchesPlane(map, territories, "after addCell()")) {
+        return;
+    }
+
+    territories.setOwner(map, 3, 7);
+    FOREACH (const HexCoord& cell, territories[3].mCells) {
+        if (map.getOwner(map.index(cell)) != 7) {
+            fail("territories", "cell %d,%d of territory 3 not handed to owner 7", cell.x, cell.y);
+            return;
+        }
+    }
+
+    //  loaded lists are indexed, a cell listed twice going to the last
+    vector<Territory> loaded(territories.getTerritories());
+    HexCoord twice = loaded[0].mCells.front();
+    loaded[1].addCell(twice);
+    if (!territories.assign(map, loaded) || !listMatchesPlane(map, territories, "after assign()")) {
+        return;
+    }
+    if (territories.territoryAt(map, twice) != 1) {
+        fail("territories", "a cell listed by territories 0 and 1 went to %d", territories.territoryAt(map, twice));
+    }
+
+    //  the plane numbers HEX_MAX_TERRITORIES territories and no more
+    loaded.assign(HEX_MAX_TERRITORIES + 1, Territory(HexCoord(0, 0)));
+    if (territories.assign(map, loaded) || territories.size() != 0) {
+        fail("territories", "assigned %d territories", HEX_MAX_TERRITORIES + 1);
+    }
+    HexMap large(grid, 256, 129);
+    territories.clear(large);
+    for (int x=0, id=0; x < 256; ++x) {
+        for (int y=0; y < 128; ++y, ++id) {
+            if (territories.add(large, HexCoord(x, y)) != id) {
+                fail("territories", "unable to add territory %d", id);
+                return;
+            }
+        }
+    }
+    if (territories.add(large, HexCoord(0, 128)) != -1) {
+        fail("territories", "added territory %d", HEX_MAX_TERRITORIES);
+    }
+    if (!listMatchesPlane(large, territories, "with every ID used")) {
+        return;
+    }
+
+    //  nor will a text map hold more
+    std::ostringstream text;
+    text << "hexmap 2\nsize 4 3\n";
+    for (int t=0; t <= HEX_MAX_TERRITORIES; ++t) {
+        text << "territory 0 0 1 0 0\n";
+    }
+    text << "end\n";
+    if (readsText(text.str())) {
+        fail("territories", "read a text map with %d territories", HEX_MAX_TERRITORIES + 1);
+    }
+}
+
+//  ---------------------------------------------------------------------------
+//  procedural: the procedural shader's cell lookup and border neighbour,
+//  data/procedural_hex.glsl, compiled as C++ and checked against HexGrid
+//  with the spacing HexRender uses.  The file is shared with the shader, so
+//  a change to it is tested here.  C++ does the unsuffixed literal
+//  arithmetic in double, so points on a side may round either way.
+
+static const Vec2f PROCEDURAL_SPACING(1.5f, 1.732050807f);
+
+//  The GLSL procedural_hex.glsl uses
+namespace glsl {
+
+struct vec2
+{
+    float x, y;
+    vec2() : x(0), y(0) { }
+    explicit vec2(float v) : x(v), y(v) { }
+    vec2(float x, float y) : x(x), y(y) { }
+};
+inline vec2 operator+(const vec2& a, const vec2& b) { return vec2(a.x + b.x, a.y + b.y); }
+inline vec2 operator-(const vec2& a, const vec2& b) { return vec2(a.x - b.x, a.y - b.y); }
+inline vec2 operator*(const vec2& a, float s) { return vec2(a.x * s, a.y * s); }
+
+inline float floor(float v) { return std::floor(v); }
+inline float ceil(float v) { return std::ceil(v); }
+inline float abs(float v) { return std::fabs(v); }
+inline float cos(float v) { return std::cos(v); }
+inline float sin(float v) { return std::sin(v); }
+inline float radians(float degrees) { return degrees * (3.14159265f / 180.0f); }
+inline float mod(float x, float y) { return x - y * std::floor(x / y); }
+inline float dot(const vec2& a, const vec2& b) { return a.x * b.x + a.y * b.y; }
+
+#define uniform static
+#include "../data/procedural_hex.glsl"
+#undef uniform
+
+}
+
+static HexCoord shaderWorldToHex(const Vec2f& pos)
+{
+    glsl::vec2 hex = glsl::worldToHex(glsl::vec2(pos.x, pos.y));
+    return HexCoord(static_cast<int>(hex.x), static_cast<int>(hex.y));
+}
+
+static Vec2f shaderHexToWorld(const HexCoord& hex)
+{
+    glsl::vec2 world = glsl::hexToWorld(glsl::vec2(float(hex.x), float(hex.y)));
+    return Vec2f(world.x, world.y);
+}
+
+//  The cell across the side of hex nearest world, as the border test finds it
+static HexCoord shaderAcross(const HexCoord& hex, const Vec2f& world)
+{
+    glsl::vec2 centre = glsl::hexToWorld(glsl::vec2(float(hex.x), float(hex.y)));
+    glsl::vec2 normal = glsl::nearestSide(glsl::vec2(world.x, world.y) - centre);
+    glsl::vec2 across = glsl::acrossSide(centre, normal);
+    return HexCoord(static_cast<int>(across.x), static_cast<int>(across.y));
+}
+
+static void testProcedural()
+{
+    HexGrid grid;
+    grid.setSpacing(PROCEDURAL_SPACING.x, PROCEDURAL_SPACING.y);
+    const Vec2f& spacing = PROCEDURAL_SPACING;
+    glsl::spacing = glsl::vec2(spacing.x, spacing.y);
+
+    //  cell centres either side of zero, where odd columns need GLSL's
+    //  mod() and negative rows the rounding towards zero
+    for (int x=-20; x <= 20; ++x) {
+        for (int y=-20; y <= 20; ++y) {
+            HexCoord hex(x, y);
+            Vec3f centre = grid.HexToWorld(hex);
+            if ((shaderHexToWorld(hex) - Vec2f(centre.x, centre.y)).length() > 1e-4f) {
+                fail("procedural", "cell %d,%d centred away from HexGrid::HexToWorld", x, y);
+                return;
+            }
+            HexCoord found = shaderWorldToHex(Vec2f(centre.x, centre.y));
+            if (found != hex) {
+                fail("procedural", "centre of cell %d,%d found in cell %d,%d", x, y, found.x, found.y);
+                return;
+            }
+        }
+    }
+
+    //  random points agree with HexGrid::WorldToHex but for points on a
+    //  side, where single and double precision can round either way
+    const float EPSILON = 1e-3f;
+    int ties = 0;
+    const int POINTS = 1000000;
+    for (int i=0; i < POINTS; ++i) {
+        Vec2f pos((randomInt(2000001) - 1000000) * 4e-5f, (randomInt(2000001) - 1000000) * 4e-5f);
+        HexCoord expected = grid.WorldToHex(Vec3f(pos.x, pos.y, 0));
+        HexCoord found = shaderWorldToHex(pos);
+        if (found == expected) {
+            continue;
+        }
+        bool tie = false;
+        for (int d=0; d < 4 && !tie; ++d) {
+            Vec2f nudge(d < 2 ? (d ? EPSILON : -EPSILON) : 0.0f, d < 2 ? 0.0f : (d == 3 ? EPSILON : -EPSILON));
+            tie = grid.WorldToHex(Vec3f(pos.x + nudge.x, pos.y + nudge.y, 0)) == found;
+        }
+        if (!tie) {
+            fail("procedural", "%f,%f found in cell %d,%d, HexGrid has %d,%d", 
+                 pos.x, pos.y, found.x, found.y, expected.x, expected.y);
+            return;
+        }
+        ++ties;
+    }
+    if (ties > POINTS / 1000) {
+        fail("procedural", "%d of %d points on a side", ties, POINTS);
+    }
+
+    //  just inside each side of a cell, the border test looks across to the
+    //  neighbour sharing that side
+    for (int x=-20; x <= 20; ++x) {
+        for (int y=-20; y <= 20; ++y) {
+            HexCoord hex(x, y);
+            Vec2f centre = shaderHexToWorld(hex);
+            vector<HexCoord> neighbours = grid.adjacent(hex).toVector();
+            for (int i=0; i < 6; ++i) {
+                float angle = (30.0f + 60.0f * i) * (3.14159265f / 180.0f);
+                Vec2f n(std::cos(angle), std::sin(angle));
+                Vec2f pos = centre + n * (0.5f * spacing.y - 0.01f);
+                if (shaderWorldToHex(pos) != hex) {
+                    fail("procedural", "inside side %d of cell %d,%d is not in the cell", i, x, y);
+                    return;
+                }
+
+                //  the neighbour whose centre lies along the side's normal
+                HexCoord side = neighbours[0];
+                float nearest = 1e30f;
+                FOREACH (const HexCoord& other, neighbours) {
+                    Vec3f w = grid.HexToWorld(other);
+                    float d = (Vec2f(w.x, w.y) - (centre + n * spacing.y)).length();
+                    if (d < nearest) {
+                        nearest = d;
+                        side = other;
+                    }
+                }
+                HexCoord across = shaderAcross(hex, pos);
+                if (across != side) {
+                    fail("procedural", "side %d of cell %d,%d borders %d,%d, the shader looks at %d,%d",
+                         i, x, y, side.x, side.y, across.x, across.y);
+                    return;
+                }
+            }
+        }
+    }
+}
+
+struct Test
+{
+    const char* name;
+    void (*run)();
+};
+
+static const Test TESTS[] = {
+    { "components", testComponents },
+    { "regions",    testRegions },
+    { "mapfile",    testMapFile },
+    { "palette",    testPalette },
+    { "territory",  testTerritories },
+    { "territories", testTerritoryList },
+    { "procedural", testProcedural }
+};
+static const int TEST_COUNT = sizeof(TESTS) / sizeof(TESTS[0]);
+
+int main(int argc, char* argv[])
+{
+    for (int i=1; i < argc; ++i) {
+        bool found = false;
+        for (int t=0; t < TEST_COUNT; ++t) {
+            found = found || strcmp(argv[i], TESTS[t].name) == 0;
+        }
+        if (!found) {
+            fprintf(stderr, "hextest: no test named %s, there are:", argv[i]);
+            for (int t=0; t < TEST_COUNT; ++t) {
+                fprintf(stderr, " %s", TESTS[t].name);
+            }
+            fprintf(stderr, "\n");
+            return 1;
+        }
+    }
+
+    for (int t=0; t < TEST_COUNT; ++t) {
+        bool wanted = argc == 1;
+        for (int i=1; i < argc; ++i) {
+            wanted = wanted || strcmp(argv[i], TESTS[t].name) == 0;
+        }
+        if (wanted) {
+            int failures = gFailures;
+            TESTS[t].run();
+            printf("%-12s %s\n", TESTS[t].name, gFailures == failures ? "ok" : "FAILED");
+        }
+    }
+    return gFailures ? 1 : 0;
+}